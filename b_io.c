@@ -22,6 +22,11 @@ Siqi Guo, 918209895, Guo-1999
 #include <fcntl.h>
 #include "b_io.h"
 #include "mfs.h"
+#include "compress.h"
+#include "extent.h"
+#include "inode.h"
+#include "journal.h"
+#include "defrag.h"
 #include <pthread.h>
 
 #define MAXFCBS 20
@@ -38,15 +43,21 @@ typedef struct b_fcb
 	char *buf;				 // holds the open file buffer
 	uint64_t index;			 // holds current index of the buffer
 	uint64_t buflen;		 // holds how many valid bytes are in the buffer
-	fdDir *parent;			 // holds the parent directory of the file
-	char *trueFileName;		 // holds the true file name not the path
+	struct fs_diriteminfo parentEntry; // holds the . entry of the parent directory
+	uint64_t parentVersion;			   // holds readVersion of the parent, see followDirectoryMoves()
+	struct fs_diriteminfo entry;	   // holds the entry of the file, SPACE_FREE if it doesn't exist
+	char trueFileName[MAX_NAME_LENGTH]; // holds the true file name not the path
 	unsigned short detector; // holds the functionality of the method
+	compressReader *zReader; // holds the chunk index if the file is compressed
+	fsVolume *volume;		 // holds the volume the file is on
 } b_fcb;
 
 b_fcb fcbArray[MAXFCBS];
 
 int startup = 0; //Indicates that this has not been initialized
 
+void writeIntoVolume(int argfd, fdDir *parent);
+
 /**
  * @brief initializa our io of file system
  * 
@@ -81,13 +92,12 @@ int b_getFCB()
 }
 
 /**
- * @brief open the file and set up parent and file name
+ * @brief take a free fcb for a file on the volume
  * 
- * @param path the whole path to the file
- * @param flags not used, we rather use a detector for default
+ * @param volume the volume the file is on
  * @return 0-MAXFCBS for a fd, -1 for fail
  */
-int b_open(char *path, int flags)
+int b_reserveFCB(fsVolume *volume)
 {
 	//don't call b_close() since that requires an initialized fcb
 	if (startup == 0)
@@ -102,9 +112,10 @@ int b_open(char *path, int flags)
 
 	// get our own file descriptor
 	int returnFd = b_getFCB();
-	if (fcbArray[returnFd].fd != -2)
-	{ // unexpected error
+	if (returnFd < 0 || fcbArray[returnFd].fd != -2)
+	{ // all in use or unexpected error
 		eprintf("b_getFCB()");
+		pthread_mutex_unlock(&mutex);
 		return -1;
 	}
 	fcbArray[returnFd].fd = returnFd; // Save the linux file descriptor
@@ -116,51 +127,178 @@ int b_open(char *path, int flags)
 		return -1;
 	}
 
-	// NOTE: we assume the destination may hold path
-	// so we will do something like fs_mkdir()
-	char *pathBeforeLastSlash = malloc(strlen(path) + 1);
-	if (pathBeforeLastSlash == NULL)
+	// the fd keeps the volume, so b_read() and b_write() use the same one
+	currentVolume = volume;
+	fcbArray[returnFd].volume = volume;
+
+	// allocate our buffer later because b_read() and b_write() has different situation
+	// have not read anything yet
+	fcbArray[returnFd].parentEntry.space = SPACE_FREE;
+	fcbArray[returnFd].entry.space = SPACE_FREE;
+	fcbArray[returnFd].trueFileName[0] = '\0';
+	fcbArray[returnFd].buflen = 0;
+	fcbArray[returnFd].index = 0;
+	fcbArray[returnFd].detector = 0;
+	fcbArray[returnFd].buf = NULL;
+	fcbArray[returnFd].zReader = NULL;
+	return returnFd;
+}
+
+/**
+ * @brief open the file and set up parent and file name
+ * 
+ * @param path the whole path to the file
+ * @param flags not used, we rather use a detector for default
+ * @return 0-MAXFCBS for a fd, -1 for fail
+ */
+int b_open(char *path, int flags)
+{
+	return b_open_r(fsDefaultSession, path, flags);
+}
+
+/**
+ * @brief open the file with a path starting from the cwd of the session
+ * 
+ * @param session the session
+ * @param path the whole path to the file
+ * @param flags not used, we rather use a detector for default
+ * @return 0-MAXFCBS for a fd, -1 for fail
+ */
+int b_open_r(fsSession *session, char *path, int flags)
+{
+	int returnFd = b_reserveFCB(session->volume);
+	if (returnFd < 0)
 	{
-		eprintf("malloc() on pathBeforeLastSlash");
 		return -1;
 	}
-	strcpy(pathBeforeLastSlash, path);
-	fcbArray[returnFd].trueFileName = getPathByLastSlash(pathBeforeLastSlash);
+
+	// NOTE: we assume the destination may hold path
+	// so we will do something like fs_mkdir()
+	// the path is split in place, nothing is copied but the name
+	size_t parentLength;
+	const char *name = getNameByLastSlash(path, &parentLength);
 
 	// stop if there is no given file name
-	if (strcmp(fcbArray[returnFd].trueFileName, "") == 0)
-	{ // avoiding memory leak
+	if (strcmp(name, "") == 0)
+	{
 		printf("\nname should be given!!!\n");
-		fcbArray[returnFd].fd = -2;
-		free(pathBeforeLastSlash);
-		pathBeforeLastSlash = NULL;
+		fcbArray[returnFd].fd = -1;
 		return -2;
 	}
 
+	// truncate the name if it exceeds the max length
+	strncpy(fcbArray[returnFd].trueFileName, name, MAX_NAME_LENGTH - 1);
+	fcbArray[returnFd].trueFileName[MAX_NAME_LENGTH - 1] = '\0';
+
 	// find the directory that is going to store the file
-	fcbArray[returnFd].parent = getDirByPath(pathBeforeLastSlash);
+	refreshCwd(session);
+	fdDir *parent = getDirFromN(session->cwd, path, parentLength);
 
 	// error handle and avaliable space check
-	if (fcbArray[returnFd].parent == NULL)
-	{ // avoiding memory leak
-		fcbArray[returnFd].fd = -2;
-		free(pathBeforeLastSlash);
-		pathBeforeLastSlash = NULL;
+	if (parent == NULL)
+	{ // the caller never gets the fd, so free it here
+		fcbArray[returnFd].fd = -1;
 		return -2;
 	}
 
-	// free the unused buffer
-	free(pathBeforeLastSlash);
-	pathBeforeLastSlash = NULL;
+	// only the two entries are kept, the directory is read again to write the file
+	memcpy(&fcbArray[returnFd].parentEntry, parent->entryList, sizeof(struct fs_diriteminfo));
+	fcbArray[returnFd].parentVersion = parent->readVersion;
+	int i = findEntry(parent, fcbArray[returnFd].trueFileName, strlen(fcbArray[returnFd].trueFileName));
+	if (i >= 0)
+	{
+		memcpy(&fcbArray[returnFd].entry, parent->entryList + i, sizeof(struct fs_diriteminfo));
+	}
+	releaseDir(parent);
+	return (returnFd); // all set
+}
 
-	// allocate our buffer later because b_read() and b_write() has different situation
-	// have not read anything yet
-	fcbArray[returnFd].buflen = 0;
-	fcbArray[returnFd].index = 0;
-	fcbArray[returnFd].detector = 0;
+/**
+ * @brief open a file resolved by fs_lookup(), the entries found by
+ * the lookup are copied instead of walking the path again
+ * 
+ * @param handle the handle of a file
+ * @param flags not used, we rather use a detector for default
+ * @return 0-MAXFCBS for a fd, -1 for fail
+ */
+int b_openEntry(fsEntry *handle, int flags)
+{
+	if (handle->entry->fileType != TYPE_FILE)
+	{
+		return -1;
+	}
+
+	int returnFd = b_reserveFCB(handle->volume);
+	if (returnFd < 0)
+	{
+		return -1;
+	}
+
+	memcpy(&fcbArray[returnFd].parentEntry, handle->parent->entryList, sizeof(struct fs_diriteminfo));
+	fcbArray[returnFd].parentVersion = handle->parent->readVersion;
+	memcpy(&fcbArray[returnFd].entry, handle->entry, sizeof(struct fs_diriteminfo));
+	strcpy(fcbArray[returnFd].trueFileName, handle->entry->d_name);
 	return (returnFd); // all set
 }
 
+/**
+ * @brief find the file of a fd and load it for b_read() and b_seek()
+ * a compressed file only loads its chunk index here
+ * 
+ * @param argfd fd of the file to load
+ * @return 0 for success, -1 for fail
+ */
+int b_loadFile(int argfd)
+{
+	fcbArray[argfd].detector = FUNC_READ;
+	struct fs_diriteminfo *entry = &fcbArray[argfd].entry;
+	if (entry->space == SPACE_USED && entry->fileType == TYPE_FILE)
+	{
+		// the defragmenter can't move the extent between finding and reading it
+		beginExtentRead();
+
+		// the inode is newer than the entry copied when the file was opened
+		inode *node = getInode(entry->inodeNumber);
+		if (node != NULL)
+		{
+			entry->entryStartLocation = node->entryStartLocation;
+			entry->size = node->size;
+			entry->attributes = node->attributes;
+		}
+		touchInodeAccess(entry->inodeNumber);
+
+		// since we are giving a buffer, the size will be buflen
+		fcbArray[argfd].buflen = entry->size;
+
+		if (entry->attributes & ATTR_COMPRESSED)
+		{
+			fcbArray[argfd].zReader = openCompressReader(entry->entryStartLocation);
+			endExtentRead();
+			return fcbArray[argfd].zReader == NULL ? -1 : 0;
+		}
+
+		// whole blocks are read, so the buffer is sized by the block size of the volume
+		uint blockCount = getBlockCount(fcbArray[argfd].buflen);
+		fcbArray[argfd].buf = fsMalloc(blockCount * ourVCB->blockSize);
+		if (fcbArray[argfd].buf == NULL)
+		{
+			eprintf("malloc() on fcbArray[argfd].buf");
+			fcbArray[argfd].fd = -2;
+			endExtentRead();
+			return -1;
+		}
+
+		// reading the data into the buffer for outside to read
+		deviceRead(fcbArray[argfd].buf, blockCount, entry->entryStartLocation);
+		endExtentRead();
+		return 0;
+	}
+
+	// handle error of not find files
+	printf("\n%s is not existed in volume\n", fcbArray[argfd].trueFileName);
+	return -1;
+}
+
 // we chose to rewrite b_read() so it fits with fsshell.c
 // we could use the template to read all bytes into buffer
 // but this is not consistent with the lixux read()
@@ -182,46 +320,12 @@ int b_read(int argfd, char *buffer, int count)
 	{
 		return (-1);
 	}
+	currentVolume = fcbArray[argfd].volume;
 
 	// initialize the detector the first time it calls this function
-	// and find the file and records its data and size for reading
-	if (fcbArray[argfd].detector == 0)
+	if (fcbArray[argfd].detector == 0 && b_loadFile(argfd) != 0)
 	{
-		fcbArray[argfd].detector = FUNC_READ;
-		int i = 0;
-		for (; i < MAX_AMOUNT_OF_ENTRIES; i++)
-		{
-			if (fcbArray[argfd].parent->entryList[i].space == SPACE_USED &&
-				fcbArray[argfd].parent->entryList[i].fileType == TYPE_FILE &&
-				strcmp(fcbArray[argfd].parent->entryList[i].d_name, fcbArray[argfd].trueFileName) == 0)
-			{
-				// since we are giving a buffer, the size will be buflen
-				fcbArray[argfd].buflen = fcbArray[argfd].parent->entryList[i].size;
-
-				// NOTE: this can easily cause problem if buffer size is different
-				// must keep LBAread(), vcb, and b_io's buffer size the same
-				// getBlockCount() depends on vcb's buffer size
-				uint blockCount = getBlockCount(fcbArray[argfd].buflen);
-				fcbArray[argfd].buf = malloc(blockCount * B_CHUNK_SIZE);
-				if (fcbArray[argfd].buf == NULL)
-				{
-					eprintf("malloc() on fcbArray[argfd].buf");
-					fcbArray[argfd].fd = -2;
-					return -1;
-				}
-
-				// reading the data into the buffer for outside to read
-				LBAread(fcbArray[argfd].buf, blockCount, fcbArray[argfd].parent->entryList[i].entryStartLocation);
-				break;
-			}
-		}
-
-		// handle error of not find files
-		if (i == MAX_AMOUNT_OF_ENTRIES)
-		{
-			printf("\n%s is not existed in volume\n", fcbArray[argfd].trueFileName);
-			return -1;
-		}
+		return -1;
 	}
 
 	// it shouldn't do another functionality
@@ -234,7 +338,11 @@ int b_read(int argfd, char *buffer, int count)
 	// two conditions based on the remianing bytes
 	// NOTE: since it is outside buffer reading, we use the its size, which is count
 	int bytesToRead = 0;
-	uint64_t remainingBytes = fcbArray[argfd].buflen - fcbArray[argfd].index;
+	uint64_t remainingBytes = 0;
+	if (fcbArray[argfd].index < fcbArray[argfd].buflen)
+	{
+		remainingBytes = fcbArray[argfd].buflen - fcbArray[argfd].index;
+	}
 	if (remainingBytes != 0)
 	{
 		if (remainingBytes > count)
@@ -247,13 +355,82 @@ int b_read(int argfd, char *buffer, int count)
 		}
 		ldprintf("bytesToRead: %d", bytesToRead);
 
-		// copy the data using index as offset to change start location
-		memcpy(buffer, fcbArray[argfd].buf + fcbArray[argfd].index, bytesToRead);
+		// compressed files only decompress the chunks this read touches
+		if (fcbArray[argfd].zReader != NULL)
+		{
+			bytesToRead = compressReaderRead(fcbArray[argfd].zReader, fcbArray[argfd].index, buffer, bytesToRead);
+			if (bytesToRead < 0)
+			{
+				return -1;
+			}
+		}
+		else
+		{ // copy the data using index as offset to change start location
+			memcpy(buffer, fcbArray[argfd].buf + fcbArray[argfd].index, bytesToRead);
+		}
 		fcbArray[argfd].index += bytesToRead;
 	}
 	return bytesToRead;
 }
 
+/**
+ * @brief move the read position of an opened file
+ * 
+ * @param argfd fd of the file
+ * @param offset offset based on whence
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @return the new position, -1 for fail
+ */
+int b_seek(int argfd, off_t offset, int whence)
+{
+	if (startup == 0)
+		b_init(); //Initialize our system
+
+	if ((argfd < 0) || (argfd >= MAXFCBS) || fcbArray[argfd].fd == -1)
+	{
+		return (-1);
+	}
+	currentVolume = fcbArray[argfd].volume;
+
+	// seeking decides the fd is for reading, just like b_read()
+	if (fcbArray[argfd].detector == 0 && b_loadFile(argfd) != 0)
+	{
+		return -1;
+	}
+
+	// writing only appends into our buffer, so it can't seek
+	if (fcbArray[argfd].detector != FUNC_READ)
+	{
+		eprintf("no mix use of functionality!");
+		return -1;
+	}
+
+	int64_t position;
+	switch (whence)
+	{
+	case SEEK_SET:
+		position = offset;
+		break;
+	case SEEK_CUR:
+		position = fcbArray[argfd].index + offset;
+		break;
+	case SEEK_END:
+		position = fcbArray[argfd].buflen + offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (position < 0)
+	{
+		return -1;
+	}
+
+	// nothing is read here, the next b_read() loads what it touches
+	fcbArray[argfd].index = position;
+	return position;
+}
+
 /**
  * @brief wirte the data from the passed in buffer into our buffer
  * 
@@ -267,10 +444,12 @@ int b_write(int argfd, char *buffer, int count)
 	if (startup == 0)
 		b_init(); //Initialize our system
 
-	if ((argfd < 0) || (argfd >= MAXFCBS) || fcbArray[argfd].fd == -1 || count < 0)
+	// a fd that failed before is -2, it has no buffer to write into
+	if ((argfd < 0) || (argfd >= MAXFCBS) || fcbArray[argfd].fd < 0 || count < 0)
 	{
 		return (-1);
 	}
+	currentVolume = fcbArray[argfd].volume;
 
 	// initialize the detector the first time it calls this function
 	if (fcbArray[argfd].detector == 0)
@@ -278,33 +457,37 @@ int b_write(int argfd, char *buffer, int count)
 		fcbArray[argfd].detector = FUNC_WRITE;
 
 		// check if there is no more place to store files in parent directory
-		if (fcbArray[argfd].parent->dirEntryAmount >= MAX_AMOUNT_OF_ENTRIES)
+		// the fd only keeps its entry, so the directory is read for it
+		followDirectoryMoves(&fcbArray[argfd].parentEntry, fcbArray[argfd].parentVersion);
+		fdDir *parent = getDirByEntry(&fcbArray[argfd].parentEntry);
+		if (parent == NULL || parent->dirEntryAmount >= MAX_AMOUNT_OF_ENTRIES)
 		{
+			releaseDir(parent);
 			fcbArray[argfd].fd = -2;
 			return -1;
 		}
 
 		// check if there is already a same name of file
-		for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+		int exists = findEntry(parent, fcbArray[argfd].trueFileName, strlen(fcbArray[argfd].trueFileName)) >= 0;
+		releaseDir(parent);
+		if (exists)
 		{
-			if (fcbArray[argfd].parent->entryList[i].space == SPACE_USED &&
-				strcmp(fcbArray[argfd].parent->entryList[i].d_name, fcbArray[argfd].trueFileName) == 0)
-			{
-				printf("\nsame name of directory or file existed\n");
-				fcbArray[argfd].fd = -2;
-				return -1;
-			}
+			printf("\nsame name of directory or file existed\n");
+			fcbArray[argfd].fd = -2;
+			return -1;
 		}
 
-		// allocate the buffer with the first size
-		fcbArray[argfd].buf = malloc(B_CHUNK_SIZE);
+		// allocate the buffer with the first size, at least one block
+		// since whole blocks are written from it
+		uint64_t firstSize = ourVCB->blockSize > B_CHUNK_SIZE ? ourVCB->blockSize : B_CHUNK_SIZE;
+		fcbArray[argfd].buf = fsMalloc(firstSize);
 		if (fcbArray[argfd].buf == NULL)
 		{
 			eprintf("malloc() on fcbArray[returnFd].buf");
 			fcbArray[argfd].fd = -2;
 			return -1;
 		}
-		fcbArray[argfd].buflen += B_CHUNK_SIZE;
+		fcbArray[argfd].buflen += firstSize;
 	}
 
 	// it shouldn't do another functionality
@@ -322,9 +505,13 @@ int b_write(int argfd, char *buffer, int count)
 		uint64_t newIndex = fcbArray[argfd].index + count;
 		if (newIndex > fcbArray[argfd].buflen)
 		{
-			// realloc() with the new length
-			fcbArray[argfd].buflen += B_CHUNK_SIZE;
-			fcbArray[argfd].buf = realloc(fcbArray[argfd].buf, fcbArray[argfd].buflen);
+			// realloc() with the new length, doubled until the data fits
+			// so a large write never overflows and a file needs few realloc()
+			while (newIndex > fcbArray[argfd].buflen)
+			{
+				fcbArray[argfd].buflen *= 2;
+			}
+			fcbArray[argfd].buf = fsRealloc(fcbArray[argfd].buf, fcbArray[argfd].buflen);
 			if (fcbArray[argfd].buf == NULL)
 			{
 				eprintf("realloc() on fcbArray[argfd].buf");
@@ -339,6 +526,27 @@ int b_write(int argfd, char *buffer, int count)
 	return 0;
 }
 
+/**
+ * @brief get the status of an open file, taken from its inode
+ * without reading the directory holding it
+ * 
+ * @param argfd fd of the file
+ * @param buf where to store the status
+ * @return 0 for success, -1 for fail or if the file is not written yet
+ */
+int b_fstat(int argfd, struct fs_stat *buf)
+{
+	if ((argfd < 0) || (argfd >= MAXFCBS) || fcbArray[argfd].fd < 0 ||
+		fcbArray[argfd].entry.space != SPACE_USED)
+	{
+		return -1;
+	}
+	currentVolume = fcbArray[argfd].volume;
+
+	fillStat(&fcbArray[argfd].entry, buf);
+	return 0;
+}
+
 /**
  * @brief close the fd and mark it free
  * 
@@ -347,14 +555,33 @@ int b_write(int argfd, char *buffer, int count)
 void b_close(int argfd)
 {
 	// check for some error that return a invalid fd
-	// must handle memory leak above (no time to optimize better)
-	if (fcbArray[argfd].fd != -1 && fcbArray[argfd].fd != -2)
+	if ((argfd < 0) || (argfd >= MAXFCBS))
+	{
+		return;
+	}
+
+	// a fd that failed in b_write() is -2, it still holds its buffers
+	if (fcbArray[argfd].fd != -1)
 	{
+		currentVolume = fcbArray[argfd].volume;
+
 		// write the buffer in if it is FUNC_WRITE
 		// this is due to how we design b_write()
-		if (fcbArray[argfd].detector == FUNC_WRITE)
+		if (fcbArray[argfd].fd != -2 && fcbArray[argfd].detector == FUNC_WRITE)
 		{
-			writeIntoVolume(argfd);
+			// data goes straight to the volume, metadata into one transaction
+			journalBeforeDataWrite();
+			journalBegin();
+
+			// another file in the same directory can be closed since it was opened
+			followDirectoryMoves(&fcbArray[argfd].parentEntry, fcbArray[argfd].parentVersion);
+			fdDir *parent = getDirByEntry(&fcbArray[argfd].parentEntry);
+			if (parent != NULL)
+			{
+				writeIntoVolume(argfd, parent);
+				releaseDir(parent);
+			}
+			journalEnd();
 		}
 
 		// free all associated malloc() pointer
@@ -363,77 +590,172 @@ void b_close(int argfd)
 			free(fcbArray[argfd].buf);
 			fcbArray[argfd].buf = NULL;
 		}
-		if (fcbArray[argfd].parent != NULL)
+		if (fcbArray[argfd].zReader != NULL)
 		{
-			free(fcbArray[argfd].parent);
-			fcbArray[argfd].parent = NULL;
+			closeCompressReader(fcbArray[argfd].zReader);
+			fcbArray[argfd].zReader = NULL;
 		}
-		if (fcbArray[argfd].trueFileName != NULL)
+	}
+	fcbArray[argfd].fd = -1;
+}
+
+/**
+ * @brief close every file still open on the volume in use, used when it is closed
+ *
+ */
+void b_closeAll()
+{
+	if (startup == 0)
+		return;
+
+	for (int i = 0; i < MAXFCBS; i++)
+	{
+		if (fcbArray[i].fd >= 0 && fcbArray[i].volume == currentVolume)
 		{
-			free(fcbArray[argfd].trueFileName);
-			fcbArray[argfd].trueFileName = NULL;
+			dprintf("closing fd %d left open", i);
+			b_close(i);
 		}
 	}
-	fcbArray[argfd].fd = -1;
 }
 
 /**
  * @brief write the buffer of the file into volume (used with b_write())
  * 
  * @param argfd fd to retrieve data
+ * @param parent the directory holding the file, read in the same transaction
  */
-void writeIntoVolume(int argfd)
+void writeIntoVolume(int argfd, fdDir *parent)
 {
+	// another fd can write the same name after the first b_write() of this one
+	if (findEntry(parent, fcbArray[argfd].trueFileName, strlen(fcbArray[argfd].trueFileName)) >= 0)
+	{
+		printf("\nsame name of directory or file existed\n");
+		return;
+	}
+
 	// find the first avaliable space and put it in
 	for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
 	{
-		if (fcbArray[argfd].parent->entryList[i].space == SPACE_FREE)
+		if (parent->entryList[i].space == SPACE_FREE)
 		{
-			// allocate the space in memory and use it for LBAwrite()
-			uint blockCount = getBlockCount(fcbArray[argfd].index);
-			uint64_t start = allocateFreespace(blockCount);
-			if (start == -1)
-			{ // avoid memory leaking
-				dprintf("allocateFreespace() on start");
-				fcbArray[argfd].fd = -1;
-				free(fcbArray[argfd].buf);
-				fcbArray[argfd].buf = NULL;
+			// replace the buffer by its compressed image if the volume wants it
+			// this returns NULL when compressing would not save any block
+			char *toWrite = fcbArray[argfd].buf;
+			uint64_t extentSize = 0;
+			char *compressed = NULL;
+			if (ourVCB->featureFlags & FEATURE_COMPRESSION)
+			{
+				compressed = compressExtent(fcbArray[argfd].buf, fcbArray[argfd].index, &extentSize);
+			}
+			if (compressed != NULL)
+			{
+				toWrite = compressed;
+				dprintf("%s compressed from %ld to %ld bytes", fcbArray[argfd].trueFileName,
+						fcbArray[argfd].index, extentSize);
+			}
+			else
+			{
+				extentSize = fcbArray[argfd].index;
 			}
 
-			// write the file into the volume and set start location for the entry
-			fcbArray[argfd].parent->entryList[i].entryStartLocation = start;
-			LBAwrite(fcbArray[argfd].buf, blockCount, start);
+			unsigned char attributes = compressed != NULL ? ATTR_COMPRESSED : 0;
 
-			// now we need to add the info into the entry list
-			fcbArray[argfd].parent->dirEntryAmount++;
-			fcbArray[argfd].parent->entryList[i].d_reclen = sizeof(struct fs_diriteminfo);
-			fcbArray[argfd].parent->entryList[i].fileType = TYPE_FILE;
-			fcbArray[argfd].parent->entryList[i].space = SPACE_USED;
-			fcbArray[argfd].parent->entryList[i].size = fcbArray[argfd].index;
-
-			// truncate the name if it exceeds the max length
-			// slightly different than the directory one
-			if (strlen(fcbArray[argfd].trueFileName) > (MAX_NAME_LENGTH - 1))
+			// look for an extent already holding the same bytes
+			// the fingerprint only finds a candidate, the bytes are compared after
+			uint64_t fingerprint = 0;
+			extentRef *shared = NULL;
+			if (ourVCB->featureFlags & FEATURE_DEDUP)
 			{
-				char *shortName = malloc(MAX_NAME_LENGTH);
-				if (shortName == NULL)
-				{ // unexpected error
-					eprintf("malloc() on shortName");
+				fingerprint = fingerprintData(toWrite, extentSize);
+				shared = findExtentByFingerprint(fingerprint, fcbArray[argfd].index, attributes);
+				if (shared != NULL && !extentMatches(shared, toWrite, extentSize))
+				{
+					shared = NULL;
+				}
+			}
+
+			uint blockCount = getBlockCount(extentSize);
+			uint64_t start;
+			if (shared != NULL && shareExtent(shared) == 0)
+			{ // a duplicate only costs the directory update
+				start = shared->start;
+				dprintf("%s shares the extent at %ld", fcbArray[argfd].trueFileName, start);
+			}
+			else
+			{
+				// allocate the space in memory and use it for LBAwrite()
+				start = allocateFreespaceNear(blockCount, placementGoal(parent->entryList, TYPE_FILE, blockCount));
+				if (start == -1)
+				{ // avoid memory leaking
+					dprintf("allocateFreespace() on start");
+					free(compressed);
+					compressed = NULL;
 					return;
 				}
 
-				// make sure it only contains one less than the max for null terminator
-				strncpy(shortName, fcbArray[argfd].trueFileName, MAX_NAME_LENGTH - 1);
-				shortName[MAX_NAME_LENGTH - 1] = '\0';
+				// write the file into the volume
+				if (compressed != NULL)
+				{ // the image is not padded to a full block like our buffer
+					updateByLBAwrite(compressed, extentSize, start);
+				}
+				else
+				{
+					deviceWrite(toWrite, blockCount, start);
+				}
 
-				free(fcbArray[argfd].trueFileName);
-				fcbArray[argfd].trueFileName = shortName;
+				// keep the fingerprint so later copies can find this extent
+				if (ourVCB->featureFlags & FEATURE_DEDUP)
+				{
+					addExtentRef(start, blockCount, fcbArray[argfd].index, attributes, fingerprint);
+				}
 			}
-			strcpy(fcbArray[argfd].parent->entryList[i].d_name, fcbArray[argfd].trueFileName);
+			free(compressed);
+			compressed = NULL;
+
+			// set start location for the entry
+			parent->entryList[i].entryStartLocation = start;
+
+			// now we need to add the info into the entry list
+			parent->dirEntryAmount++;
+			parent->entryList[i].d_reclen = sizeof(struct fs_diriteminfo);
+			parent->entryList[i].fileType = TYPE_FILE;
+			parent->entryList[i].space = SPACE_USED;
+			parent->entryList[i].attributes = attributes;
+			parent->entryList[i].size = fcbArray[argfd].index;
+
+			// the name was truncated to fit when the file was opened
+			strcpy(parent->entryList[i].d_name, fcbArray[argfd].trueFileName);
+
+			// location, size and times live in the inode from now on
+			parent->entryList[i].inodeNumber = allocInode(parent->entryList + i);
 
 			// update the directory
-			updateDirectory(fcbArray[argfd].parent);
+			updateDirectory(parent);
+			addTreeUsage(parent->entryList, fcbArray[argfd].index, blockCount);
 			break;
 		}
 	}
 }
+
+/**
+ * @brief tell if a fd of the volume in use still reads the extent,
+ * a compressed file reads its chunks from the volume until it is closed
+ *
+ * @param start LBA of the extent
+ * @return 1 if it is read, 0 if not
+ */
+int b_extentInUse(uint64_t start)
+{
+	if (startup == 0)
+		return 0;
+
+	for (int i = 0; i < MAXFCBS; i++)
+	{
+		if (fcbArray[i].fd >= 0 && fcbArray[i].volume == currentVolume &&
+			fcbArray[i].zReader != NULL && fcbArray[i].entry.entryStartLocation == start)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -18,11 +18,25 @@ Siqi Guo, 918209895, Guo-1999
 #ifndef _B_IO_H
 #define _B_IO_H
 #include <fcntl.h>
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+
+struct fsSession; // declared in mfs.h, which includes this file
+struct fsEntry;
+struct fs_stat;
 
 int b_open(char *filename, int flags);
+int b_open_r(struct fsSession *session, char *filename, int flags);
+int b_openEntry(struct fsEntry *handle, int flags);
 int b_read(int argfd, char *buffer, int count);
 int b_write(int argfd, char *buffer, int count);
+int b_seek(int argfd, off_t offset, int whence);
+int b_fstat(int argfd, struct fs_stat *buf);
 void b_close(int argfd);
-void writeIntoVolume(int argfd);
+void b_closeAll();
+int b_extentInUse(uint64_t start);
 
 #endif
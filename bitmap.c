@@ -1,6 +1,6 @@
 /**************************************************************
 * Class:  CSC-415-02 Summer 2021
-* Name: Team Fiore 
+* Name: Team Fiore
 
 Haoyuan Tan(Sunny), 918274583, CiYuan53
 Minseon Park, 917199574, minseon-park
@@ -11,47 +11,233 @@ Siqi Guo, 918209895, Guo-1999
 *
 * File: bitmap.c
 *
-* Description: read and modify a bit array using int array
+* Description: read and modify the freespace bitmap, which is
+* loaded one block (page) at a time when the allocator touches it,
+* with a persisted count of free blocks for each page (group)
+* so full and empty groups are decided without loading them
 *
 **************************************************************/
 
 #include "mfs.h"
-
-int setUsed(uint64_t, int *bitmap);
-int setBitFree(uint64_t, int *bitmap);
-int checkBit(uint64_t, int *bitmap);
+#include "journal.h"
 
 // keep track of values so the method can reuse them
-// use static to keep them only usable in this file
-uint targetIndex = 0, targetBit = 0;
+// use static to keep them only usable in this file, and one copy
+// per thread since threads can use different volumes at once
+static __thread uint targetIndex = 0, targetBit = 0;
+static __thread int *targetPage = NULL;
+
+/**
+ * @brief create the in-memory map of the freespace, nothing is read yet
+ *
+ * @return the map, NULL for fail
+ */
+freespaceMap *openFreespace()
+{
+	freespaceMap *map = fsMalloc(sizeof(freespaceMap));
+	if (map == NULL)
+	{
+		eprintf("malloc() on map");
+		return NULL;
+	}
+	memset(map, 0, sizeof(freespaceMap));
+
+	map->pageCount = ourVCB->freespaceBlockCount;
+	map->blocksPerPage = ourVCB->blockSize * 8;
+	map->groupsPerSummaryBlock = ourVCB->blockSize / sizeof(uint32_t);
+	map->summaryBlockCount = getBlockCount(map->pageCount * sizeof(uint32_t));
+
+	map->pages = fsCalloc(map->pageCount, sizeof(int *));
+	map->summary = fsCalloc(map->summaryBlockCount, sizeof(uint32_t *));
+	map->dirtyFlags = fsCalloc(map->pageCount + map->summaryBlockCount, 1);
+	if (map->pages == NULL || map->summary == NULL || map->dirtyFlags == NULL)
+	{
+		eprintf("calloc() on pages, summary or dirtyFlags");
+		closeFreespace(map);
+		return NULL;
+	}
+	return map;
+}
+
+/**
+ * @brief free the map and every loaded block, nothing is written
+ *
+ * @param map the map to free
+ */
+void closeFreespace(freespaceMap *map)
+{
+	if (map == NULL)
+	{
+		return;
+	}
+	for (uint64_t i = 0; map->pages != NULL && i < map->pageCount; i++)
+	{
+		free(map->pages[i]);
+	}
+	for (uint64_t i = 0; map->summary != NULL && i < map->summaryBlockCount; i++)
+	{
+		free(map->summary[i]);
+	}
+	free(map->pages);
+	free(map->summary);
+	free(map->dirtyList);
+	free(map->dirtyFlags);
+	free(map);
+}
+
+/**
+ * @brief remember a page or summary block has to be written back
+ *
+ * @param map the map
+ * @param slot index of a page, or pageCount + index of a summary block
+ */
+static void markDirty(freespaceMap *map, uint64_t slot)
+{
+	if (map->dirtyFlags[slot])
+	{
+		return;
+	}
+
+	if (map->dirtyCount == map->dirtyCapacity)
+	{
+		uint64_t newCapacity = map->dirtyCapacity == 0 ? 16 : map->dirtyCapacity * 2;
+		uint64_t *newList = fsRealloc(map->dirtyList, newCapacity * sizeof(uint64_t));
+		if (newList == NULL)
+		{
+			eprintf("realloc() on dirtyList");
+			return;
+		}
+		map->dirtyList = newList;
+		map->dirtyCapacity = newCapacity;
+	}
+	map->dirtyList[map->dirtyCount++] = slot;
+	map->dirtyFlags[slot] = 1;
+}
+
+/**
+ * @brief get a page of the bitmap, read it from the volume the first time
+ *
+ * @param map the map
+ * @param page index of the page
+ * @return the page, NULL for fail
+ */
+static int *getPage(freespaceMap *map, uint64_t page)
+{
+	if (map->pages[page] == NULL)
+	{
+		int *buffer = fsMalloc(ourVCB->blockSize);
+		if (buffer == NULL)
+		{
+			eprintf("malloc() on page");
+			return NULL;
+		}
+
+		// starts right behind vcb
+		journalLBAread(buffer, 1, ourVCB->vcbBlockCount + page);
+		map->pages[page] = buffer;
+		map->loadedPages++;
+		ldprintf("freespace page %ld loaded", page);
+	}
+	return map->pages[page];
+}
+
+/**
+ * @brief amount of blocks covered by a group, the last one can be shorter
+ *
+ * @param map the map
+ * @param group index of the group
+ * @return amount of blocks
+ */
+static uint64_t getGroupSize(freespaceMap *map, uint64_t group)
+{
+	uint64_t groupStart = group * map->blocksPerPage;
+	uint64_t left = ourVCB->numberOfBlocks - groupStart;
+	return left < map->blocksPerPage ? left : map->blocksPerPage;
+}
+
+/**
+ * @brief get the free block counter of a group, read its summary
+ * block from the volume the first time
+ *
+ * @param map the map
+ * @param group index of the group
+ * @return pointer to the counter, NULL for fail
+ */
+static uint32_t *getGroupFree(freespaceMap *map, uint64_t group)
+{
+	uint64_t block = group / map->groupsPerSummaryBlock;
+	if (map->summary[block] == NULL)
+	{
+		uint32_t *buffer = fsMalloc(ourVCB->blockSize);
+		if (buffer == NULL)
+		{
+			eprintf("malloc() on summary");
+			return NULL;
+		}
+		journalLBAread(buffer, 1, ourVCB->freespaceSummaryLocation + block);
+		map->summary[block] = buffer;
+	}
+	return map->summary[block] + group % map->groupsPerSummaryBlock;
+}
+
+/**
+ * @brief count the free blocks of a group by reading its page
+ *
+ * @param map the map
+ * @param group index of the group
+ * @return amount of free blocks
+ */
+static uint32_t countGroupFree(freespaceMap *map, uint64_t group)
+{
+	int *page = getPage(map, group);
+	if (page == NULL)
+	{
+		return 0;
+	}
+
+	uint64_t groupSize = getGroupSize(map, group);
+	uint32_t count = 0;
+	for (uint64_t i = 0; i < groupSize; i++)
+	{
+		if ((page[i / BIT_SIZE_OF_INT] & (SPACE_USED << (i % BIT_SIZE_OF_INT))) == SPACE_FREE)
+		{
+			count++;
+		}
+	}
+	return count;
+}
 
 /**
  * @brief load all values and check if the bit is free or used
- * 
+ *
  * @param indexOfBlock index of the block in the volume
- * @param bitmap pointer to the bitmap
- * @return 0 for free, 1 for used
+ * @return 0 for free, 1 for used, -1 for fail
  */
-int checkBit(uint64_t indexOfBlock, int *bitmap)
+int checkBit(uint64_t indexOfBlock)
 {
-	// load up the index and bit position
-	targetIndex = indexOfBlock / BIT_SIZE_OF_INT;
+	// load up the page, index and bit position
+	uint64_t page = indexOfBlock / freespace->blocksPerPage;
+	targetPage = getPage(freespace, page);
+	if (targetPage == NULL)
+	{
+		return -1;
+	}
+	targetIndex = (indexOfBlock % freespace->blocksPerPage) / BIT_SIZE_OF_INT;
 	targetBit = indexOfBlock % BIT_SIZE_OF_INT;
 
 	// check to see if the bit is used or free
-	return (bitmap[targetIndex] & (SPACE_USED << targetBit)) != SPACE_FREE;
+	return (targetPage[targetIndex] & (SPACE_USED << targetBit)) != SPACE_FREE;
 }
 
 /**
  * @brief set the bit to used only if that bit is in free
- * 
+ *
  * @param indexOfBlock index of the block in the volume
- * @param bitmap pointer to the bitmap
  * @return 0 for success, -1 for fail
  */
-int setBitUsed(uint64_t indexOfBlock, int *bitmap)
+int setBitUsed(uint64_t indexOfBlock)
 {
-	if (checkBit(indexOfBlock, bitmap) == SPACE_USED)
+	if (checkBit(indexOfBlock) != SPACE_FREE)
 	{ // error if the bit is already in used
 		//eprintf("block %ld is already used!", indexOfBlock);
 		return -1;
@@ -59,20 +245,29 @@ int setBitUsed(uint64_t indexOfBlock, int *bitmap)
 
 	// set the bit to used
 	//dprintf("bit at %ld is set to USED", indexOfBlock);
-	bitmap[targetIndex] |= (SPACE_USED << targetBit);
+	uint64_t group = indexOfBlock / freespace->blocksPerPage;
+	uint32_t *groupFree = getGroupFree(freespace, group);
+	if (groupFree == NULL)
+	{
+		return -1;
+	}
+	targetPage[targetIndex] |= (SPACE_USED << targetBit);
+	(*groupFree)--;
+	__atomic_sub_fetch(&ourVCB->freeBlockCount, 1, __ATOMIC_RELAXED);
+	markDirty(freespace, group);
+	markDirty(freespace, freespace->pageCount + group / freespace->groupsPerSummaryBlock);
 	return 0;
 }
 
 /**
  * @brief set the bit to free only if that bit is in used
- * 
+ *
  * @param indexOfBlock index of the block in the volume
- * @param bitmap pointer to the bitmap
  * @return 0 for success, -1 for fail
  */
-int setBitFree(uint64_t indexOfBlock, int *bitmap)
+int setBitFree(uint64_t indexOfBlock)
 {
-	if (checkBit(indexOfBlock, bitmap) == SPACE_FREE)
+	if (checkBit(indexOfBlock) != SPACE_USED)
 	{ // error if the bit is already in free
 		//eprintf("block %ld is already FREE!", indexOfBlock);
 		return -1;
@@ -80,6 +275,367 @@ int setBitFree(uint64_t indexOfBlock, int *bitmap)
 
 	// set the bit to free
 	//dprintf("bit at %ld is set to FREE", indexOfBlock);
-	bitmap[targetIndex] &= ~(SPACE_USED << targetBit);
+	uint64_t group = indexOfBlock / freespace->blocksPerPage;
+	uint32_t *groupFree = getGroupFree(freespace, group);
+	if (groupFree == NULL)
+	{
+		return -1;
+	}
+	targetPage[targetIndex] &= ~(SPACE_USED << targetBit);
+	(*groupFree)++;
+	__atomic_add_fetch(&ourVCB->freeBlockCount, 1, __ATOMIC_RELAXED);
+	markDirty(freespace, group);
+	markDirty(freespace, freespace->pageCount + group / freespace->groupsPerSummaryBlock);
+	return 0;
+}
+
+/**
+ * @brief find the first free block, full groups are skipped
+ * without loading their pages
+ *
+ * @param from index of the block to start from
+ * @return index of the free block, numberOfBlocks if there is none or fail
+ */
+uint64_t findFreeBlock(uint64_t from)
+{
+	uint64_t i = from;
+	while (i < ourVCB->numberOfBlocks)
+	{
+		uint64_t group = i / freespace->blocksPerPage;
+		uint32_t *groupFree = getGroupFree(freespace, group);
+		if (groupFree == NULL)
+		{
+			return ourVCB->numberOfBlocks;
+		}
+		if (*groupFree == 0)
+		{
+			i = group * freespace->blocksPerPage + getGroupSize(freespace, group);
+			continue;
+		}
+		if (checkBit(i) == SPACE_FREE)
+		{
+			return i;
+		}
+		i++;
+	}
+	return ourVCB->numberOfBlocks;
+}
+
+/**
+ * @brief find contigous free blocks, a full group breaks the run and
+ * an empty group extends it without loading its page
+ *
+ * @param requestedBlock amount of blocks needed
+ * @param from index of the block to start from
+ * @return the last block of the run, numberOfBlocks if there is none or fail
+ */
+uint64_t findFreeRun(uint64_t requestedBlock, uint64_t from)
+{
+	uint64_t count = 0;
+	uint64_t i = from;
+	while (i < ourVCB->numberOfBlocks)
+	{
+		uint64_t group = i / freespace->blocksPerPage;
+		uint64_t groupStart = group * freespace->blocksPerPage;
+		uint64_t groupSize = getGroupSize(freespace, group);
+		uint32_t *groupFreePointer = getGroupFree(freespace, group);
+		if (groupFreePointer == NULL)
+		{
+			return ourVCB->numberOfBlocks;
+		}
+		uint32_t groupFree = *groupFreePointer;
+
+		if (groupFree == 0)
+		{
+			count = 0;
+			i = groupStart + groupSize;
+			continue;
+		}
+		if (i == groupStart && groupFree == groupSize && count + groupSize < requestedBlock)
+		{
+			count += groupSize;
+			i = groupStart + groupSize;
+			continue;
+		}
+
+		if (checkBit(i) == SPACE_FREE)
+		{
+			count++;
+			if (count == requestedBlock)
+			{
+				return i;
+			}
+		}
+		else
+		{
+			count = 0;
+		}
+		i++;
+	}
+	return ourVCB->numberOfBlocks;
+}
+
+/**
+ * @brief pick the group a new top level directory starts in, so they are
+ * spread over the volume and each has room for what goes under it, like
+ * the Orlov allocator, a group with at least the average free blocks is
+ * taken, looking from the one after the group given last time
+ *
+ * @param requestedBlock amount of blocks of the directory
+ * @return first block of the group, 0 to take the first fit
+ */
+uint64_t spreadGoal(uint64_t requestedBlock)
+{
+	if (freespace->pageCount < 2)
+	{
+		return 0;
+	}
+
+	uint64_t average = ourVCB->freeBlockCount / freespace->pageCount;
+	for (uint64_t k = 0; k < freespace->pageCount; k++)
+	{
+		uint64_t group = (freespace->spreadCursor + k) % freespace->pageCount;
+		uint32_t *groupFree = getGroupFree(freespace, group);
+		if (groupFree == NULL)
+		{
+			return 0;
+		}
+		if (*groupFree >= average && *groupFree >= requestedBlock)
+		{
+			freespace->spreadCursor = group + 1;
+			return group * freespace->blocksPerPage;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief keep every summary block in memory and mark it to be written,
+ * used before the summary has a place on the volume
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int holdSummary()
+{
+	for (uint64_t i = 0; i < freespace->summaryBlockCount; i++)
+	{
+		if (freespace->summary[i] == NULL)
+		{
+			freespace->summary[i] = fsMalloc(ourVCB->blockSize);
+			if (freespace->summary[i] == NULL)
+			{
+				eprintf("malloc() on summary");
+				return -1;
+			}
+			memset(freespace->summary[i], 0, ourVCB->blockSize);
+		}
+		markDirty(freespace, freespace->pageCount + i);
+	}
+	return 0;
+}
+
+/**
+ * @brief add up the free count of every group into the vcb,
+ * used when the count on the volume can't be trusted,
+ * only the summary is read and not the pages
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int sumFreeBlocks()
+{
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < freespace->pageCount; i++)
+	{
+		uint32_t *groupFree = getGroupFree(freespace, i);
+		if (groupFree == NULL)
+		{
+			return -1;
+		}
+		total += *groupFree;
+	}
+	if (total != ourVCB->freeBlockCount)
+	{
+		dprintf("free block count changes from %ld to %ld", ourVCB->freeBlockCount, total);
+		ourVCB->freeBlockCount = total;
+	}
 	return 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief give the summary its blocks on the volume, after all
+ * of its counters are in memory
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int placeSummary()
+{
+	uint64_t start = allocateFreespace(freespace->summaryBlockCount);
+	if (start == -1)
+	{
+		eprintf("allocateFreespace() on summary");
+		return -1;
+	}
+
+	ourVCB->freespaceSummaryLocation = start;
+	updateFreespace();
+	updateOurVCB();
+
+	dprintf("freespace summary created at %ld", start);
+	return 0;
+}
+
+/**
+ * @brief create the freespace of a new volume, every block is free
+ * and the pages on the volume are cleaned, but none is kept in memory
+ *
+ * @return 0 for success, -1 for fail
+ */
+int formatFreespace()
+{
+	freespace = openFreespace();
+	if (freespace == NULL || holdSummary() != 0)
+	{
+		return -1;
+	}
+
+	// clean the bitmap on the volume, a few blocks at a time
+	uint64_t chunk = 64;
+	char *zeroBuffer = fsMalloc(chunk * ourVCB->blockSize);
+	if (zeroBuffer == NULL)
+	{
+		eprintf("malloc() on zeroBuffer");
+		return -1;
+	}
+	memset(zeroBuffer, 0, chunk * ourVCB->blockSize);
+	for (uint64_t i = 0; i < freespace->pageCount; i += chunk)
+	{
+		uint64_t count = freespace->pageCount - i < chunk ? freespace->pageCount - i : chunk;
+		deviceWrite(zeroBuffer, count, ourVCB->vcbBlockCount + i);
+	}
+	free(zeroBuffer);
+	zeroBuffer = NULL;
+
+	for (uint64_t i = 0; i < freespace->pageCount; i++)
+	{
+		uint32_t *groupFree = getGroupFree(freespace, i);
+		if (groupFree == NULL)
+		{
+			return -1;
+		}
+		*groupFree = getGroupSize(freespace, i);
+	}
+	ourVCB->freeBlockCount = ourVCB->numberOfBlocks;
+
+	// set current used block which is taken by VCB and this bitmap
+	if (allocateFreespace(ourVCB->freespaceBlockCount + ourVCB->vcbBlockCount) == -1)
+	{
+		return -1;
+	}
+	return placeSummary();
+}
+
+/**
+ * @brief count the free blocks of every group again and fix the summary,
+ * used when the volume was not closed cleanly
+ *
+ * @return 0 for success, -1 for fail
+ */
+int checkFreespace()
+{
+	uint64_t fixed = 0;
+	for (uint64_t i = 0; i < freespace->pageCount; i++)
+	{
+		uint32_t count = countGroupFree(freespace, i);
+		uint32_t *groupFree = getGroupFree(freespace, i);
+		if (groupFree == NULL)
+		{
+			return -1;
+		}
+		if (*groupFree != count)
+		{
+			eprintf("group %ld has %d free blocks, not %d", i, count, *groupFree);
+			*groupFree = count;
+			markDirty(freespace, freespace->pageCount + i / freespace->groupsPerSummaryBlock);
+			fixed++;
+		}
+
+		// nothing changed in the page, so it does not need to stay
+		if (!freespace->dirtyFlags[i])
+		{
+			free(freespace->pages[i]);
+			freespace->pages[i] = NULL;
+			freespace->loadedPages--;
+		}
+	}
+
+	// blocks before it can be freed without moving it back
+	uint64_t firstFree = findFreeBlock(0);
+	if (firstFree < ourVCB->numberOfBlocks && firstFree != ourVCB->firstFreeBlockIndex)
+	{
+		dprintf("first free block index changes to %ld", firstFree);
+		ourVCB->firstFreeBlockIndex = firstFree;
+	}
+	if (sumFreeBlocks() != 0)
+	{
+		return -1;
+	}
+	updateOurVCB();
+
+	dprintf("freespace checked, %ld groups fixed", fixed);
+	return fixed > 0 ? updateFreespace() : 0;
+}
+
+/**
+ * @brief open the freespace of a mounted volume, volumes made before
+ * the summary get one by reading the whole bitmap this time only
+ *
+ * @return 0 for success, -1 for fail
+ */
+int loadFreespace()
+{
+	freespace = openFreespace();
+	if (freespace == NULL)
+	{
+		return -1;
+	}
+	if (ourVCB->freespaceSummaryLocation != 0)
+	{
+		// volumes made before the count don't have it yet
+		if (!(ourVCB->featureFlags & FEATURE_FREE_COUNT))
+		{
+			if (sumFreeBlocks() != 0)
+			{
+				return -1;
+			}
+			ourVCB->featureFlags |= FEATURE_FREE_COUNT;
+			updateOurVCB();
+		}
+		return 0;
+	}
+
+	dprintf("building the freespace summary");
+	if (holdSummary() != 0)
+	{
+		return -1;
+	}
+	for (uint64_t i = 0; i < freespace->pageCount; i++)
+	{
+		uint32_t *groupFree = getGroupFree(freespace, i);
+		if (groupFree == NULL)
+		{
+			return -1;
+		}
+		*groupFree = countGroupFree(freespace, i);
+
+		// nothing changed in the page, so it does not need to stay
+		free(freespace->pages[i]);
+		freespace->pages[i] = NULL;
+		freespace->loadedPages--;
+	}
+	if (sumFreeBlocks() != 0)
+	{
+		return -1;
+	}
+	ourVCB->featureFlags |= FEATURE_FREE_COUNT;
+	return placeSummary();
+}
@@ -0,0 +1,551 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: compress.c
+*
+* Description: a small LZ77 compressor (LZ4 style sequences) and
+* the chunked extent layout used for compressed files
+*
+* layout of a compressed extent:
+*	compressHeader | compressChunk[chunkCount] | chunk data ...
+*
+**************************************************************/
+
+#include "mfs.h"
+#include "compress.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5	// the last bytes are always stored as literals
+#define LZ_MATCH_LIMIT 12	// no match can start within the last bytes
+#define LZ_SKIP_TRIGGER 6	// misses before we start skipping faster
+
+/**
+ * @brief read 4 bytes without alignment requirement
+ */
+static uint32_t lzRead32(const unsigned char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/**
+ * @brief hash of 4 bytes into the index of the match table
+ */
+static uint32_t lzHash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief write one sequence (literals followed by an optional match)
+ *
+ * @param dest output buffer
+ * @param out current length of the output
+ * @param capacity size of the output buffer
+ * @param literal pointer to the literals
+ * @param literalLength amount of literals
+ * @param offset distance back to the match
+ * @param matchLength length of the match, 0 for the last sequence
+ * @return new length of the output, -1 if it does not fit
+ */
+static int lzEmit(unsigned char *dest, int out, int capacity, const unsigned char *literal,
+				  int literalLength, int offset, int matchLength)
+{
+	// worst case of what this sequence needs
+	int needed = 1 + literalLength / 255 + 1 + literalLength;
+	if (matchLength > 0)
+	{
+		needed += 2 + matchLength / 255 + 1;
+	}
+	if (out + needed > capacity)
+	{
+		return -1;
+	}
+
+	int storedMatch = matchLength > 0 ? matchLength - LZ_MIN_MATCH : 0;
+	unsigned char *token = dest + out++;
+	*token = (unsigned char)(((literalLength >= 15 ? 15 : literalLength) << 4) |
+							 (storedMatch >= 15 ? 15 : storedMatch));
+
+	// extra bytes of literal length
+	if (literalLength >= 15)
+	{
+		int remaining = literalLength - 15;
+		for (; remaining >= 255; remaining -= 255)
+		{
+			dest[out++] = 255;
+		}
+		dest[out++] = (unsigned char)remaining;
+	}
+	memcpy(dest + out, literal, literalLength);
+	out += literalLength;
+
+	// the last sequence has no match
+	if (matchLength > 0)
+	{
+		dest[out++] = (unsigned char)(offset & 0xFF);
+		dest[out++] = (unsigned char)(offset >> 8);
+		if (storedMatch >= 15)
+		{
+			int remaining = storedMatch - 15;
+			for (; remaining >= 255; remaining -= 255)
+			{
+				dest[out++] = 255;
+			}
+			dest[out++] = (unsigned char)remaining;
+		}
+	}
+	return out;
+}
+
+/**
+ * @brief compress the source, giving up as soon as the output
+ * would not fit in destCapacity (used as the incompressible fast path)
+ *
+ * @param source data to compress
+ * @param sourceLength size of the data, must be below 64KB
+ * @param dest buffer for compressed data
+ * @param destCapacity max size allowed for compressed data
+ * @return compressed size, 0 if it does not fit
+ */
+int lzCompress(const char *source, int sourceLength, char *dest, int destCapacity)
+{
+	const unsigned char *src = (const unsigned char *)source;
+	unsigned char *dst = (unsigned char *)dest;
+
+	// positions of the last seen 4 bytes for each hash
+	int table[1 << LZ_HASH_BITS];
+	for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+	{
+		table[i] = -1;
+	}
+
+	int anchor = 0, pos = 0, out = 0, misses = 0;
+	int searchLimit = sourceLength - LZ_MATCH_LIMIT;
+	int matchLimit = sourceLength - LZ_LAST_LITERALS;
+
+	while (pos < searchLimit)
+	{
+		uint32_t sequence = lzRead32(src + pos);
+		uint32_t hash = lzHash(sequence);
+		int ref = table[hash];
+		table[hash] = pos;
+
+		// skip faster and faster on data that does not repeat
+		if (ref < 0 || pos - ref > 0xFFFF || lzRead32(src + ref) != sequence)
+		{
+			misses++;
+			pos += 1 + (misses >> LZ_SKIP_TRIGGER);
+			continue;
+		}
+		misses = 0;
+
+		// extend the match backward into the pending literals
+		while (pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1])
+		{
+			pos--;
+			ref--;
+		}
+
+		// then extend it forward
+		int matchLength = LZ_MIN_MATCH;
+		while (pos + matchLength < matchLimit && src[pos + matchLength] == src[ref + matchLength])
+		{
+			matchLength++;
+		}
+
+		out = lzEmit(dst, out, destCapacity, src + anchor, pos - anchor, pos - ref, matchLength);
+		if (out < 0)
+		{
+			return 0;
+		}
+		pos += matchLength;
+		anchor = pos;
+	}
+
+	// whatever is left is stored as the last literals
+	out = lzEmit(dst, out, destCapacity, src + anchor, sourceLength - anchor, 0, 0);
+	if (out < 0)
+	{
+		return 0;
+	}
+	return out;
+}
+
+/**
+ * @brief decompress data made by lzCompress()
+ *
+ * @param source compressed data
+ * @param sourceLength size of the compressed data
+ * @param dest buffer for the original data
+ * @param destCapacity size of dest
+ * @return size of the original data, -1 for corrupted data
+ */
+int lzDecompress(const char *source, int sourceLength, char *dest, int destCapacity)
+{
+	const unsigned char *src = (const unsigned char *)source;
+	unsigned char *dst = (unsigned char *)dest;
+	int ip = 0, op = 0;
+
+	while (ip < sourceLength)
+	{
+		unsigned char token = src[ip++];
+
+		// copy the literals
+		int literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (ip >= sourceLength)
+				{
+					return -1;
+				}
+				extra = src[ip++];
+				literalLength += extra;
+			} while (extra == 255);
+		}
+		if (ip + literalLength > sourceLength || op + literalLength > destCapacity)
+		{
+			return -1;
+		}
+		memcpy(dst + op, src + ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// the last sequence ends right after its literals
+		if (ip >= sourceLength)
+		{
+			break;
+		}
+
+		// copy the match from what is already decompressed
+		if (ip + 2 > sourceLength)
+		{
+			return -1;
+		}
+		int offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op)
+		{
+			return -1;
+		}
+
+		int matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			unsigned char extra;
+			do
+			{
+				if (ip >= sourceLength)
+				{
+					return -1;
+				}
+				extra = src[ip++];
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		matchLength += LZ_MIN_MATCH;
+		if (op + matchLength > destCapacity)
+		{
+			return -1;
+		}
+		if (offset >= matchLength)
+		{
+			memcpy(dst + op, dst + op - offset, matchLength);
+			op += matchLength;
+		}
+		else
+		{ // byte by byte since the match overlaps itself
+			for (int i = 0; i < matchLength; i++, op++)
+			{
+				dst[op] = dst[op - offset];
+			}
+		}
+	}
+	return op;
+}
+
+/**
+ * @brief build the compressed image of a file, chunk by chunk
+ * chunks that do not shrink are stored raw
+ *
+ * @param raw the file data
+ * @param rawSize size of the file data
+ * @param extentSize set to the size of the returned image
+ * @return malloc()ed image, NULL when compressing saves no block
+ */
+char *compressExtent(char *raw, uint64_t rawSize, uint64_t *extentSize)
+{
+	if (rawSize == 0)
+	{
+		return NULL;
+	}
+
+	uint32_t chunkCount = rawSize / COMPRESS_CHUNK_SIZE;
+	if (rawSize % COMPRESS_CHUNK_SIZE > 0)
+	{
+		chunkCount++;
+	}
+	uint64_t headerSize = sizeof(compressHeader) + chunkCount * sizeof(compressChunk);
+
+	// worst case is every chunk stored raw
+	char *image = fsMalloc(headerSize + rawSize);
+	if (image == NULL)
+	{
+		eprintf("malloc() on image");
+		return NULL;
+	}
+
+	compressHeader *header = (compressHeader *)image;
+	compressChunk *index = (compressChunk *)(image + sizeof(compressHeader));
+	uint64_t out = headerSize;
+
+	for (uint32_t i = 0; i < chunkCount; i++)
+	{
+		uint64_t rawOffset = (uint64_t)i * COMPRESS_CHUNK_SIZE;
+		int length = COMPRESS_CHUNK_SIZE;
+		if (rawSize - rawOffset < COMPRESS_CHUNK_SIZE)
+		{
+			length = rawSize - rawOffset;
+		}
+
+		// the chunk has to save at least 1/16 to be worth decompressing
+		int stored = lzCompress(raw + rawOffset, length, image + out, length - length / 16);
+		index[i].offset = out;
+		if (stored > 0)
+		{
+			index[i].method = CHUNK_LZ;
+			index[i].length = stored;
+		}
+		else
+		{
+			index[i].method = CHUNK_RAW;
+			index[i].length = length;
+			memcpy(image + out, raw + rawOffset, length);
+		}
+		out += index[i].length;
+	}
+
+	header->magicNumber = COMPRESS_MAGIC;
+	header->chunkSize = COMPRESS_CHUNK_SIZE;
+	header->chunkCount = chunkCount;
+	header->blockCount = getBlockCount(out);
+	header->rawSize = rawSize;
+
+	// keep the file raw if it does not free any block
+	if (header->blockCount >= getBlockCount(rawSize))
+	{
+		free(image);
+		image = NULL;
+		return NULL;
+	}
+
+	*extentSize = out;
+	return image;
+}
+
+/**
+ * @brief read the header of a compressed extent to know its real length
+ *
+ * @param start LBA of the extent
+ * @return amount of blocks of the extent, 0 for fail
+ */
+uint64_t compressedBlockCount(uint64_t start)
+{
+	char *readBuffer = fsMalloc(ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return 0;
+	}
+	deviceRead(readBuffer, 1, start);
+
+	compressHeader *header = (compressHeader *)readBuffer;
+	uint64_t blockCount = 0;
+	if (header->magicNumber == COMPRESS_MAGIC)
+	{
+		blockCount = header->blockCount;
+	}
+	else
+	{
+		eprintf("extent at %ld is not compressed", start);
+	}
+
+	free(readBuffer);
+	readBuffer = NULL;
+	return blockCount;
+}
+
+/**
+ * @brief load the header and chunk index of a compressed extent
+ *
+ * @param start LBA of the extent
+ * @return a reader for compressReaderRead(), NULL for fail
+ */
+compressReader *openCompressReader(uint64_t start)
+{
+	compressReader *reader = fsMalloc(sizeof(compressReader));
+	if (reader == NULL)
+	{
+		eprintf("malloc() on reader");
+		return NULL;
+	}
+	memset(reader, 0, sizeof(compressReader));
+	reader->start = start;
+	reader->loadedChunk = -1;
+
+	// the first block tells how long the index is
+	char *readBuffer = fsMalloc(ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		free(reader);
+		return NULL;
+	}
+	deviceRead(readBuffer, 1, start);
+	memcpy(&reader->header, readBuffer, sizeof(compressHeader));
+	free(readBuffer);
+	readBuffer = NULL;
+
+	if (reader->header.magicNumber != COMPRESS_MAGIC || reader->header.chunkSize == 0)
+	{
+		eprintf("extent at %ld is not compressed", start);
+		free(reader);
+		return NULL;
+	}
+
+	// read every block holding the index
+	uint64_t headerSize = sizeof(compressHeader) + reader->header.chunkCount * sizeof(compressChunk);
+	uint headerBlockCount = getBlockCount(headerSize);
+	readBuffer = fsMalloc(headerBlockCount * ourVCB->blockSize);
+	reader->index = fsMalloc(reader->header.chunkCount * sizeof(compressChunk));
+
+	// a stored chunk can start in the middle of a block, so keep one extra
+	reader->readBuffer = fsMalloc((getBlockCount(reader->header.chunkSize) + 1) * ourVCB->blockSize);
+	reader->chunkBuffer = fsMalloc(reader->header.chunkSize);
+	if (readBuffer == NULL || reader->index == NULL || reader->readBuffer == NULL || reader->chunkBuffer == NULL)
+	{
+		eprintf("malloc() on compressReader");
+		free(readBuffer);
+		closeCompressReader(reader);
+		return NULL;
+	}
+
+	deviceRead(readBuffer, headerBlockCount, start);
+	memcpy(reader->index, readBuffer + sizeof(compressHeader), reader->header.chunkCount * sizeof(compressChunk));
+
+	free(readBuffer);
+	readBuffer = NULL;
+	return reader;
+}
+
+/**
+ * @brief make sure the given chunk is decompressed into chunkBuffer
+ *
+ * @param reader an opened reader
+ * @param chunk index of the chunk
+ * @return 0 for success, -1 for fail
+ */
+static int loadChunk(compressReader *reader, uint32_t chunk)
+{
+	if (reader->loadedChunk == chunk)
+	{
+		return 0;
+	}
+
+	compressChunk *entry = reader->index + chunk;
+	uint64_t rawOffset = (uint64_t)chunk * reader->header.chunkSize;
+	uint64_t rawLength = reader->header.rawSize - rawOffset;
+	if (rawLength > reader->header.chunkSize)
+	{
+		rawLength = reader->header.chunkSize;
+	}
+
+	// only read the blocks covering this chunk
+	uint64_t firstBlock = entry->offset / ourVCB->blockSize;
+	uint64_t lastBlock = (entry->offset + entry->length - 1) / ourVCB->blockSize;
+	deviceRead(reader->readBuffer, lastBlock - firstBlock + 1, reader->start + firstBlock);
+	char *stored = reader->readBuffer + entry->offset % ourVCB->blockSize;
+
+	if (entry->method == CHUNK_RAW)
+	{
+		memcpy(reader->chunkBuffer, stored, rawLength);
+	}
+	else if (lzDecompress(stored, entry->length, reader->chunkBuffer, reader->header.chunkSize) != rawLength)
+	{
+		eprintf("chunk %d of extent %ld is corrupted", chunk, reader->start);
+		reader->loadedChunk = -1;
+		return -1;
+	}
+
+	reader->loadedChunk = chunk;
+	return 0;
+}
+
+/**
+ * @brief copy the original data at offset, decompressing only touched chunks
+ *
+ * @param reader an opened reader
+ * @param offset position in the original file
+ * @param buffer buffer to copy data to
+ * @param count amount of bytes wanted
+ * @return amount of bytes copied, -1 for fail
+ */
+int compressReaderRead(compressReader *reader, uint64_t offset, char *buffer, int count)
+{
+	int copied = 0;
+	while (copied < count && offset < reader->header.rawSize)
+	{
+		uint32_t chunk = offset / reader->header.chunkSize;
+		if (loadChunk(reader, chunk) != 0)
+		{
+			return -1;
+		}
+
+		// copy until the end of this chunk or the request
+		uint64_t inChunk = offset % reader->header.chunkSize;
+		uint64_t available = reader->header.chunkSize - inChunk;
+		if (available > reader->header.rawSize - offset)
+		{
+			available = reader->header.rawSize - offset;
+		}
+		if (available > count - copied)
+		{
+			available = count - copied;
+		}
+
+		memcpy(buffer + copied, reader->chunkBuffer + inChunk, available);
+		copied += available;
+		offset += available;
+	}
+	return copied;
+}
+
+/**
+ * @brief free everything of a reader
+ *
+ * @param reader reader to close, can be NULL
+ */
+void closeCompressReader(compressReader *reader)
+{
+	if (reader == NULL)
+	{
+		return;
+	}
+	free(reader->index);
+	free(reader->chunkBuffer);
+	free(reader->readBuffer);
+	free(reader);
+}
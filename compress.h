@@ -0,0 +1,75 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: compress.h
+*
+* Description: Interface of the per-chunk LZ compression used
+*	when a file is written back into the volume
+*
+**************************************************************/
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+#ifndef uint32_t
+typedef u_int32_t uint32_t;
+#endif
+
+#define COMPRESS_MAGIC 0x50495A46 // stands for "FZIP"
+#define COMPRESS_CHUNK_SIZE 8192  // raw bytes per chunk, must stay below 64KB
+
+// how a chunk is stored in the extent
+#define CHUNK_RAW 0
+#define CHUNK_LZ 1
+
+// first bytes of a compressed extent, followed by the chunk index
+typedef struct
+{
+	uint32_t magicNumber;
+	uint32_t chunkSize;	 // raw bytes per chunk (last one can be shorter)
+	uint32_t chunkCount; // amount of entries in the chunk index
+	uint32_t blockCount; // amount of blocks occupied by the whole extent
+	uint64_t rawSize;	 // exact size of the file before compression
+} compressHeader;
+
+typedef struct
+{
+	uint32_t offset; // byte offset of the chunk from the extent start
+	uint32_t length; // stored length of the chunk
+	uint32_t method; // CHUNK_RAW or CHUNK_LZ
+} compressChunk;
+
+// keeps the index of an opened compressed file so reads only
+// decompress the chunks they touch
+typedef struct
+{
+	uint64_t start;			// LBA of the extent
+	compressHeader header;
+	compressChunk *index;
+	char *chunkBuffer;		// holds the decompressed chunk
+	char *readBuffer;		// holds the blocks of a stored chunk
+	int64_t loadedChunk;	// index of the chunk in chunkBuffer, -1 for none
+} compressReader;
+
+int lzCompress(const char *source, int sourceLength, char *dest, int destCapacity);
+int lzDecompress(const char *source, int sourceLength, char *dest, int destCapacity);
+
+char *compressExtent(char *raw, uint64_t rawSize, uint64_t *extentSize);
+uint64_t compressedBlockCount(uint64_t start);
+
+compressReader *openCompressReader(uint64_t start);
+int compressReaderRead(compressReader *reader, uint64_t offset, char *buffer, int count);
+void closeCompressReader(compressReader *reader);
+
+#endif
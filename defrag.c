@@ -0,0 +1,661 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: defrag.c
+*
+* Description: a file is written into one run of free blocks, so a
+* volume full of holes can't take a large file even when the free
+* blocks are enough. the defragmenter walks the tree and moves each
+* file and directory into the first run below it that fits, which
+* leaves the free space merged at the end of the volume. each move
+* is one transaction of its own and the background thread rests
+* after each of them, so other sessions only wait for one move.
+*
+**************************************************************/
+
+#include <pthread.h>
+
+#include "mfs.h"
+#include "journal.h"
+#include "extent.h"
+#include "inode.h"
+#include "compress.h"
+#include "prefetch.h"
+#include "defrag.h"
+
+// a file or directory the walk found, checked again when it is moved
+typedef struct
+{
+	struct fs_diriteminfo entry;	   // the entry in its directory
+	struct fs_diriteminfo parentEntry; // . entry of the directory holding it
+	uint64_t blockCount;
+	uint64_t version; // readVersion of the directory holding it
+} defragCandidate;
+
+// a directory that changed its location, copies read before it still point to the old one
+typedef struct
+{
+	uint64_t from;
+	uint64_t to;
+	uint64_t version; // dirVersion once everything pointing to it was written
+} directoryMove;
+
+// the defragmenter of one volume
+typedef struct defragState
+{
+	pthread_rwlock_t extentLock; // held for writing while an extent changes its location
+	pthread_t worker;
+	int workerRunning;
+	volatile int workerDone;
+	volatile int stopWorker;
+	uint64_t movedExtents;
+	uint64_t movedBlocks;
+
+	// kept until the unmount, a copy of a directory can be held that long
+	directoryMove *moves;
+	uint moveCount;
+	uint moveCapacity;
+	uint64_t lastMoveVersion;
+	pthread_mutex_t moveLock;
+} defragState;
+
+/**
+ * @brief create the defragmenter state of a volume, nothing runs yet
+ *
+ * @return the state, NULL for fail
+ */
+defragState *openDefragState()
+{
+	defragState *defrag = fsMalloc(sizeof(defragState));
+	if (defrag == NULL)
+	{
+		eprintf("malloc() on defrag");
+		return NULL;
+	}
+	memset(defrag, 0, sizeof(defragState));
+	pthread_rwlock_init(&defrag->extentLock, NULL);
+	pthread_mutex_init(&defrag->moveLock, NULL);
+	return defrag;
+}
+
+/**
+ * @brief free the defragmenter state of a volume, stopDefrag() must be called first
+ *
+ * @param defrag the state
+ */
+void closeDefragState(defragState *defrag)
+{
+	if (defrag == NULL)
+	{
+		return;
+	}
+	pthread_rwlock_destroy(&defrag->extentLock);
+	pthread_mutex_destroy(&defrag->moveLock);
+	free(defrag->moves);
+	free(defrag);
+}
+
+/**
+ * @brief keep the extents where they are while a file finds and reads its extent
+ */
+void beginExtentRead()
+{
+	pthread_rwlock_rdlock(&currentVolume->defrag->extentLock);
+}
+
+/**
+ * @brief let the extents move again
+ */
+void endExtentRead()
+{
+	pthread_rwlock_unlock(&currentVolume->defrag->extentLock);
+}
+
+/**
+ * @brief point an entry copied from a directory read before some moves
+ * to where its directory is now, the old blocks can already hold
+ * something else so the copy must not be read there
+ *
+ * @param entry the entry, changed in place
+ * @param version readVersion of the directory the entry was copied from
+ */
+void followDirectoryMoves(struct fs_diriteminfo *entry, uint64_t version)
+{
+	defragState *defrag = currentVolume->defrag;
+
+	// most copies were read after the last move
+	if (entry->fileType != TYPE_DIR || __atomic_load_n(&defrag->moveCount, __ATOMIC_ACQUIRE) == 0 ||
+		version > __atomic_load_n(&defrag->lastMoveVersion, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+
+	// a directory moved twice is followed through both in order
+	pthread_mutex_lock(&defrag->moveLock);
+	for (uint i = 0; i < defrag->moveCount; i++)
+	{
+		if (defrag->moves[i].version >= version && defrag->moves[i].from == entry->entryStartLocation)
+		{
+			entry->entryStartLocation = defrag->moves[i].to;
+		}
+	}
+	pthread_mutex_unlock(&defrag->moveLock);
+}
+
+/**
+ * @brief remember a directory moved, called after every entry
+ * pointing to it was written and before its old blocks are released
+ *
+ * @param from the old location
+ * @param to the new location
+ * @return 0 for success, -1 for fail
+ */
+static int recordDirectoryMove(uint64_t from, uint64_t to)
+{
+	defragState *defrag = currentVolume->defrag;
+	int retVal = 0;
+
+	pthread_mutex_lock(&defrag->moveLock);
+	if (defrag->moveCount == defrag->moveCapacity)
+	{
+		uint newCapacity = defrag->moveCapacity == 0 ? 64 : defrag->moveCapacity * 2;
+		directoryMove *newMoves = fsRealloc(defrag->moves, newCapacity * sizeof(directoryMove));
+		if (newMoves == NULL)
+		{
+			eprintf("realloc() on moves");
+			retVal = -1;
+		}
+		else
+		{
+			defrag->moves = newMoves;
+			defrag->moveCapacity = newCapacity;
+		}
+	}
+	if (retVal == 0)
+	{
+		uint64_t version = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+		defrag->moves[defrag->moveCount] = (directoryMove){from, to, version};
+		__atomic_store_n(&defrag->lastMoveVersion, version, __ATOMIC_RELEASE);
+		__atomic_store_n(&defrag->moveCount, defrag->moveCount + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&defrag->moveLock);
+	return retVal;
+}
+
+/**
+ * @brief measure how the free space is split, the bitmap is read in
+ * one operation so nothing is allocated in between
+ *
+ * @param report buffer to store the result
+ * @return 0 for success, -1 for fail
+ */
+int getDefragReport(defragReport *report)
+{
+	defragState *defrag = currentVolume->defrag;
+
+	memset(report, 0, sizeof(defragReport));
+	report->movedExtents = __atomic_load_n(&defrag->movedExtents, __ATOMIC_RELAXED);
+	report->movedBlocks = __atomic_load_n(&defrag->movedBlocks, __ATOMIC_RELAXED);
+	report->running = defrag->workerRunning && !defrag->workerDone;
+
+	journalBegin();
+	uint64_t i = findFreeBlock(ourVCB->firstFreeBlockIndex);
+	while (i < ourVCB->numberOfBlocks)
+	{
+		uint64_t run = 0;
+		while (i < ourVCB->numberOfBlocks && checkBit(i) == SPACE_FREE)
+		{
+			run++;
+			i++;
+		}
+		report->freeBlocks += run;
+		report->freeRuns++;
+		if (run > report->largestFreeRun)
+		{
+			report->largestFreeRun = run;
+		}
+		i = findFreeBlock(i);
+	}
+	journalEnd();
+	return 0;
+}
+
+/**
+ * @brief add a file or directory found by the walk to the list
+ *
+ * @param list the list, grown when it is full
+ * @param count amount in the list
+ * @param capacity room of the list
+ * @param candidate the file
+ * @return 0 for success, -1 for fail
+ */
+static int addCandidate(defragCandidate **list, uint *count, uint *capacity, defragCandidate *candidate)
+{
+	if (*count == *capacity)
+	{
+		uint newCapacity = *capacity == 0 ? 64 : *capacity * 2;
+		defragCandidate *newList = fsRealloc(*list, newCapacity * sizeof(defragCandidate));
+		if (newList == NULL)
+		{
+			eprintf("realloc() on list");
+			return -1;
+		}
+		*list = newList;
+		*capacity = newCapacity;
+	}
+	(*list)[(*count)++] = *candidate;
+	return 0;
+}
+
+/**
+ * @brief compare two candidates, the one closer to the start goes first
+ */
+static int compareStart(const void *a, const void *b)
+{
+	const defragCandidate *x = a;
+	const defragCandidate *y = b;
+	return (x->entry.entryStartLocation > y->entry.entryStartLocation) -
+		   (x->entry.entryStartLocation < y->entry.entryStartLocation);
+}
+
+/**
+ * @brief find every file and directory that can be moved, each directory
+ * is read in an operation of its own so the walk doesn't block other sessions
+ *
+ * @param count amount found
+ * @return the candidates sorted by location, NULL if there is none or fails
+ */
+static defragCandidate *collectCandidates(uint *count)
+{
+	defragCandidate *list = NULL;
+	uint capacity = 0;
+	*count = 0;
+
+	// the directories waiting to be read
+	defragCandidate *dirs = NULL;
+	uint dirCount = 0;
+	uint dirCapacity = 0;
+
+	journalBegin();
+	fdDir *dirp = getRootDir();
+	journalEnd();
+	if (dirp != NULL)
+	{
+		defragCandidate root = {0};
+		root.entry = dirp->entryList[0];
+		root.version = dirp->readVersion;
+		releaseDir(dirp);
+		addCandidate(&dirs, &dirCount, &dirCapacity, &root);
+	}
+
+	while (dirCount > 0 && !currentVolume->defrag->stopWorker)
+	{
+		defragCandidate next = dirs[--dirCount];
+
+		journalBegin();
+		followDirectoryMoves(&next.entry, next.version);
+		dirp = getDirByEntry(&next.entry);
+		if (dirp == NULL)
+		{ // removed since its parent was read
+			journalEnd();
+			continue;
+		}
+
+		// . links to this directory and .. links to the parent
+		for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+		{
+			struct fs_diriteminfo *entry = dirp->entryList + i;
+			if (entry->space != SPACE_USED)
+			{
+				continue;
+			}
+
+			defragCandidate candidate = {0};
+			candidate.entry = *entry;
+			candidate.parentEntry = dirp->entryList[0];
+			candidate.version = dirp->readVersion;
+			if (entry->fileType == TYPE_DIR)
+			{
+				candidate.blockCount = getBlockCount(DIR_EXTENT_SIZE);
+				addCandidate(&dirs, &dirCount, &dirCapacity, &candidate);
+				addCandidate(&list, count, &capacity, &candidate);
+				continue;
+			}
+
+			// an entry without an inode is copied by open handles, it stays
+			if (entry->inodeNumber == 0)
+			{
+				continue;
+			}
+			candidate.blockCount = getExtentBlockCount(entry);
+			if (candidate.blockCount > 0 && candidate.blockCount <= DEFRAG_MAX_MOVE_BLOCKS)
+			{
+				addCandidate(&list, count, &capacity, &candidate);
+			}
+		}
+		releaseDir(dirp);
+		journalEnd();
+	}
+	free(dirs);
+	dirs = NULL;
+
+	if (*count > 0)
+	{
+		qsort(list, *count, sizeof(defragCandidate), compareStart);
+	}
+	return list;
+}
+
+/**
+ * @brief find the first free run below a location
+ *
+ * @param blockCount amount of blocks needed
+ * @param from the location
+ * @return 1 if there is one, 0 if not
+ */
+static int fitsBelow(uint64_t blockCount, uint64_t from)
+{
+	uint64_t last = findFreeRun(blockCount, ourVCB->firstFreeBlockIndex);
+	return last < ourVCB->numberOfBlocks && last - blockCount + 1 < from;
+}
+
+/**
+ * @brief move the extent of a file into the first free run below it,
+ * the copy, the inode, the entry and the release of the old blocks
+ * are one transaction, so a crash leaves the file at one place
+ *
+ * @param candidate the file
+ * @param buffer room for DEFRAG_MAX_MOVE_BLOCKS blocks
+ * @return 1 if moved, 0 if it stays, -1 for fail
+ */
+static int moveExtent(defragCandidate *candidate, char *buffer)
+{
+	defragState *defrag = currentVolume->defrag;
+	uint64_t from = candidate->entry.entryStartLocation;
+	uint32_t inodeNumber = candidate->entry.inodeNumber;
+
+	// the blocks taken can be ones released by the batch in progress
+	journalBeforeDataWrite();
+	journalBegin();
+
+	// removed since the walk, or the inode was taken by another file
+	inode *node = getInode(inodeNumber);
+	if (node == NULL || node->entryStartLocation != from)
+	{
+		journalEnd();
+		return 0;
+	}
+	uint64_t blockCount = (node->attributes & ATTR_COMPRESSED) ? compressedBlockCount(from) : getBlockCount(node->size);
+
+	// another entry points to a shared extent, it would keep the old location
+	extentRef *ref = findExtentByStart(from);
+	if (blockCount != candidate->blockCount || (ref != NULL && ref->refCount > 1) ||
+		!fitsBelow(blockCount, from))
+	{
+		journalEnd();
+		return 0;
+	}
+
+	// first fit, the same run fitsBelow() found
+	uint64_t target = allocateFreespace(blockCount);
+	if (target == -1)
+	{
+		journalEnd();
+		return -1;
+	}
+	deviceRead(buffer, blockCount, from);
+	deviceWrite(buffer, blockCount, target);
+
+	// readers only wait for the location to change, not for the copy
+	pthread_rwlock_wrlock(&defrag->extentLock);
+	if (b_extentInUse(from))
+	{ // an open compressed file reads its chunks from the old blocks
+		pthread_rwlock_unlock(&defrag->extentLock);
+		releaseFreespace(target, blockCount);
+		journalEnd();
+		return 0;
+	}
+
+	node->entryStartLocation = target;
+	updateInode(inodeNumber);
+	if (ref != NULL)
+	{
+		moveExtentRef(ref, target);
+	}
+
+	// the copy in the directory is only read without the inode table
+	followDirectoryMoves(&candidate->parentEntry, candidate->version);
+	fdDir *parent = getDirByEntry(&candidate->parentEntry);
+	for (int i = 2; parent != NULL && i < MAX_AMOUNT_OF_ENTRIES; i++)
+	{
+		if (parent->entryList[i].space == SPACE_USED && parent->entryList[i].inodeNumber == inodeNumber)
+		{
+			parent->entryList[i].entryStartLocation = target;
+			updateDirectory(parent);
+			break;
+		}
+	}
+	releaseDir(parent);
+	parent = NULL;
+
+	releaseFreespace(from, blockCount);
+	pthread_rwlock_unlock(&defrag->extentLock);
+	ldprintf("extent of inode %u moved from %ld to %ld", inodeNumber, from, target);
+
+	__atomic_fetch_add(&defrag->movedExtents, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&defrag->movedBlocks, blockCount, __ATOMIC_RELAXED);
+	journalEnd();
+	return 1;
+}
+
+/**
+ * @brief move a directory into the first free run below it, its entry
+ * in the parent and the .. of each directory in it are written in the
+ * same transaction, copies read before still find it by the move list
+ *
+ * @param candidate the directory
+ * @return 1 if moved, 0 if it stays, -1 for fail
+ */
+static int moveDirectory(defragCandidate *candidate)
+{
+	defragState *defrag = currentVolume->defrag;
+	uint64_t from = candidate->entry.entryStartLocation;
+	uint64_t blockCount = candidate->blockCount;
+
+	journalBegin();
+
+	// the parent can be moved already, and the directory removed or renamed
+	followDirectoryMoves(&candidate->parentEntry, candidate->version);
+	fdDir *parent = getDirByEntry(&candidate->parentEntry);
+	int i = parent == NULL ? -1 : findEntry(parent, candidate->entry.d_name, strlen(candidate->entry.d_name));
+	fdDir *dirp = NULL;
+	if (i >= 0 && parent->entryList[i].fileType == TYPE_DIR && parent->entryList[i].entryStartLocation == from &&
+		from != ourVCB->rootDirLocation && fitsBelow(blockCount, from))
+	{
+		dirp = getDirByEntry(parent->entryList + i);
+	}
+	if (dirp == NULL)
+	{
+		releaseDir(parent);
+		journalEnd();
+		return 0;
+	}
+
+	uint64_t target = allocateFreespace(blockCount);
+	if (target == -1)
+	{
+		releaseDir(dirp);
+		releaseDir(parent);
+		journalEnd();
+		return -1;
+	}
+
+	// the directory is written whole at its new place, the old blocks stay as they are
+	dirp->directoryStartLocation = target;
+	dirp->entryList[0].entryStartLocation = target;
+	updateDirectory(dirp);
+
+	// . links to this directory and .. links to the parent
+	for (int j = 2; j < MAX_AMOUNT_OF_ENTRIES; j++)
+	{
+		if (dirp->entryList[j].space != SPACE_USED || dirp->entryList[j].fileType != TYPE_DIR)
+		{
+			continue;
+		}
+		fdDir *child = getDirByEntry(dirp->entryList + j);
+		if (child != NULL)
+		{
+			child->entryList[1].entryStartLocation = target;
+			updateDirectory(child);
+			releaseDir(child);
+		}
+	}
+
+	parent->entryList[i].entryStartLocation = target;
+	updateDirectory(parent);
+
+	prefetchForget(from);
+	recordDirectoryMove(from, target);
+	releaseFreespace(from, blockCount);
+	ldprintf("directory %s moved from %ld to %ld", dirp->dirName, from, target);
+
+	__atomic_fetch_add(&defrag->movedExtents, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&defrag->movedBlocks, blockCount, __ATOMIC_RELAXED);
+	releaseDir(dirp);
+	releaseDir(parent);
+	journalEnd();
+	return 1;
+}
+
+/**
+ * @brief walk and move until a walk moves nothing
+ *
+ * @param throttle 1 to rest after each move
+ * @return amount of extents moved, -1 for fail
+ */
+static int64_t defragPasses(int throttle)
+{
+	defragState *defrag = currentVolume->defrag;
+	int64_t moved = 0;
+
+	char *buffer = fsMalloc(DEFRAG_MAX_MOVE_BLOCKS * ourVCB->blockSize);
+	if (buffer == NULL)
+	{
+		eprintf("malloc() on buffer");
+		return -1;
+	}
+
+	int64_t movedInPass = 1;
+	while (movedInPass > 0 && !defrag->stopWorker)
+	{
+		movedInPass = 0;
+		uint count;
+		defragCandidate *list = collectCandidates(&count);
+		for (uint i = 0; i < count && !defrag->stopWorker; i++)
+		{
+			struct timespec begin, end;
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			int result = list[i].entry.fileType == TYPE_DIR ? moveDirectory(list + i) : moveExtent(list + i, buffer);
+			if (result < 0)
+			{
+				break;
+			}
+			movedInPass += result;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			// rest as long as the move took, so the thread takes half the device at most
+			if (throttle && result > 0)
+			{
+				uint64_t took = (end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_nsec - begin.tv_nsec) / 1000;
+				usleep(DEFRAG_PAUSE_US + took);
+			}
+		}
+		free(list);
+		list = NULL;
+		moved += movedInPass;
+	}
+
+	free(buffer);
+	buffer = NULL;
+	return moved;
+}
+
+/**
+ * @brief defragment the volume in use before returning
+ *
+ * @return amount of extents moved, -1 for fail
+ */
+int runDefrag()
+{
+	if (currentVolume->defrag->workerRunning && !currentVolume->defrag->workerDone)
+	{
+		dprintf("the defragmenter already runs in the background");
+		return -1;
+	}
+	currentVolume->defrag->stopWorker = 0;
+	return defragPasses(0);
+}
+
+/**
+ * @brief body of the background thread
+ *
+ * @param arg the volume to defragment
+ * @return NULL
+ */
+static void *defragWorker(void *arg)
+{
+	currentVolume = arg;
+	int64_t moved = defragPasses(1);
+	dprintf("the defragmenter moved %ld extents", moved);
+	currentVolume->defrag->workerDone = 1;
+	return NULL;
+}
+
+/**
+ * @brief start defragmenting the volume in use in the background
+ *
+ * @return 0 for success, -1 for fail
+ */
+int startDefrag()
+{
+	defragState *defrag = currentVolume->defrag;
+
+	if (defrag->workerRunning && !defrag->workerDone)
+	{
+		return 0;
+	}
+	stopDefrag(); // joins a thread that finished
+
+	defrag->stopWorker = 0;
+	defrag->workerDone = 0;
+	if (pthread_create(&defrag->worker, NULL, defragWorker, currentVolume) != 0)
+	{
+		eprintf("pthread_create() failed");
+		return -1;
+	}
+	defrag->workerRunning = 1;
+	return 0;
+}
+
+/**
+ * @brief stop the background thread after the move in progress
+ */
+void stopDefrag()
+{
+	defragState *defrag = currentVolume->defrag;
+
+	if (defrag->workerRunning)
+	{
+		defrag->stopWorker = 1;
+		pthread_join(defrag->worker, NULL);
+		defrag->workerRunning = 0;
+	}
+}
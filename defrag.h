@@ -0,0 +1,53 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: defrag.h
+*
+* Description: Interface of the defragmenter, which moves files
+*	and directories into free space closer to the start of the
+*	volume so the free space left behind is merged
+*
+**************************************************************/
+#ifndef _DEFRAG_H
+#define _DEFRAG_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+
+#define DEFRAG_MAX_MOVE_BLOCKS 2048 // larger extents stay, one move holds the operation lock this long at most
+#define DEFRAG_PAUSE_US 2000		// rest of the background thread after each move, on top of the time the move took
+
+// how the free space of a volume is split
+typedef struct defragReport
+{
+	uint64_t freeBlocks;	 // same as the free block count of the vcb
+	uint64_t freeRuns;		 // amount of runs of free blocks
+	uint64_t largestFreeRun; // the largest file that can be written now, in blocks
+	uint64_t movedExtents;	 // moved by the defragmenter since the mount
+	uint64_t movedBlocks;
+	int running;			 // 1 while the background thread works
+} defragReport;
+
+struct fs_diriteminfo;
+
+struct defragState *openDefragState();
+void closeDefragState(struct defragState *defrag);
+void beginExtentRead();
+void endExtentRead();
+void followDirectoryMoves(struct fs_diriteminfo *entry, uint64_t version);
+int getDefragReport(defragReport *report);
+int runDefrag();
+int startDefrag();
+void stopDefrag();
+
+#endif
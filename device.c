@@ -0,0 +1,223 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: device.c
+*
+* Description: LBAread() and LBAwrite() move the file position
+* before each transfer, so two threads using them at the same
+* time can read or write the wrong blocks. every access of the
+* file system goes through here and takes turns on a lock.
+*
+* fsLow only has one partition, other volume files are opened
+* here and use pread() and pwrite(), which don't share a file
+* position, so volumes on different files don't wait for each other.
+*
+**************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "mfs.h"
+#include "device.h"
+
+// same layout as the header written by startPartitionSystem()
+typedef struct
+{
+	char description[64];
+	uint64_t signature;	 // PART_SIGNATURE
+	uint64_t volumeSize; // size asked for when the file was made
+	uint64_t blockSize;
+	uint64_t blockCount; // blocks after the header
+	uint64_t reserved[2];
+	uint64_t signature2; // PART_SIGNATURE2
+	char volumeName[64];
+} partitionHeader;
+
+static pthread_mutex_t deviceLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief make a new volume file with the header of fsLow
+ *
+ * @param fileName path of the volume file
+ * @param volumeSize size of the volume in bytes
+ * @param blockSize size of a block, a power of 2
+ * @return the file descriptor, -1 for fail
+ */
+static int createVolumeFile(char *fileName, uint64_t volumeSize, uint64_t blockSize)
+{
+	if (blockSize < MINBLOCKSIZE || (blockSize & (blockSize - 1)) != 0 ||
+		volumeSize / blockSize == 0)
+	{
+		eprintf("invalid volume size %ld or block size %ld", volumeSize, blockSize);
+		return -1;
+	}
+
+	int fd = open(fileName, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		eprintf("open() on %s, errno = %d", fileName, errno);
+		return -1;
+	}
+
+	// the header takes one more block in front of the volume
+	uint64_t blockCount = volumeSize / blockSize;
+	char *headerBlock = fsCalloc(1, blockSize);
+	if (headerBlock == NULL || ftruncate(fd, (blockCount + 1) * blockSize) != 0)
+	{
+		eprintf("can't make %s", fileName);
+		free(headerBlock);
+		close(fd);
+		return -1;
+	}
+
+	partitionHeader *header = (partitionHeader *)headerBlock;
+	strcpy(header->description, "CSC-415 - Operating Systems File System Partition Header\n\n");
+	header->signature = PART_SIGNATURE;
+	header->volumeSize = volumeSize;
+	header->blockSize = blockSize;
+	header->blockCount = blockCount;
+	header->signature2 = PART_SIGNATURE2;
+	strcpy(header->volumeName, "Untitled\n\n");
+
+	int written = pwrite(fd, headerBlock, blockSize, 0) == blockSize;
+	free(headerBlock);
+	headerBlock = NULL;
+	if (!written)
+	{
+		eprintf("pwrite() on the header of %s", fileName);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief open a volume file made by fsLow or by this file,
+ * a missing file is made when a size is given
+ *
+ * @param fileName path of the volume file
+ * @param volumeSize size for a new file, filled with the size of the volume
+ * @param blockSize block size for a new file, filled with the block size
+ * @return the file descriptor, -1 for fail
+ */
+int deviceOpen(char *fileName, uint64_t *volumeSize, uint64_t *blockSize)
+{
+	int fd = open(fileName, O_RDWR);
+	if (fd < 0 && errno == ENOENT && *volumeSize > 0)
+	{
+		fd = createVolumeFile(fileName, *volumeSize, *blockSize);
+	}
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	partitionHeader header;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+		header.signature != PART_SIGNATURE || header.signature2 != PART_SIGNATURE2)
+	{
+		eprintf("%s is not a volume file", fileName);
+		close(fd);
+		return -1;
+	}
+
+	*volumeSize = header.blockCount * header.blockSize;
+	*blockSize = header.blockSize;
+	return fd;
+}
+
+/**
+ * @brief close a volume file opened by deviceOpen()
+ *
+ * @param fd the file descriptor
+ */
+void deviceClose(int fd)
+{
+	if (fd >= 0)
+	{
+		fsync(fd);
+		close(fd);
+	}
+}
+
+/**
+ * @brief LBAread() that can be called from any thread
+ *
+ * @return amount of blocks read
+ */
+uint64_t deviceRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
+{
+	if (currentVolume->deviceFd < 0)
+	{
+		pthread_mutex_lock(&deviceLock);
+		uint64_t retVal = LBAread(buffer, lbaCount, lbaPosition);
+		pthread_mutex_unlock(&deviceLock);
+		return retVal;
+	}
+
+	// block 0 of the file is the header
+	uint64_t blockSize = currentVolume->deviceBlockSize;
+	uint64_t length = lbaCount * blockSize;
+	uint64_t done = 0;
+	while (done < length)
+	{
+		ssize_t count = pread(currentVolume->deviceFd, (char *)buffer + done, length - done,
+							  (lbaPosition + 1) * blockSize + done);
+		if (count <= 0)
+		{
+			eprintf("pread() at block %ld, errno = %d", lbaPosition, errno);
+			break;
+		}
+		done += count;
+	}
+	return done / blockSize;
+}
+
+/**
+ * @brief LBAwrite() that can be called from any thread
+ *
+ * @return amount of blocks written
+ */
+uint64_t deviceWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
+{
+	// the change stays in memory, the volume is only looked at
+	if (currentVolume->readOnly)
+	{
+		return lbaCount;
+	}
+
+	if (currentVolume->deviceFd < 0)
+	{
+		pthread_mutex_lock(&deviceLock);
+		uint64_t retVal = LBAwrite(buffer, lbaCount, lbaPosition);
+		pthread_mutex_unlock(&deviceLock);
+		return retVal;
+	}
+
+	uint64_t blockSize = currentVolume->deviceBlockSize;
+	uint64_t length = lbaCount * blockSize;
+	uint64_t done = 0;
+	while (done < length)
+	{
+		ssize_t count = pwrite(currentVolume->deviceFd, (char *)buffer + done, length - done,
+							   (lbaPosition + 1) * blockSize + done);
+		if (count <= 0)
+		{
+			eprintf("pwrite() at block %ld, errno = %d", lbaPosition, errno);
+			break;
+		}
+		done += count;
+	}
+	return done / blockSize;
+}
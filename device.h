@@ -0,0 +1,33 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: device.h
+*
+* Description: Interface of the block device used by the file
+*	system, LBAread() and LBAwrite() that are safe to call
+*	from more than one thread, on the partition of fsLow or on
+*	any other volume file
+*
+**************************************************************/
+#ifndef _DEVICE_H
+#define _DEVICE_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+
+int deviceOpen(char *fileName, uint64_t *volumeSize, uint64_t *blockSize);
+void deviceClose(int fd);
+uint64_t deviceRead(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+uint64_t deviceWrite(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+
+#endif
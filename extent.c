@@ -0,0 +1,440 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: extent.c
+*
+* Description: keeps the table of shared extents on the volume
+* so identical files can point to the same blocks, and the blocks
+* are only released when the last entry pointing to them is gone
+*
+**************************************************************/
+
+#include "mfs.h"
+#include "extent.h"
+#include "journal.h"
+#include "compress.h"
+
+/**
+ * @brief a fast 64 bits hash of the data, taking 8 bytes each step
+ *
+ * @param data data to hash
+ * @param size size of the data
+ * @return the fingerprint, never 0
+ */
+uint64_t fingerprintData(const char *data, uint64_t size)
+{
+	const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t hash = size * prime1;
+	uint64_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash ^= word * prime2;
+		hash = ((hash << 31) | (hash >> 33)) * prime1;
+	}
+
+	// the tail that is shorter than 8 bytes
+	for (; i < size; i++)
+	{
+		hash ^= (unsigned char)data[i] * prime1;
+		hash = ((hash << 11) | (hash >> 53)) * prime2;
+	}
+
+	// mix the bits of the end result
+	hash ^= hash >> 29;
+	hash *= prime2;
+	hash ^= hash >> 32;
+	return hash == 0 ? 1 : hash;
+}
+
+/**
+ * @brief fingerprint of the bytes stored in an extent, the same one
+ * b_close() gives a new extent, so a clone can be found by later copies
+ *
+ * @param start LBA of the extent
+ * @param blockCount amount of blocks of the extent
+ * @param size exact size of the entry
+ * @param attributes ATTR_* bits of the entry
+ * @return the fingerprint, 0 for fail
+ */
+uint64_t fingerprintExtent(uint64_t start, uint32_t blockCount, uint64_t size, unsigned char attributes)
+{
+	char *readBuffer = fsMalloc((uint64_t)blockCount * ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return 0;
+	}
+	deviceRead(readBuffer, blockCount, start);
+
+	// a compressed image ends after its last chunk, not at the size of the file
+	uint64_t length = size;
+	if (attributes & ATTR_COMPRESSED)
+	{
+		compressHeader *header = (compressHeader *)readBuffer;
+		compressChunk *index = (compressChunk *)(readBuffer + sizeof(compressHeader));
+		length = sizeof(compressHeader) + header->chunkCount * sizeof(compressChunk);
+		for (uint32_t i = 0; i < header->chunkCount; i++)
+		{
+			if (index[i].offset + index[i].length > length)
+			{
+				length = index[i].offset + index[i].length;
+			}
+		}
+	}
+
+	uint64_t fingerprint = 0;
+	if (length <= (uint64_t)blockCount * ourVCB->blockSize)
+	{
+		fingerprint = fingerprintData(readBuffer, length);
+	}
+	free(readBuffer);
+	readBuffer = NULL;
+	return fingerprint;
+}
+
+/**
+ * @brief length of the table on the volume, tables made before
+ * it could grow have REF_TABLE_BLOCK_COUNT blocks
+ *
+ * @return amount of blocks
+ */
+uint64_t getRefTableBlockCount()
+{
+	return ourVCB->refTableBlockCount == 0 ? REF_TABLE_BLOCK_COUNT : ourVCB->refTableBlockCount;
+}
+
+/**
+ * @brief read the table from the volume if the volume has one,
+ * the whole table is kept in memory once it is loaded
+ *
+ * @return 0 for success, -1 if there is no table
+ */
+int loadRefTable()
+{
+	if (currentVolume->refTable != NULL)
+	{
+		return 0;
+	}
+	if (ourVCB->refTableLocation == 0)
+	{
+		return -1;
+	}
+
+	uint64_t blockCount = getRefTableBlockCount();
+	uint64_t tableBytes = blockCount * ourVCB->blockSize;
+	currentVolume->refTable = fsMalloc(tableBytes);
+	if (currentVolume->refTable == NULL)
+	{
+		eprintf("malloc() on refTable");
+		return -1;
+	}
+	journalLBAread(currentVolume->refTable, blockCount, ourVCB->refTableLocation);
+	currentVolume->refTableCapacity = tableBytes / sizeof(extentRef);
+
+	currentVolume->refTableUsed = 0;
+	for (uint i = 0; i < currentVolume->refTableCapacity; i++)
+	{
+		currentVolume->refTableUsed += currentVolume->refTable[i].refCount > 0;
+	}
+	return 0;
+}
+
+/**
+ * @brief free the table in memory, it is read again when needed
+ */
+void freeRefTable()
+{
+	free(currentVolume->refTable);
+	currentVolume->refTable = NULL;
+	currentVolume->refTableCapacity = 0;
+	currentVolume->refTableUsed = 0;
+}
+
+/**
+ * @brief allocate an empty table on the volume the first time it is needed
+ *
+ * @return 0 for success, -1 for fail
+ */
+int createRefTable()
+{
+	if (loadRefTable() == 0)
+	{
+		return 0;
+	}
+
+	uint64_t start = allocateFreespace(REF_TABLE_BLOCK_COUNT);
+	if (start == -1)
+	{
+		eprintf("allocateFreespace() on refTable");
+		return -1;
+	}
+
+	uint64_t tableBytes = REF_TABLE_BLOCK_COUNT * ourVCB->blockSize;
+	currentVolume->refTable = fsMalloc(tableBytes);
+	if (currentVolume->refTable == NULL)
+	{
+		eprintf("malloc() on refTable");
+		releaseFreespace(start, REF_TABLE_BLOCK_COUNT);
+		return -1;
+	}
+	memset(currentVolume->refTable, 0, tableBytes);
+	currentVolume->refTableCapacity = tableBytes / sizeof(extentRef);
+	currentVolume->refTableUsed = 0;
+
+	journalLBAwrite(currentVolume->refTable, tableBytes, start);
+	ourVCB->refTableLocation = start;
+	ourVCB->refTableBlockCount = REF_TABLE_BLOCK_COUNT;
+	updateOurVCB();
+
+	dprintf("shared extent table created at %ld", start);
+	return 0;
+}
+
+/**
+ * @brief move the table to a place twice as long, the slots keep their
+ * index so only the pointers to the old table in memory go stale
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int growRefTable()
+{
+	uint64_t oldStart = ourVCB->refTableLocation;
+	uint64_t oldBlockCount = getRefTableBlockCount();
+	uint64_t newBlockCount = oldBlockCount * 2;
+
+	uint64_t start = allocateFreespace(newBlockCount);
+	if (start == -1)
+	{
+		return -1;
+	}
+
+	uint64_t oldBytes = oldBlockCount * ourVCB->blockSize;
+	uint64_t newBytes = newBlockCount * ourVCB->blockSize;
+	extentRef *newTable = fsRealloc(currentVolume->refTable, newBytes);
+	if (newTable == NULL)
+	{
+		eprintf("realloc() on refTable");
+		releaseFreespace(start, newBlockCount);
+		return -1;
+	}
+	memset((char *)newTable + oldBytes, 0, newBytes - oldBytes);
+	currentVolume->refTable = newTable;
+	currentVolume->refTableCapacity = newBytes / sizeof(extentRef);
+
+	journalLBAwrite(newTable, newBytes, start);
+	ourVCB->refTableLocation = start;
+	ourVCB->refTableBlockCount = newBlockCount;
+	updateOurVCB();
+	releaseFreespace(oldStart, oldBlockCount);
+
+	dprintf("shared extent table moved to %ld with %ld blocks", start, newBlockCount);
+	return 0;
+}
+
+/**
+ * @brief write back only the block holding the given slot
+ *
+ * @param ref a slot of the table
+ * @return 0 for success, -1 for fail
+ */
+int updateRefTableEntry(extentRef *ref)
+{
+	uint64_t offset = (char *)ref - (char *)currentVolume->refTable;
+	uint64_t block = offset / ourVCB->blockSize;
+	return journalLBAwrite((char *)currentVolume->refTable + block * ourVCB->blockSize, ourVCB->blockSize,
+						   ourVCB->refTableLocation + block);
+}
+
+/**
+ * @brief find an extent holding the same stored bytes
+ *
+ * @param fingerprint fingerprint of the stored bytes
+ * @param size exact size of the entry
+ * @param attributes ATTR_* bits of the entry
+ * @return the slot, NULL if not found
+ */
+extentRef *findExtentByFingerprint(uint64_t fingerprint, uint64_t size, unsigned char attributes)
+{
+	if (loadRefTable() != 0 || currentVolume->refTableUsed == 0)
+	{
+		return NULL;
+	}
+	extentRef *refTable = currentVolume->refTable;
+	uint refTableCapacity = currentVolume->refTableCapacity;
+
+	for (uint i = 0; i < refTableCapacity; i++)
+	{
+		if (refTable[i].refCount > 0 &&
+			refTable[i].fingerprint == fingerprint &&
+			refTable[i].size == size &&
+			refTable[i].attributes == attributes)
+		{
+			return refTable + i;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief find the slot of the extent starting at the LBA
+ *
+ * @param start LBA of the extent
+ * @return the slot, NULL if the extent is not shared
+ */
+extentRef *findExtentByStart(uint64_t start)
+{
+	if (loadRefTable() != 0 || currentVolume->refTableUsed == 0)
+	{
+		return NULL;
+	}
+	extentRef *refTable = currentVolume->refTable;
+	uint refTableCapacity = currentVolume->refTableCapacity;
+
+	for (uint i = 0; i < refTableCapacity; i++)
+	{
+		if (refTable[i].refCount > 0 && refTable[i].start == start)
+		{
+			return refTable + i;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief record an extent with one reference, a full table grows
+ *
+ * @return the slot, NULL if the table can't grow or fails
+ */
+extentRef *addExtentRef(uint64_t start, uint32_t blockCount, uint64_t size,
+						unsigned char attributes, uint64_t fingerprint)
+{
+	if (createRefTable() != 0)
+	{
+		return NULL;
+	}
+	if (currentVolume->refTableUsed == currentVolume->refTableCapacity && growRefTable() != 0)
+	{
+		printf("shared extent table is full, the volume has no room to grow it\n");
+		return NULL;
+	}
+	extentRef *refTable = currentVolume->refTable;
+	uint refTableCapacity = currentVolume->refTableCapacity;
+
+	for (uint i = 0; i < refTableCapacity; i++)
+	{
+		if (refTable[i].refCount == 0)
+		{
+			refTable[i].fingerprint = fingerprint;
+			refTable[i].start = start;
+			refTable[i].size = size;
+			refTable[i].blockCount = blockCount;
+			refTable[i].attributes = attributes;
+			refTable[i].refCount = 1;
+			currentVolume->refTableUsed++;
+			updateRefTableEntry(refTable + i);
+			return refTable + i;
+		}
+	}
+
+	eprintf("refTableUsed doesn't match the table");
+	return NULL;
+}
+
+/**
+ * @brief add one reference to an extent
+ *
+ * @param ref the slot of the extent
+ * @return 0 for success, -1 for fail
+ */
+int shareExtent(extentRef *ref)
+{
+	if (ref->refCount == (unsigned short)-1)
+	{
+		dprintf("extent %ld can't have more references", ref->start);
+		return -1;
+	}
+	ref->refCount++;
+	ldprintf("extent %ld has %d references", ref->start, ref->refCount);
+	return updateRefTableEntry(ref);
+}
+
+/**
+ * @brief remove one reference of the extent starting at the LBA
+ *
+ * @param start LBA of the extent
+ * @return references left, 0 means the blocks can be released
+ */
+int dropExtentRef(uint64_t start)
+{
+	extentRef *ref = findExtentByStart(start);
+	if (ref == NULL)
+	{ // not shared, the only owner is going away
+		return 0;
+	}
+
+	ref->refCount--;
+	if (ref->refCount == 0)
+	{
+		currentVolume->refTableUsed--;
+	}
+	updateRefTableEntry(ref);
+	dprintf("extent %ld has %d references left", start, ref->refCount);
+	return ref->refCount;
+}
+
+/**
+ * @brief record the new location of an extent whose blocks were copied
+ *
+ * @param ref the slot of the extent
+ * @param start LBA the blocks were copied to
+ * @return 0 for success, -1 for fail
+ */
+int moveExtentRef(extentRef *ref, uint64_t start)
+{
+	dprintf("extent %ld moves to %ld", ref->start, start);
+	ref->start = start;
+	return updateRefTableEntry(ref);
+}
+
+/**
+ * @brief compare the stored bytes of an extent with the data,
+ * so a fingerprint collision never links different files
+ *
+ * @param ref the slot of the extent
+ * @param data bytes that would be stored
+ * @param length amount of bytes that would be stored
+ * @return 1 for same, 0 for different or fail
+ */
+int extentMatches(extentRef *ref, const char *data, uint64_t length)
+{
+	if (getBlockCount(length) != ref->blockCount)
+	{
+		return 0;
+	}
+
+	char *readBuffer = fsMalloc(ref->blockCount * ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return 0;
+	}
+	deviceRead(readBuffer, ref->blockCount, ref->start);
+
+	int result = memcmp(readBuffer, data, length) == 0;
+
+	free(readBuffer);
+	readBuffer = NULL;
+	return result;
+}
@@ -0,0 +1,57 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: extent.h
+*
+* Description: Interface of the table of shared extents, which
+*	keeps a fingerprint and a reference count for each extent
+*	that can be pointed by more than one entry
+*
+**************************************************************/
+#ifndef _EXTENT_H
+#define _EXTENT_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+#ifndef uint32_t
+typedef u_int32_t uint32_t;
+#endif
+
+#define REF_TABLE_BLOCK_COUNT 32 // blocks of a new table, doubled each time it is full
+
+typedef struct extentRef
+{
+	uint64_t fingerprint;	  // hash of the stored bytes, 0 if never hashed
+	uint64_t start;			  // LBA of the extent
+	uint64_t size;			  // exact size of the entries pointing to it
+	uint32_t blockCount;	  // amount of blocks of the extent
+	unsigned short refCount;  // amount of entries pointing to it, 0 for free slot
+	unsigned char attributes; // ATTR_* bits every entry pointing to it must have
+	unsigned char reserved;	  // keeps a slot at 32 bytes so none crosses a block
+} extentRef;
+
+uint64_t fingerprintData(const char *data, uint64_t size);
+uint64_t fingerprintExtent(uint64_t start, uint32_t blockCount, uint64_t size, unsigned char attributes);
+uint64_t getRefTableBlockCount();
+int loadRefTable();
+void freeRefTable();
+extentRef *findExtentByFingerprint(uint64_t fingerprint, uint64_t size, unsigned char attributes);
+extentRef *findExtentByStart(uint64_t start);
+extentRef *addExtentRef(uint64_t start, uint32_t blockCount, uint64_t size,
+						unsigned char attributes, uint64_t fingerprint);
+int shareExtent(extentRef *ref);
+int dropExtentRef(uint64_t start);
+int moveExtentRef(extentRef *ref, uint64_t start);
+int extentMatches(extentRef *ref, const char *data, uint64_t length);
+
+#endif
@@ -26,18 +26,163 @@ Siqi Guo, 918209895, Guo-1999
 
 #include "fsLow.h"
 #include "mfs.h"
-
-// must matchthe size, currently it is 8 bytes
-#define MAGIC_NUMBER 0x53465F45524F4946 // stands for "FIORE_FS"
+#include "journal.h"
+#include "prefetch.h"
+#include "defrag.h"
+#include "extent.h"
+#include "inode.h"
 
 int initVCB(uint64_t, uint64_t, uint);
 int initFreespace();
 int initRootDir();
+int mountVolume(uint64_t, uint64_t);
+void unmountVolume();
+
+/**
+ * @brief create the in-memory state of a volume and use it on this thread
+ * 
+ * @param fileName volume file, NULL for the partition started by startPartitionSystem()
+ * @param volumeSize size for a new file, filled with the size of the volume
+ * @param blockSize block size for a new file, filled with the block size
+ * @return the volume, NULL for fail
+ */
+fsVolume *openVolume(char *fileName, uint64_t *volumeSize, uint64_t *blockSize)
+{
+	fsVolume *volume = fsMalloc(sizeof(fsVolume));
+	if (volume == NULL)
+	{
+		eprintf("malloc() on volume");
+		return NULL;
+	}
+	memset(volume, 0, sizeof(fsVolume));
+	volume->deviceFd = -1;
+
+	if (fileName != NULL)
+	{
+		volume->deviceFd = deviceOpen(fileName, volumeSize, blockSize);
+		if (volume->deviceFd < 0)
+		{
+			free(volume);
+			return NULL;
+		}
+		volume->deviceBlockSize = *blockSize;
+	}
 
+	volume->journal = openJournalState();
+	volume->prefetch = openPrefetchState();
+	volume->defrag = openDefragState();
+	if (volume->journal == NULL || volume->prefetch == NULL || volume->defrag == NULL)
+	{
+		closeVolume(volume);
+		return NULL;
+	}
+
+	currentVolume = volume;
+	return volume;
+}
+
+/**
+ * @brief free the in-memory state of a volume which is not mounted
+ * 
+ * @param volume the volume
+ */
+void closeVolume(fsVolume *volume)
+{
+	if (volume == NULL)
+	{
+		return;
+	}
+	closeJournalState(volume->journal);
+	closePrefetchState(volume->prefetch);
+	closeDefragState(volume->defrag);
+	deviceClose(volume->deviceFd);
+	if (currentVolume == volume)
+	{
+		currentVolume = NULL;
+	}
+	free(volume);
+}
+
+/**
+ * @brief mount the partition started by startPartitionSystem(),
+ * it becomes the volume of every call without a session
+ * 
+ * @param numberOfBlocks amount of blocks in the volume
+ * @param blockSize size (in bytes) of a block
+ * @return 0 for success, -1 for fail
+ */
 int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize)
 {
 	printf("Initializing File System with %ld blocks with a block size of %ld\n", numberOfBlocks, blockSize);
 
+	defaultVolume = openVolume(NULL, NULL, NULL);
+	if (defaultVolume == NULL)
+	{
+		eprintf("openVolume() failed");
+		return -1;
+	}
+	return mountVolume(numberOfBlocks, blockSize);
+}
+
+void exitFileSystem()
+{
+	currentVolume = defaultVolume;
+	unmountVolume();
+	closeVolume(defaultVolume);
+	defaultVolume = NULL;
+
+	printf("System exiting\n");
+}
+
+/**
+ * @brief mount a volume file, it is made and formatted if it is missing,
+ * any amount of volumes can be mounted at the same time
+ * 
+ * @param fileName path of the volume file
+ * @param volumeSize size of a new volume in bytes, 0 to only open an existing one
+ * @param blockSize block size of a new volume
+ * @return the volume, NULL for fail
+ */
+fsVolume *fs_mount(char *fileName, uint64_t volumeSize, uint64_t blockSize)
+{
+	fsVolume *volume = openVolume(fileName, &volumeSize, &blockSize);
+	if (volume == NULL)
+	{
+		return NULL;
+	}
+
+	if (mountVolume(volumeSize / blockSize, blockSize) != 0)
+	{
+		eprintf("mountVolume() failed on %s", fileName);
+		closeVolume(volume);
+		return NULL;
+	}
+	return volume;
+}
+
+/**
+ * @brief close a volume mounted by fs_mount(), its sessions must be closed first
+ * 
+ * @param volume the volume
+ * @return 0 for success
+ */
+int fs_unmount(fsVolume *volume)
+{
+	currentVolume = volume;
+	unmountVolume();
+	closeVolume(volume);
+	return 0;
+}
+
+/**
+ * @brief read the vcb of the volume in use, and format it if it is not ours
+ * 
+ * @param numberOfBlocks amount of blocks in the volume
+ * @param blockSize size (in bytes) of a block
+ * @return 0 for success, -1 for fail
+ */
+int mountVolume(uint64_t numberOfBlocks, uint64_t blockSize)
+{
 	// find how many blocks of VCB needed to read
 	// can't call getBlockCount() because it needs vcb to be initialized
 	uint blockCountOfVCB = sizeof(vcb) / blockSize;
@@ -47,16 +192,16 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize)
 	}
 
 	// initialize a buffer and read from the beginning block of the volume
-	char *readBuffer = malloc(blockCountOfVCB * blockSize);
+	char *readBuffer = fsMalloc(blockCountOfVCB * blockSize);
 	if (readBuffer == NULL)
 	{
 		eprintf("malloc() on readBuffer");
 		return -1;
 	}
-	LBAread(readBuffer, blockCountOfVCB, 0);
+	deviceRead(readBuffer, blockCountOfVCB, 0);
 
 	// allocate space for our VCB and copy the data from the buffer into ourVCB
-	ourVCB = malloc(sizeof(vcb));
+	ourVCB = fsMalloc(sizeof(vcb));
 	if (ourVCB == NULL)
 	{
 		eprintf("malloc() on ourVCB");
@@ -70,48 +215,46 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize)
 	// determine the volume is formatted as our file system by checking magic number
 	if (MAGIC_NUMBER == ourVCB->magicNumber)
 	{
-		// read the freespace from the volume into buffer
-		readBuffer = malloc(ourVCB->freespaceBlockCount * ourVCB->blockSize);
-		if (readBuffer == NULL)
+		// finish the metadata committed before a crash, this can change ourVCB
+		if (replayJournal() < 0)
 		{
-			eprintf("malloc() on readBuffer");
+			eprintf("replayJournal() failed");
 			return -1;
 		}
-		LBAread(readBuffer, ourVCB->freespaceBlockCount, ourVCB->vcbBlockCount);
 
-		// copy the needed amount of data into freespace
-		freespace = malloc(ourVCB->numberOfBlocks);
-		if (freespace == NULL)
+		// the bitmap is read one page at a time when it is needed
+		if (loadFreespace() != 0)
 		{
-			eprintf("malloc() on freespace");
+			eprintf("loadFreespace() failed");
 			return -1;
 		}
-		memcpy(freespace, readBuffer, ourVCB->numberOfBlocks);
-
-		// free the buffer for reuse
-		free(readBuffer);
-		readBuffer = NULL;
 
-		// get the root directory as cwd
-		readBuffer = malloc(getBlockCount(sizeof(fdDir)) * ourVCB->blockSize);
-		if (readBuffer == NULL)
+		// the checks are only needed when the last session did not finish
+		if (ourVCB->volumeState == VOLUME_CLEAN)
 		{
-			eprintf("malloc() on readBuffer");
-			return -1;
+			dprintf("volume was closed cleanly, skipping checks");
 		}
-		LBAread(readBuffer, getBlockCount(sizeof(fdDir)), ourVCB->rootDirLocation);
-
-		// malloc() the root directory pointer and copy the data in
-		fsCWD = malloc(sizeof(fdDir));
-		if (fsCWD == NULL)
+		else if (checkFreespace() != 0)
 		{
-			eprintf("malloc() on root");
+			eprintf("checkFreespace() failed");
 			return -1;
 		}
-		memcpy(fsCWD, readBuffer, sizeof(fdDir));
 
-		free(readBuffer);
-		readBuffer = NULL;
+		// entries of files point into the inode table, so it is loaded
+		// before any directory is read, a volume without one gets it later
+		loadInodeTable();
+
+		// a crash from now on leaves the volume dirty,
+		// this goes straight home since the journal is not started yet
+		ourVCB->volumeState = VOLUME_DIRTY;
+		updateOurVCB();
+
+		// directories used the most last time are read in the background,
+		// while this thread goes on with the root directory
+		if (startPrefetch() != 0)
+		{
+			eprintf("startPrefetch() failed");
+		}
 	}
 	else
 	{
@@ -136,6 +279,13 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize)
 		updateOurVCB();
 	}
 
+	// metadata is journaled from now on, volumes made before it get one here
+	if (initJournal() != 0)
+	{
+		eprintf("initJournal() failed");
+		return -1;
+	}
+
 	// testing vcb status
 	dprintf("*** VCB STATUS ***");
 	dprintf("number of blocks: %ld", ourVCB->numberOfBlocks);
@@ -144,17 +294,47 @@ int initFileSystem(uint64_t numberOfBlocks, uint64_t blockSize)
 	dprintf("freespace block count: %d", ourVCB->freespaceBlockCount);
 	dprintf("first free block index: %ld\n\n", ourVCB->firstFreeBlockIndex);
 
-	// setting the other status in memory
-	openedDir = NULL;
-	openedDirEntryIndex = 0;
+	// the calls without a session start from the root directory
+	currentVolume->defaultSession = fs_opensession(currentVolume);
+	if (currentVolume->defaultSession == NULL)
+	{
+		eprintf("fs_opensession() failed");
+		return -1;
+	}
 
 	return 0;
 }
 
-void exitFileSystem()
+/**
+ * @brief write everything of the volume in use home and free its memory
+ */
+void unmountVolume()
 {
-	// TODO close all
-	printf("System exiting\n");
+	// a move in progress finishes first
+	stopDefrag();
+
+	// files still open are written back the same as b_close()
+	b_closeAll();
+	stopPrefetch();
+	savePrefetchPlan();
+	updateFreespace();
+	flushInodeTimes();
+
+	// write the batched metadata home in LBA order so the next mount
+	// has nothing to replay, then mark the volume clean as the last write
+	closeJournal();
+	ourVCB->volumeState = VOLUME_CLEAN;
+	updateOurVCB();
+
+	// free everything kept in memory
+	closeFreespace(freespace);
+	freespace = NULL;
+	freeRefTable();
+	freeInodeTable();
+	fs_closesession(currentVolume->defaultSession);
+	currentVolume->defaultSession = NULL;
+	free(ourVCB);
+	ourVCB = NULL;
 }
 
 /**
@@ -176,6 +356,7 @@ int initVCB(uint64_t numberOfBlocks, uint64_t blockSize, uint blockCountOfVCB)
 	ourVCB->blockSize = blockSize;
 	ourVCB->vcbBlockCount = blockCountOfVCB;
 	ourVCB->firstFreeBlockIndex = 0; // this step is just for in case
+	ourVCB->featureFlags = FEATURE_LOCALITY | FEATURE_FREE_COUNT;
 
 	// each block needs one bit to indicate the status
 	// do a round up before we get block count since it cotains a division
@@ -197,18 +378,8 @@ int initVCB(uint64_t numberOfBlocks, uint64_t blockSize, uint blockCountOfVCB)
  */
 int initFreespace()
 {
-	// initialize the bitmap array with all 0s to represent free by default
-	// this is because int 0 is the same as all 0 in bits
-	freespace = malloc(ourVCB->numberOfBlocks);
-	if (freespace == NULL)
-	{
-		eprintf("malloc() on freespace");
-		return -1;
-	}
-	memset(freespace, 0, ourVCB->numberOfBlocks);
-
-	// set current used block which is taken by VCB and this bitmap
-	return allocateFreespace(ourVCB->freespaceBlockCount + ourVCB->vcbBlockCount);
+	// every block starts free, then VCB and this bitmap are taken
+	return formatFreespace();
 }
 
 /**
@@ -229,8 +400,9 @@ int initRootDir()
 	// write the directory file psycially
 	updateDirectory(retDir);
 
-	// set the root directory as cwd
-	fsCWD = retDir;
-	ourVCB->rootDirLocation = fsCWD->directoryStartLocation;
+	// the root directory is read again as cwd when the session is opened
+	ourVCB->rootDirLocation = retDir->directoryStartLocation;
+	free(retDir);
+	retDir = NULL;
 	return 0;
 }
\ No newline at end of file
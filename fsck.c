@@ -0,0 +1,883 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: fsck.c
+*
+* Description: offline checker of a volume, run while no shell has
+* it mounted. it walks the directory tree from the root, builds the
+* bitmap the volume should have and reports (or repairs with -r)
+* every block where the freespace differs from it. the usage kept in
+* each directory is compared with its subtree, -r marks a wrong one and
+* the directories above it as not counted so du counts them again.
+* without -r nothing is written to the volume, and a volume that is
+* mounted or was not closed cleanly is only checked with -f.
+*
+* directories are checked by a pool of threads, each with its own
+* queue of directories, and an idle thread steals from the others.
+* the child directories of a directory are read sorted by LBA, with
+* the ones next to each other taken in one read.
+*
+**************************************************************/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "fsLow.h"
+#include "mfs.h"
+#include "extent.h"
+#include "inode.h"
+#include "journal.h"
+
+#define FSCK_MAX_THREADS 16
+#define FSCK_REPORT_LIMIT 20 // differences printed one by one
+
+// exit codes, same meaning as the ones of e2fsck
+#define FSCK_OK 0
+#define FSCK_REPAIRED 1
+#define FSCK_UNREPAIRED 4
+#define FSCK_FAILED 8
+
+typedef struct
+{
+	fdDir *dir; // the directory, already read
+	char *path; // full path, for the report
+} fsckWork;
+
+// the owner pushes and pops at the bottom, the others steal at the top
+typedef struct
+{
+	fsckWork *items;
+	uint64_t top;
+	uint64_t bottom;
+	uint64_t capacity;
+	pthread_mutex_t lock;
+} workDeque;
+
+static workDeque deques[FSCK_MAX_THREADS];
+static int threadCount = 0;
+static long pendingWork = 0; // pushed but not finished yet
+
+static uint64_t *expected = NULL; // blocks the tree and the metadata use
+static unsigned char *inodeSeen = NULL; // 1 for each inode an entry points to
+static uint dirBlockCount = 0;
+static fsVolume *checkedVolume = NULL; // used by every worker
+
+static char **wrongUsage = NULL; // paths of directories keeping a wrong usage, under reportLock
+static long wrongUsageCount = 0;
+
+static long problemCount = 0;
+static long dirCount = 0;
+static long fileCount = 0;
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief print a problem, from any thread
+ */
+#define report(fmt, args...)                                  \
+	do                                                        \
+	{                                                         \
+		pthread_mutex_lock(&reportLock);                      \
+		printf(fmt "\n", ##args);                             \
+		pthread_mutex_unlock(&reportLock);                    \
+		__atomic_add_fetch(&problemCount, 1, __ATOMIC_RELAXED); \
+	} while (0)
+
+/**
+ * @brief mark blocks as expected to be used
+ *
+ * @param start first block
+ * @param count amount of blocks
+ * @param path what uses them, for the report
+ * @param shared 1 if other entries can use the same blocks
+ * @return amount of blocks already marked, -1 if outside the volume
+ */
+static long markBlocks(uint64_t start, uint64_t count, const char *path, int shared)
+{
+	if (count == 0 || start >= ourVCB->numberOfBlocks || count > ourVCB->numberOfBlocks - start)
+	{
+		report("%s: blocks %ld-%ld are outside the volume", path, start, start + count - 1);
+		return -1;
+	}
+
+	long overlaps = 0;
+	for (uint64_t i = start; i < start + count; i++)
+	{
+		uint64_t mask = 1ULL << (i % 64);
+		if (__atomic_fetch_or(expected + i / 64, mask, __ATOMIC_RELAXED) & mask)
+		{
+			overlaps++;
+		}
+	}
+	if (overlaps > 0 && !shared)
+	{
+		report("%s: %ld blocks at %ld are also used by something else", path, overlaps, start);
+	}
+	return overlaps;
+}
+
+/**
+ * @brief add a directory to the queue of a worker
+ *
+ * @param owner index of the worker
+ * @param work the directory, the queue takes it
+ * @return 0 for success, -1 for fail
+ */
+static int pushWork(int owner, fsckWork work)
+{
+	workDeque *deque = deques + owner;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->bottom == deque->capacity)
+	{
+		// reuse the room left by stolen items before growing
+		if (deque->top > 0)
+		{
+			memmove(deque->items, deque->items + deque->top,
+					(deque->bottom - deque->top) * sizeof(fsckWork));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		}
+		else
+		{
+			uint64_t newCapacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+			fsckWork *newItems = realloc(deque->items, newCapacity * sizeof(fsckWork));
+			if (newItems == NULL)
+			{
+				pthread_mutex_unlock(&deque->lock);
+				eprintf("realloc() on items");
+				return -1;
+			}
+			deque->items = newItems;
+			deque->capacity = newCapacity;
+		}
+	}
+	__atomic_add_fetch(&pendingWork, 1, __ATOMIC_SEQ_CST);
+	deque->items[deque->bottom++] = work;
+	pthread_mutex_unlock(&deque->lock);
+	return 0;
+}
+
+/**
+ * @brief take a directory, from the own queue first, then from the others
+ *
+ * @param owner index of the worker
+ * @param work where to put the directory
+ * @return 1 for found, 0 for nothing to do now
+ */
+static int takeWork(int owner, fsckWork *work)
+{
+	for (int i = 0; i < threadCount; i++)
+	{
+		int victim = (owner + i) % threadCount;
+		workDeque *deque = deques + victim;
+		int found = 0;
+
+		pthread_mutex_lock(&deque->lock);
+		if (deque->bottom > deque->top)
+		{
+			// the newest of our own keeps the walk depth first,
+			// the oldest of another is likely a big subtree
+			*work = victim == owner ? deque->items[--deque->bottom] : deque->items[deque->top++];
+			found = 1;
+		}
+		pthread_mutex_unlock(&deque->lock);
+
+		if (found)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief join a parent path and a name
+ *
+ * @return the new path, NULL for fail
+ */
+static char *joinPath(const char *parent, const char *name)
+{
+	char *path = malloc(strlen(parent) + strlen(name) + 2);
+	if (path == NULL)
+	{
+		eprintf("malloc() on path");
+		return NULL;
+	}
+	sprintf(path, "%s%s%s", parent, strcmp(parent, "/") == 0 ? "" : "/", name);
+	return path;
+}
+
+/**
+ * @brief compare two entries by their LBA
+ */
+static int compareEntryLBA(const void *a, const void *b)
+{
+	const struct fs_diriteminfo *left = *(struct fs_diriteminfo *const *)a;
+	const struct fs_diriteminfo *right = *(struct fs_diriteminfo *const *)b;
+	if (left->entryStartLocation == right->entryStartLocation)
+	{
+		return 0;
+	}
+	return left->entryStartLocation < right->entryStartLocation ? -1 : 1;
+}
+
+/**
+ * @brief read the child directories, next to each other ones in one read,
+ * and give them to the worker
+ *
+ * @param owner index of the worker
+ * @param path path of the parent
+ * @param children entries of the child directories, sorted by LBA
+ * @param count amount of children
+ * @param usage adds the usage kept by each child, blocks stay 0 if one is not counted
+ */
+static void readChildren(int owner, const char *path, struct fs_diriteminfo **children, int count,
+						 struct fs_dirusage *usage)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint64_t runBytes = dirBlockCount * ourVCB->blockSize;
+	char *readBuffer = malloc(count * runBytes);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return;
+	}
+
+	for (int i = 0; i < count;)
+	{
+		int run = 1;
+		while (i + run < count &&
+			   children[i + run]->entryStartLocation == children[i]->entryStartLocation + run * dirBlockCount)
+		{
+			run++;
+		}
+		deviceRead(readBuffer, run * dirBlockCount, children[i]->entryStartLocation);
+
+		for (int j = 0; j < run; j++)
+		{
+			struct fs_diriteminfo *entry = children[i + j];
+			char *childPath = joinPath(path, entry->d_name);
+			fdDir *child = malloc(sizeof(fdDir));
+			if (childPath == NULL || child == NULL)
+			{
+				eprintf("malloc() on child");
+				free(childPath);
+				free(child);
+				continue;
+			}
+			if (unpackDirectory(readBuffer + j * runBytes, runBytes, child) != 0)
+			{
+				report("%s: directory at LBA %ld is damaged", childPath, entry->entryStartLocation);
+				free(childPath);
+				free(child);
+				continue;
+			}
+
+			if (child->directoryStartLocation != entry->entryStartLocation)
+			{
+				report("%s: does not point to a directory (LBA %ld)", childPath, entry->entryStartLocation);
+				free(childPath);
+				free(child);
+				continue;
+			}
+
+			if (child->usedBlocks == 0 || usage->du_blocks == 0)
+			{
+				usage->du_blocks = 0;
+			}
+			else
+			{
+				usage->du_bytes += child->usedBytes;
+				usage->du_blocks += child->usedBlocks;
+			}
+
+			fsckWork work = {child, childPath};
+			if (pushWork(owner, work) != 0)
+			{
+				free(childPath);
+				free(child);
+			}
+		}
+		i += run;
+	}
+
+	free(readBuffer);
+	readBuffer = NULL;
+}
+
+/**
+ * @brief check the inode a file points to, and take the location
+ * and size from it since that is what the file system reads
+ *
+ * @param entry entry of the file, updated from the inode
+ * @param path path of the file, for the report
+ */
+static void checkInode(struct fs_diriteminfo *entry, const char *path)
+{
+	inode *node = getInode(entry->inodeNumber);
+	if (node == NULL)
+	{
+		report("%s: points to inode %u which is not used", path, entry->inodeNumber);
+		return;
+	}
+	if (__atomic_exchange_n(inodeSeen + entry->inodeNumber - 1, 1, __ATOMIC_RELAXED))
+	{
+		report("%s: inode %u is also pointed to by another entry", path, entry->inodeNumber);
+	}
+
+	entry->entryStartLocation = node->entryStartLocation;
+	entry->size = node->size;
+	entry->attributes = node->attributes;
+}
+
+/**
+ * @brief report the inodes in use that no entry points to
+ */
+static void checkLostInodes()
+{
+	for (uint i = 0; i < currentVolume->inodeTableCapacity; i++)
+	{
+		if (getInode(i + 1) != NULL && !inodeSeen[i])
+		{
+			report("inode %u is used but no entry points to it", i + 1);
+		}
+	}
+}
+
+/**
+ * @brief check the entries of one directory and queue its children
+ *
+ * @param owner index of the worker
+ * @param work the directory
+ */
+static void checkDirectory(int owner, fsckWork *work)
+{
+	fdDir *dir = work->dir;
+	struct fs_diriteminfo *children[MAX_AMOUNT_OF_ENTRIES];
+	int childCount = 0;
+	int usedCount = 0;
+	struct fs_dirusage usage = {0, dirBlockCount};
+
+	__atomic_add_fetch(&dirCount, 1, __ATOMIC_RELAXED);
+
+	for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+	{
+		struct fs_diriteminfo *entry = dir->entryList + i;
+		if (entry->space != SPACE_USED)
+		{
+			continue;
+		}
+		usedCount++;
+
+		// . and .. are checked as the entries of their own directories
+		if (i < 2)
+		{
+			continue;
+		}
+
+		char *path = joinPath(work->path, entry->d_name);
+		if (path == NULL)
+		{
+			continue;
+		}
+
+		if (entry->fileType == TYPE_DIR)
+		{
+			// a directory reached twice is a loop or a cross link, not walked again
+			if (markBlocks(entry->entryStartLocation, dirBlockCount, path, 0) == 0)
+			{
+				children[childCount++] = entry;
+			}
+		}
+		else if (entry->fileType == TYPE_FILE)
+		{
+			__atomic_add_fetch(&fileCount, 1, __ATOMIC_RELAXED);
+			if (entry->inodeNumber != 0)
+			{
+				checkInode(entry, path);
+			}
+			uint64_t blockCount = getExtentBlockCount(entry);
+			if (blockCount == 0)
+			{
+				report("%s: extent at %ld has no valid length", path, entry->entryStartLocation);
+			}
+			else
+			{
+				int shared = findExtentByStart(entry->entryStartLocation) != NULL;
+				markBlocks(entry->entryStartLocation, blockCount, path, shared);
+			}
+			usage.du_bytes += entry->size;
+			usage.du_blocks += blockCount;
+		}
+		else
+		{
+			report("%s: unknown file type %d", path, entry->fileType);
+		}
+		free(path);
+	}
+
+	if (usedCount != dir->dirEntryAmount)
+	{
+		report("%s: has %d entries but counts %d", work->path, usedCount, dir->dirEntryAmount);
+	}
+
+	qsort(children, childCount, sizeof(struct fs_diriteminfo *), compareEntryLBA);
+	readChildren(owner, work->path, children, childCount, &usage);
+
+	// directories of older volumes are not counted, but then neither is their parent
+	if (dir->usedBlocks != 0 &&
+		(usage.du_blocks != dir->usedBlocks || usage.du_bytes != dir->usedBytes))
+	{
+		report("%s: keeps a usage of %ld bytes in %ld blocks, its subtree has %ld bytes in %ld blocks",
+			   work->path, dir->usedBytes, dir->usedBlocks, usage.du_bytes, usage.du_blocks);
+
+		pthread_mutex_lock(&reportLock);
+		char **paths = realloc(wrongUsage, (wrongUsageCount + 1) * sizeof(char *));
+		char *path = strdup(work->path);
+		if (paths != NULL)
+		{
+			wrongUsage = paths;
+		}
+		if (paths != NULL && path != NULL)
+		{
+			wrongUsage[wrongUsageCount++] = path;
+		}
+		else
+		{
+			free(path);
+		}
+		pthread_mutex_unlock(&reportLock);
+	}
+}
+
+/**
+ * @brief mark a directory keeping a wrong usage and every directory above
+ * it as not counted, the next du counts them again from their subtrees,
+ * since a counted directory can't be under one that is not
+ *
+ * @param path full path of the directory
+ * @return 0 for success, -1 for fail
+ */
+static int clearUsage(const char *path)
+{
+	fdDir *dir = getRootDir();
+	while (dir != NULL)
+	{
+		if (dir->usedBlocks != 0)
+		{
+			dir->usedBytes = 0;
+			dir->usedBlocks = 0;
+			updateDirectory(dir);
+		}
+
+		// go down one name of the path
+		while (*path == '/')
+		{
+			path++;
+		}
+		if (*path == '\0')
+		{
+			releaseDir(dir);
+			return 0;
+		}
+		size_t length = strcspn(path, "/");
+		int i = findEntry(dir, path, length);
+		fdDir *child = i >= 0 ? getDirByEntry(dir->entryList + i) : NULL;
+		releaseDir(dir);
+		dir = child;
+		path += length;
+	}
+	return -1;
+}
+
+/**
+ * @brief body of a worker thread
+ *
+ * @param arg index of the worker
+ * @return NULL
+ */
+static void *fsckWorker(void *arg)
+{
+	int owner = (int)(long)arg;
+	fsckWork work;
+	currentVolume = checkedVolume;
+
+	while (1)
+	{
+		if (takeWork(owner, &work))
+		{
+			checkDirectory(owner, &work);
+			free(work.dir);
+			free(work.path);
+			__atomic_sub_fetch(&pendingWork, 1, __ATOMIC_SEQ_CST);
+		}
+		else if (__atomic_load_n(&pendingWork, __ATOMIC_SEQ_CST) == 0)
+		{ // nothing queued anywhere and nobody can queue more
+			break;
+		}
+		else
+		{
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief mark the blocks used by the metadata of the volume
+ */
+static void markMetadata()
+{
+	markBlocks(0, ourVCB->vcbBlockCount + ourVCB->freespaceBlockCount, "vcb and bitmap", 0);
+	if (ourVCB->freespaceSummaryLocation != 0)
+	{
+		markBlocks(ourVCB->freespaceSummaryLocation, freespace->summaryBlockCount, "freespace summary", 0);
+	}
+	if (ourVCB->refTableLocation != 0)
+	{
+		markBlocks(ourVCB->refTableLocation, getRefTableBlockCount(), "shared extent table", 0);
+	}
+	for (uint i = 0; getInodeSegmentLocation(i) != 0; i++)
+	{
+		markBlocks(getInodeSegmentLocation(i), INODE_TABLE_BLOCK_COUNT, "inode table", 0);
+	}
+	if (ourVCB->journalLocation != 0)
+	{
+		markBlocks(ourVCB->journalLocation, ourVCB->journalBlockCount, "journal", 0);
+	}
+	if (ourVCB->prefetchPlanLocation != 0)
+	{
+		markBlocks(ourVCB->prefetchPlanLocation, 1, "prefetch plan", 0);
+	}
+	markBlocks(ourVCB->rootDirLocation, dirBlockCount, "/", 0);
+}
+
+/**
+ * @brief print a run of blocks that differ, the first few only
+ *
+ * @param used 1 for used but marked free, 0 for free but marked used
+ * @param start first block of the run
+ * @param count length of the run
+ * @param runs amount of runs printed so far
+ */
+static void reportRun(int used, uint64_t start, uint64_t count, long runs)
+{
+	if (runs < FSCK_REPORT_LIMIT)
+	{
+		printf("blocks %ld-%ld are %s\n", start, start + count - 1,
+			   used ? "used but marked free" : "marked used but not used (leaked)");
+	}
+	else if (runs == FSCK_REPORT_LIMIT)
+	{
+		printf("...\n");
+	}
+}
+
+/**
+ * @brief compare the expected bitmap with the freespace of the volume
+ *
+ * @param repair 1 to fix the freespace
+ * @return amount of blocks that differ
+ */
+static uint64_t compareBitmap(int repair)
+{
+	uint64_t missing = 0, leaked = 0, freeBits = 0;
+	uint64_t runStart = 0, runLength = 0;
+	int runUsed = 0;
+	long runs = 0;
+
+	for (uint64_t i = 0; i <= ourVCB->numberOfBlocks; i++)
+	{
+		int differs = 0, want = 0;
+		if (i < ourVCB->numberOfBlocks)
+		{
+			want = (expected[i / 64] >> (i % 64)) & 1;
+			int bit = checkBit(i);
+			differs = want != bit;
+			freeBits += bit == SPACE_FREE;
+		}
+
+		// close the run when it stops or changes its kind
+		if (runLength > 0 && (!differs || want != runUsed))
+		{
+			reportRun(runUsed, runStart, runLength, runs++);
+			runLength = 0;
+		}
+		if (!differs)
+		{
+			continue;
+		}
+
+		if (runLength == 0)
+		{
+			runStart = i;
+			runUsed = want;
+		}
+		runLength++;
+
+		if (want)
+		{
+			missing++;
+			if (repair)
+			{
+				setBitUsed(i);
+			}
+		}
+		else
+		{
+			leaked++;
+			if (repair)
+			{
+				setBitFree(i);
+			}
+		}
+	}
+
+	printf("%ld blocks used but marked free, %ld blocks leaked\n", missing, leaked);
+
+	// checkFreespace() sums the count again when repairing
+	uint64_t countDiffers = freeBits != ourVCB->freeBlockCount;
+	if (countDiffers)
+	{
+		printf("vcb counts %ld free blocks, the bitmap has %ld\n", ourVCB->freeBlockCount, freeBits);
+	}
+	return missing + leaked + countDiffers;
+}
+
+int main(int argc, char *argv[])
+{
+	int repair = 0;
+	int force = 0;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int c;
+
+	while ((c = getopt(argc, argv, "frj:")) != -1)
+	{
+		switch (c)
+		{
+		case 'f':
+			force = 1;
+			break;
+		case 'r':
+			repair = 1;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			printf("Usage: fsck [-f] [-r] [-j threads] volumeFileName\n");
+			return FSCK_FAILED;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		printf("Usage: fsck [-f] [-r] [-j threads] volumeFileName\n");
+		return FSCK_FAILED;
+	}
+	threadCount = threads < 1 ? 1 : threads > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : threads;
+
+	// a size of 0 never makes a missing file
+	char *filename = argv[optind];
+	if (access(filename, R_OK | W_OK) != 0)
+	{
+		printf("%s can't be opened\n", filename);
+		return FSCK_FAILED;
+	}
+	uint64_t volumeSize = 0, blockSize = 0;
+	checkedVolume = openVolume(filename, &volumeSize, &blockSize);
+	if (checkedVolume == NULL)
+	{
+		printf("%s can't be opened as a volume\n", filename);
+		return FSCK_FAILED;
+	}
+
+	// read the vcb the same way initFileSystem() does
+	uint blockCountOfVCB = sizeof(vcb) / blockSize + (sizeof(vcb) % blockSize > 0);
+	char *readBuffer = malloc(blockCountOfVCB * blockSize);
+	ourVCB = malloc(sizeof(vcb));
+	if (readBuffer == NULL || ourVCB == NULL)
+	{
+		eprintf("malloc() on ourVCB");
+		return FSCK_FAILED;
+	}
+	deviceRead(readBuffer, blockCountOfVCB, 0);
+	memcpy(ourVCB, readBuffer, sizeof(vcb));
+	free(readBuffer);
+	readBuffer = NULL;
+
+	if (ourVCB->magicNumber != MAGIC_NUMBER)
+	{
+		printf("%s is not a Fiore volume\n", filename);
+		closeVolume(checkedVolume);
+		return FSCK_FAILED;
+	}
+
+	// a shell may have it mounted and change it during the check
+	int wasClean = ourVCB->volumeState == VOLUME_CLEAN;
+	if (!wasClean)
+	{
+		printf("%s was not closed cleanly, or is mounted now\n", filename);
+		if (!force)
+		{
+			printf("run with -f to check it anyway\n");
+			closeVolume(checkedVolume);
+			return FSCK_FAILED;
+		}
+	}
+	checkedVolume->readOnly = !repair;
+
+	// the tree is only complete with the committed records, replaying
+	// writes them home so it is part of a repair, a clean volume has none
+	if (repair && replayJournal() < 0)
+	{
+		closeVolume(checkedVolume);
+		return FSCK_FAILED;
+	}
+	if (!repair && !wasClean)
+	{
+		printf("the journal is not replayed without -r, the last operations may be missing\n");
+	}
+	if (loadFreespace() != 0)
+	{
+		closeVolume(checkedVolume);
+		return FSCK_FAILED;
+	}
+	loadRefTable();
+	loadInodeTable();
+
+	dirBlockCount = getBlockCount(DIR_EXTENT_SIZE);
+	expected = calloc(ourVCB->numberOfBlocks / 64 + 1, sizeof(uint64_t));
+	inodeSeen = calloc(checkedVolume->inodeTableCapacity + 1, 1);
+	fdDir *root = malloc(sizeof(fdDir));
+	char *rootPath = malloc(2);
+	readBuffer = malloc(dirBlockCount * ourVCB->blockSize);
+	if (expected == NULL || inodeSeen == NULL || root == NULL || rootPath == NULL || readBuffer == NULL)
+	{
+		eprintf("malloc() on expected or root");
+		return FSCK_FAILED;
+	}
+	deviceRead(readBuffer, dirBlockCount, ourVCB->rootDirLocation);
+	if (unpackDirectory(readBuffer, dirBlockCount * ourVCB->blockSize, root) != 0)
+	{
+		eprintf("root directory is damaged");
+		return FSCK_FAILED;
+	}
+	free(readBuffer);
+	readBuffer = NULL;
+	strcpy(rootPath, "/");
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	markMetadata();
+	for (int i = 0; i < threadCount; i++)
+	{
+		memset(deques + i, 0, sizeof(workDeque));
+		pthread_mutex_init(&deques[i].lock, NULL);
+	}
+	fsckWork rootWork = {root, rootPath};
+	pushWork(0, rootWork);
+
+	pthread_t workers[FSCK_MAX_THREADS];
+	for (long i = 0; i < threadCount; i++)
+	{
+		pthread_create(workers + i, NULL, fsckWorker, (void *)i);
+	}
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	for (int i = 0; i < threadCount; i++)
+	{
+		free(deques[i].items);
+		pthread_mutex_destroy(&deques[i].lock);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	checkLostInodes();
+	printf("%ld directories, %ld files walked by %d threads in %.3f ms\n", dirCount, fileCount, threadCount,
+		   ((end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9) * 1e3);
+
+	uint64_t differences = compareBitmap(repair);
+	long usageCleared = 0;
+	for (long i = 0; i < wrongUsageCount; i++)
+	{
+		if (repair && clearUsage(wrongUsage[i]) == 0)
+		{
+			usageCleared++;
+		}
+		free(wrongUsage[i]);
+	}
+	free(wrongUsage);
+	wrongUsage = NULL;
+	problemCount -= usageCleared;
+
+	int retVal = FSCK_OK;
+	if (differences > 0 || problemCount > 0)
+	{
+		retVal = FSCK_UNREPAIRED;
+	}
+
+	// only the freespace and the usage are repaired, a broken tree is left to the user
+	if (repair && differences > 0)
+	{
+		updateFreespace();
+		checkFreespace();
+	}
+	if (repair && (differences > 0 || usageCleared > 0))
+	{
+		retVal = problemCount > 0 ? FSCK_UNREPAIRED : FSCK_REPAIRED;
+	}
+	// a dirty volume stays dirty, fsck can't tell a crashed one from one
+	// a shell has mounted, the next mount checks the freespace again
+	if (repair && !wasClean)
+	{
+		printf("the volume is left marked as not closed cleanly\n");
+	}
+
+	if (retVal == FSCK_OK)
+	{
+		printf("volume is clean\n");
+	}
+	else if (retVal == FSCK_REPAIRED)
+	{
+		printf("%s repaired\n", differences == 0 ? "usage" : usageCleared == 0 ? "freespace" : "freespace and usage");
+	}
+	else
+	{
+		printf("%ld problems in the tree%s\n", problemCount,
+			   repair ? ", only the freespace and the usage are repaired"
+					  : ", run with -r to repair the freespace and the usage");
+	}
+
+	free(expected);
+	expected = NULL;
+	free(inodeSeen);
+	inodeSeen = NULL;
+	closeFreespace(freespace);
+	freespace = NULL;
+	freeRefTable();
+	freeInodeTable();
+	free(ourVCB);
+	ourVCB = NULL;
+	closeVolume(checkedVolume);
+	return retVal;
+}
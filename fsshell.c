@@ -30,6 +30,9 @@ Siqi Guo, 918209895, Guo-1999
 #include "fsLow.h"
 #include "mfs.h"
 #include "b_io.h"
+#include "compress.h"
+#include "defrag.h"
+#include "journal.h"
 
 /***************  START LINUX TESTING CODE FOR SHELL ***************/
 #define TEMP_LINUX 0 //MUST be ZERO for working with your file system
@@ -106,6 +109,7 @@ int fs_isDir(char *path)
 #define DOUBLE_QUOTE 0x22
 #define BUFFERLEN 200
 #define DIRMAX_LEN 4096
+#define LS_BATCH_SIZE 16 // entries read by each fs_readdir_plus() of ls
 
 /****   SET THESE TO 1 WHEN READY TO TEST THAT COMMAND ****/
 #define CMDLS_ON 1
@@ -136,17 +140,39 @@ int cmd_cd(int argcnt, char *argvec[]);
 int cmd_pwd(int argcnt, char *argvec[]);
 int cmd_history(int argcnt, char *argvec[]);
 int cmd_help(int argcnt, char *argvec[]);
+int cmd_compress(int argcnt, char *argvec[]);
+int cmd_zbench(int argcnt, char *argvec[]);
+int cmd_dedup(int argcnt, char *argvec[]);
+int cmd_sync(int argcnt, char *argvec[]);
+int cmd_df(int argcnt, char *argvec[]);
+int cmd_du(int argcnt, char *argvec[]);
+int cmd_defrag(int argcnt, char *argvec[]);
+int cmd_mountbench(int argcnt, char *argvec[]);
+int cmd_openbench(int argcnt, char *argvec[]);
+int cmd_placement(int argcnt, char *argvec[]);
+int cmd_treebench(int argcnt, char *argvec[]);
 
 dispatch_t dispatchTable[] = {
 	{"ls", cmd_ls, "Lists the file in a directory"},
-	{"cp", cmd_cp, "Copies a file - source dest"},
-	{"mv", cmd_mv, "Moves a file - source dest"},
+	{"cp", cmd_cp, "Copies a file by sharing its blocks - [-d] source dest"},
+	{"mv", cmd_mv, "Moves a file or directory - source dest"},
 	{"md", cmd_md, "Make a new directory"},
 	{"rm", cmd_rm, "Removes a file or directory"},
 	{"cp2l", cmd_cp2l, "Copies a file from the test file system to the linux file system"},
 	{"cp2fs", cmd_cp2fs, "Copies a file from the Linux file system to the test file system"},
 	{"cd", cmd_cd, "Changes directory"},
 	{"pwd", cmd_pwd, "Prints the working directory"},
+	{"compress", cmd_compress, "Turns compression of written files on or off - [on|off]"},
+	{"zbench", cmd_zbench, "Benchmarks compression - [Linuxfile] [rounds]"},
+	{"dedup", cmd_dedup, "Turns sharing of identical files on or off - [on|off]"},
+	{"placement", cmd_placement, "Turns placing files near their directory on or off - [on|off]"},
+	{"sync", cmd_sync, "Commits the batched metadata changes into the journal"},
+	{"df", cmd_df, "Prints the size and the free space of the volume"},
+	{"du", cmd_du, "Prints the space taken by a directory and everything in it - [path]"},
+	{"defrag", cmd_defrag, "Moves files to merge the free space, prints how it is split - [run|start|stop]"},
+	{"mountbench", cmd_mountbench, "Benchmarks loading the freespace at mount - [rounds]"},
+	{"openbench", cmd_openbench, "Benchmarks allocations of opening a file - path [rounds]"},
+	{"treebench", cmd_treebench, "Benchmarks walking and reading an aged tree with each placement - [topdirs]"},
 	{"history", cmd_history, "Prints out the history"},
 	{"help", cmd_help, "Prints out help"}};
 
@@ -159,26 +185,28 @@ int displayFiles(fdDir *dirp, int flall, int fllong)
 	if (dirp == NULL) //get out if error
 		return (-1);
 
-	struct fs_diriteminfo *di;
-	struct fs_stat statbuf;
+	// each call fills a batch of entries with their status from one pass
+	struct fs_direntplus entries[LS_BATCH_SIZE];
+	int count;
 
-	di = fs_readdir(dirp);
 	printf("\n");
-	while (di != NULL)
+	while ((count = fs_readdir_plus(dirp, entries, LS_BATCH_SIZE)) > 0)
 	{
-		if ((di->d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
+		for (int i = 0; i < count; i++)
 		{
-			if (fllong)
+			struct fs_direntplus *di = entries + i;
+			if ((di->d_name[0] != '.') || (flall)) //if not all and starts with '.' it is hidden
 			{
-				fs_stat(di->d_name, &statbuf);
-				printf("%s    %9ld   %s\n", fs_isDir(di->d_name) ? "D" : "-", statbuf.st_size, di->d_name);
-			}
-			else
-			{
-				printf("%s\n", di->d_name);
+				if (fllong)
+				{
+					printf("%s    %9ld   %s\n", di->fileType == TYPE_DIR ? "D" : "-", di->st.st_size, di->d_name);
+				}
+				else
+				{
+					printf("%s\n", di->d_name);
+				}
 			}
 		}
-		di = fs_readdir(dirp);
 	}
 	fs_closedir(dirp);
 #endif
@@ -260,7 +288,8 @@ int cmd_ls(int argcnt, char *argvec[])
 		//processing arguments after options
 		for (int k = optind; k < argcnt; k++)
 		{
-			if (fs_isDir(argvec[k]))
+			fsEntry *handle = fs_lookup(argvec[k]);
+			if (handle != NULL && fs_isDirEntry(handle))
 			{
 				fdDir *dirp;
 				dirp = fs_opendir(argvec[k]);
@@ -268,7 +297,7 @@ int cmd_ls(int argcnt, char *argvec[])
 			}
 			else // it is just a file ?
 			{
-				if (fs_isFile(argvec[k]))
+				if (handle != NULL && fs_isFileEntry(handle))
 				{
 					//no support for long format here
 					printf("%s\n", argvec[k]);
@@ -278,6 +307,7 @@ int cmd_ls(int argcnt, char *argvec[])
 					printf("%s is not found\n", argvec[k]);
 				}
 			}
+			fs_releaseentry(handle);
 		}
 	}
 	else // no pathname/filename specified - use cwd
@@ -306,6 +336,7 @@ int cmd_cp(int argcnt, char *argvec[])
 	char *dest;
 	int readcnt;
 	char buf[BUFFERLEN];
+	int deepCopy = 0;
 
 	switch (argcnt)
 	{
@@ -314,13 +345,40 @@ int cmd_cp(int argcnt, char *argvec[])
 		dest = argvec[2];
 		break;
 
+	case 4: // -d copies every byte instead of sharing the blocks
+		if (strcmp(argvec[1], "-d") == 0)
+		{
+			deepCopy = 1;
+			src = argvec[2];
+			dest = argvec[3];
+			break;
+		}
+
 	default:
-		printf("Usage: cp srcfile [destfile]\n");
+		printf("Usage: cp [-d] srcfile destfile\n");
 		return (-1);
 	}
 
+	// the destination shares the blocks of the source by default, the bytes
+	// are copied over an existing file or when the blocks can't be shared
+	if (!deepCopy && !fs_isFile(dest) && fs_clone(src, dest) == 0)
+	{
+		return 0;
+	}
+
 	testfs_src_fd = b_open(src, O_RDONLY);
+	if (testfs_src_fd < 0)
+	{
+		printf("%s can't be opened\n", src);
+		return (-1);
+	}
 	testfs_dest_fd = b_open(dest, O_WRONLY | O_CREAT | O_TRUNC);
+	if (testfs_dest_fd < 0)
+	{
+		printf("%s can't be opened\n", dest);
+		b_close(testfs_src_fd);
+		return (-1);
+	}
 
 	do
 	{
@@ -339,10 +397,6 @@ int cmd_cp(int argcnt, char *argvec[])
 int cmd_mv(int argcnt, char *argvec[])
 {
 #if (CMDMV_ON == 1)
-
-	char buf[BUFFERLEN];
-	int readCount, writeCount;
-	int test_fdsrc, test_fddest;
 	char *src, *dest;
 
 	switch (argcnt)
@@ -353,41 +407,12 @@ int cmd_mv(int argcnt, char *argvec[])
 		break;
 
 	default:
-		printf("Usage: mv srcfile destfile\n");
+		printf("Usage: mv source dest\n");
 		return (-1);
 	}
 
-	if (!fs_isFile(src))
-	{
-		printf("%s is not a file.\n", src);
-		return -1;
-	}
-
-	// create file in dest
-	test_fdsrc = b_open(src, O_RDONLY);
-	test_fddest = b_open(dest, O_WRONLY | O_CREAT | O_TRUNC);
-
-	//read from src, write to dest
-	do
-	{
-		readCount = b_read(test_fdsrc, buf, BUFFERLEN);
-		writeCount = b_write(test_fddest, buf, readCount);
-	} while (readCount == BUFFERLEN && writeCount >= 0);
-
-	//close the files
-	b_close(test_fdsrc);
-	b_close(test_fddest);
-
-	// only delete the source if we do move the file
-	if (readCount >= 0 && writeCount >= 0)
-	{
-		fs_delete(src);
-	}
-	else
-	{
-		return -1;
-	}
-
+	// only the entry moves, the data stays where it is
+	return fs_rename(src, dest);
 #endif
 	return 0;
 }
@@ -426,15 +451,20 @@ int cmd_rm(int argcnt, char *argvec[])
 
 	char *path = argvec[1];
 
-	//must determine if file or directory
-	if (fs_isDir(path))
+	//must determine if file or directory, the path is resolved once
+	fsEntry *handle = fs_lookup(path);
+	if (handle != NULL && fs_isDirEntry(handle))
 	{
+		fs_releaseentry(handle);
 		return (fs_rmdir(path));
 	}
-	if (fs_isFile(path))
+	if (handle != NULL && fs_isFileEntry(handle))
 	{
-		return (fs_delete(path));
+		int retVal = fs_deleteEntry(handle);
+		fs_releaseentry(handle);
+		return retVal;
 	}
+	fs_releaseentry(handle);
 
 	printf("The path %s is neither a file not a directory\n", path);
 #endif
@@ -471,7 +501,16 @@ int cmd_cp2l(int argcnt, char *argvec[])
 		return (-1);
 	}
 
-	testfs_fd = b_open(src, O_RDONLY);
+	// resolve the source once, b_openEntry() reuses the directory it read
+	fsEntry *srcEntry = fs_lookup(src);
+	if (srcEntry == NULL || !fs_isFileEntry(srcEntry))
+	{
+		printf("%s is not a file\n", src);
+		fs_releaseentry(srcEntry);
+		return -1;
+	}
+	testfs_fd = b_openEntry(srcEntry, O_RDONLY);
+	fs_releaseentry(srcEntry);
 
 	// NOTE: must add 0777 for permission to read the output data
 	// but this is for user to decide, so can be changed if needed
@@ -612,6 +651,356 @@ int cmd_pwd(int argcnt, char *argvec[])
 	return 0;
 }
 
+/****************************************************
+*  Compress commmand
+****************************************************/
+int cmd_compress(int argcnt, char *argvec[])
+{
+	if (argcnt == 2 && strcmp(argvec[1], "on") == 0)
+	{
+		fs_setfeature(FEATURE_COMPRESSION, 1);
+	}
+	else if (argcnt == 2 && strcmp(argvec[1], "off") == 0)
+	{
+		fs_setfeature(FEATURE_COMPRESSION, 0);
+	}
+	else if (argcnt != 1)
+	{
+		printf("Usage: compress [on|off]\n");
+		return -1;
+	}
+
+	printf("compression is %s\n", (ourVCB->featureFlags & FEATURE_COMPRESSION) ? "on" : "off");
+	return 0;
+}
+
+/****************************************************
+*  Dedup commmand
+****************************************************/
+int cmd_dedup(int argcnt, char *argvec[])
+{
+	if (argcnt == 2 && strcmp(argvec[1], "on") == 0)
+	{
+		fs_setfeature(FEATURE_DEDUP, 1);
+	}
+	else if (argcnt == 2 && strcmp(argvec[1], "off") == 0)
+	{
+		fs_setfeature(FEATURE_DEDUP, 0);
+	}
+	else if (argcnt != 1)
+	{
+		printf("Usage: dedup [on|off]\n");
+		return -1;
+	}
+
+	printf("dedup is %s\n", (ourVCB->featureFlags & FEATURE_DEDUP) ? "on" : "off");
+	return 0;
+}
+
+/****************************************************
+*  Placement commmand
+****************************************************/
+int cmd_placement(int argcnt, char *argvec[])
+{
+	if (argcnt == 2 && strcmp(argvec[1], "on") == 0)
+	{
+		fs_setfeature(FEATURE_LOCALITY, 1);
+	}
+	else if (argcnt == 2 && strcmp(argvec[1], "off") == 0)
+	{
+		fs_setfeature(FEATURE_LOCALITY, 0);
+	}
+	else if (argcnt != 1)
+	{
+		printf("Usage: placement [on|off]\n");
+		return -1;
+	}
+
+	printf("placement near the parent is %s\n", (ourVCB->featureFlags & FEATURE_LOCALITY) ? "on" : "off");
+	return 0;
+}
+
+/****************************************************
+*  Sync commmand
+****************************************************/
+int cmd_sync(int argcnt, char *argvec[])
+{
+	if (argcnt != 1)
+	{
+		printf("Usage: sync\n");
+		return -1;
+	}
+	return fs_sync();
+}
+
+/****************************************************
+*  DF commmand
+****************************************************/
+int cmd_df(int argcnt, char *argvec[])
+{
+	if (argcnt != 1)
+	{
+		printf("Usage: df\n");
+		return -1;
+	}
+
+	struct fs_statvfs st;
+	if (fs_statvfs(&st) != 0)
+	{
+		printf("df failed\n");
+		return -1;
+	}
+
+	uint64_t used = st.f_blocks - st.f_bfree;
+	printf("%12s %12s %12s %12s %5s\n", "Block size", "Blocks", "Used", "Available", "Use%");
+	printf("%12ld %12ld %12ld %12ld %4.0f%%\n", (long)st.f_bsize, (long)st.f_blocks, (long)used,
+		   (long)st.f_bavail, st.f_blocks > 0 ? 100.0 * used / st.f_blocks : 0.0);
+	return 0;
+}
+
+/****************************************************
+*  DU commmand
+****************************************************/
+int cmd_du(int argcnt, char *argvec[])
+{
+	if (argcnt > 2)
+	{
+		printf("Usage: du [path]\n");
+		return -1;
+	}
+
+	char *path = argcnt == 2 ? argvec[1] : ".";
+	struct fs_dirusage usage;
+	if (fs_dirusage(path, &usage) != 0)
+	{
+		printf("%s is not a directory\n", path);
+		return -1;
+	}
+	printf("%12ld bytes %10ld blocks  %s\n", (long)usage.du_bytes, (long)usage.du_blocks, path);
+	return 0;
+}
+
+/****************************************************
+*  Compression benchmark commmand
+****************************************************/
+double elapsedSeconds(struct timespec *begin)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - begin->tv_sec) + (end.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+int cmd_zbench(int argcnt, char *argvec[])
+{
+	int rounds = 20;
+	int size = 4 * 1024 * 1024;
+	char *data;
+
+	if (argcnt > 3)
+	{
+		printf("Usage: zbench [Linuxfile] [rounds]\n");
+		return -1;
+	}
+	if (argcnt == 3)
+	{
+		rounds = atoi(argvec[2]);
+	}
+	if (rounds < 1)
+	{
+		printf("rounds must be positive\n");
+		return -1;
+	}
+
+	if (argcnt >= 2)
+	{ // benchmark the given linux file
+		int linux_fd = open(argvec[1], O_RDONLY);
+		if (linux_fd < 0)
+		{
+			printf("%s is not a valid source\n", argvec[1]);
+			return -1;
+		}
+		size = lseek(linux_fd, 0, SEEK_END);
+		lseek(linux_fd, 0, SEEK_SET);
+		data = malloc(size + 1);
+		if (data == NULL || size <= 0 || read(linux_fd, data, size) != size)
+		{
+			printf("failed to read %s\n", argvec[1]);
+			free(data);
+			close(linux_fd);
+			return -1;
+		}
+		close(linux_fd);
+	}
+	else
+	{ // otherwise make some log like text
+		data = malloc(size);
+		if (data == NULL)
+		{
+			return -1;
+		}
+		int used = 0;
+		for (int line = 0; used < size; line++)
+		{
+			char text[128];
+			int length = snprintf(text, sizeof(text), "%08d INFO request %d served in %d ms from node-%d\n",
+								  line, line * 7919 % 100003, line % 97, line % 5);
+			if (length > size - used)
+			{
+				length = size - used;
+			}
+			memcpy(data + used, text, length);
+			used += length;
+		}
+	}
+
+	int chunkCount = (size + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+	char *compressed = malloc((size_t)chunkCount * COMPRESS_CHUNK_SIZE);
+	int *lengths = malloc(chunkCount * sizeof(int));
+	char *restored = malloc(COMPRESS_CHUNK_SIZE);
+	if (compressed == NULL || lengths == NULL || restored == NULL)
+	{
+		free(data);
+		free(compressed);
+		free(lengths);
+		free(restored);
+		return -1;
+	}
+
+	// compress every chunk the same way compressExtent() does
+	struct timespec begin;
+	uint64_t storedBytes = 0;
+	int rawChunks = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int r = 0; r < rounds; r++)
+	{
+		storedBytes = 0;
+		rawChunks = 0;
+		for (int i = 0; i < chunkCount; i++)
+		{
+			int length = size - i * COMPRESS_CHUNK_SIZE;
+			if (length > COMPRESS_CHUNK_SIZE)
+			{
+				length = COMPRESS_CHUNK_SIZE;
+			}
+			lengths[i] = lzCompress(data + i * COMPRESS_CHUNK_SIZE, length,
+									compressed + i * COMPRESS_CHUNK_SIZE, length - length / 16);
+			if (lengths[i] == 0)
+			{
+				rawChunks++;
+				storedBytes += length;
+			}
+			storedBytes += lengths[i];
+		}
+	}
+	double compressTime = elapsedSeconds(&begin);
+
+	// decompress every chunk and check it matches
+	int mismatch = 0;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int r = 0; r < rounds; r++)
+	{
+		for (int i = 0; i < chunkCount; i++)
+		{
+			int length = size - i * COMPRESS_CHUNK_SIZE;
+			if (length > COMPRESS_CHUNK_SIZE)
+			{
+				length = COMPRESS_CHUNK_SIZE;
+			}
+			if (lengths[i] == 0)
+			{
+				continue;
+			}
+			if (lzDecompress(compressed + i * COMPRESS_CHUNK_SIZE, lengths[i], restored, COMPRESS_CHUNK_SIZE) != length ||
+				memcmp(restored, data + i * COMPRESS_CHUNK_SIZE, length) != 0)
+			{
+				mismatch++;
+			}
+		}
+	}
+	double decompressTime = elapsedSeconds(&begin);
+
+	double megabytes = (double)size * rounds / (1024 * 1024);
+	printf("input: %d bytes in %d chunks, %d rounds\n", size, chunkCount, rounds);
+	printf("ratio: %.2f (%ld stored bytes, %d raw chunks)\n", (double)size / storedBytes, storedBytes, rawChunks);
+	printf("compress: %.1f MB/s\n", megabytes / compressTime);
+	printf("decompress: %.1f MB/s\n", megabytes / decompressTime);
+	if (mismatch > 0)
+	{
+		printf("%d chunks did not decompress back!\n", mismatch);
+	}
+
+	free(data);
+	free(compressed);
+	free(lengths);
+	free(restored);
+	return mismatch == 0 ? 0 : -1;
+}
+
+/****************************************************
+*  Defrag commmand
+****************************************************/
+void printDefragReport(const char *when)
+{
+	defragReport report;
+	getDefragReport(&report);
+	printf("%-8s %10ld free blocks in %6ld runs, largest run %10ld blocks, %5.1f%% fragmented\n", when,
+		   (long)report.freeBlocks, (long)report.freeRuns, (long)report.largestFreeRun,
+		   report.freeBlocks > 0 ? 100.0 * (report.freeBlocks - report.largestFreeRun) / report.freeBlocks : 0.0);
+	printf("%-8s %10ld extents moved, %10ld blocks moved, %s\n", "", (long)report.movedExtents,
+		   (long)report.movedBlocks, report.running ? "running in the background" : "not running");
+}
+
+int cmd_defrag(int argcnt, char *argvec[])
+{
+	if (argcnt > 2)
+	{
+		printf("Usage: defrag [run|start|stop]\n");
+		return -1;
+	}
+
+	if (argcnt == 1)
+	{
+		printDefragReport("now");
+		return 0;
+	}
+
+	if (strcmp(argvec[1], "run") == 0)
+	{
+		printDefragReport("before");
+		struct timespec begin;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		int moved = runDefrag();
+		if (moved < 0)
+		{
+			printf("defrag failed\n");
+			return -1;
+		}
+		double seconds = elapsedSeconds(&begin);
+		printDefragReport("after");
+		printf("moved %d extents in %.3f s\n", moved, seconds);
+	}
+	else if (strcmp(argvec[1], "start") == 0)
+	{
+		printDefragReport("before");
+		if (startDefrag() != 0)
+		{
+			printf("defrag failed\n");
+			return -1;
+		}
+	}
+	else if (strcmp(argvec[1], "stop") == 0)
+	{
+		stopDefrag();
+		printDefragReport("after");
+	}
+	else
+	{
+		printf("Usage: defrag [run|start|stop]\n");
+		return -1;
+	}
+	return 0;
+}
+
 /****************************************************
 *  History commmand
 ****************************************************/
@@ -751,6 +1140,417 @@ void processcommand(char *cmd)
 	cmdv = NULL;
 }
 
+/****************************************************
+*  Mount benchmark commmand
+****************************************************/
+int cmd_mountbench(int argcnt, char *argvec[])
+{
+	int rounds = 100;
+
+	if (argcnt > 2)
+	{
+		printf("Usage: mountbench [rounds]\n");
+		return -1;
+	}
+	if (argcnt == 2)
+	{
+		rounds = atoi(argvec[1]);
+	}
+	if (rounds < 1)
+	{
+		printf("rounds must be positive\n");
+		return -1;
+	}
+
+	// the bitmap is read whole and copied, like mounts did before paging
+	uint64_t bitmapBytes = ourVCB->freespaceBlockCount * ourVCB->blockSize;
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int i = 0; i < rounds; i++)
+	{
+		char *readBuffer = malloc(bitmapBytes);
+		char *bitmap = malloc(ourVCB->numberOfBlocks);
+		if (readBuffer == NULL || bitmap == NULL)
+		{
+			printf("malloc() failed\n");
+			free(readBuffer);
+			free(bitmap);
+			return -1;
+		}
+		deviceRead(readBuffer, ourVCB->freespaceBlockCount, ourVCB->vcbBlockCount);
+		memcpy(bitmap, readBuffer, bitmapBytes < ourVCB->numberOfBlocks ? bitmapBytes : ourVCB->numberOfBlocks);
+		free(readBuffer);
+		free(bitmap);
+	}
+	double eagerTime = elapsedSeconds(&begin);
+	uint64_t eagerBytes = bitmapBytes + ourVCB->numberOfBlocks;
+
+	// the paged map, up to the first free block the allocator would find,
+	// the operation lock keeps the defragmenter and other sessions off the
+	// freespace while it is swapped
+	uint64_t lazyBytes = 0;
+	journalBegin();
+	freespaceMap *mounted = freespace;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int i = 0; i < rounds; i++)
+	{
+		freespace = openFreespace();
+		if (freespace == NULL)
+		{
+			freespace = mounted;
+			journalEnd();
+			return -1;
+		}
+		findFreeBlock(ourVCB->firstFreeBlockIndex);
+
+		lazyBytes = sizeof(freespaceMap) + freespace->loadedPages * ourVCB->blockSize +
+					freespace->pageCount * (sizeof(int *) + 1) +
+					freespace->summaryBlockCount * (sizeof(uint32_t *) + 1);
+		for (uint64_t j = 0; j < freespace->summaryBlockCount; j++)
+		{
+			lazyBytes += freespace->summary[j] != NULL ? ourVCB->blockSize : 0;
+		}
+		closeFreespace(freespace);
+	}
+	freespace = mounted;
+	double lazyTime = elapsedSeconds(&begin);
+	journalEnd();
+
+	printf("%ld blocks, %ld bitmap pages, %d rounds\n",
+		   ourVCB->numberOfBlocks, (long)ourVCB->freespaceBlockCount, rounds);
+	printf("eager: %10.3f us per mount, %10ld bytes\n", eagerTime * 1e6 / rounds, eagerBytes);
+	printf("paged: %10.3f us per mount, %10ld bytes\n", lazyTime * 1e6 / rounds, lazyBytes);
+	printf("eager is a synthetic baseline, one read of the whole bitmap and a memcpy(), not the old mount\n");
+	return 0;
+}
+
+/****************************************************
+*  Open benchmark commmand
+****************************************************/
+// the file system counts its own allocations, see fsMalloc()
+int cmd_openbench(int argcnt, char *argvec[])
+{
+	int rounds = 10000;
+
+	if (argcnt < 2 || argcnt > 3)
+	{
+		printf("Usage: openbench path [rounds]\n");
+		return -1;
+	}
+	if (argcnt == 3)
+	{
+		rounds = atoi(argvec[2]);
+	}
+	if (rounds < 1)
+	{
+		printf("rounds must be positive\n");
+		return -1;
+	}
+
+	// one open first, so anything kept for reuse is already there
+	int fd = b_open(argvec[1], O_RDONLY);
+	if (fd < 0)
+	{
+		printf("%s can't be opened\n", argvec[1]);
+		return -1;
+	}
+	b_close(fd);
+
+	unsigned long openAllocations = 0;
+	unsigned long closeAllocations = 0;
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int i = 0; i < rounds; i++)
+	{
+		unsigned long before = fsAllocationCount;
+		fd = b_open(argvec[1], O_RDONLY);
+		openAllocations += fsAllocationCount - before;
+		if (fd < 0)
+		{
+			printf("%s can't be opened\n", argvec[1]);
+			return -1;
+		}
+
+		before = fsAllocationCount;
+		b_close(fd);
+		closeAllocations += fsAllocationCount - before;
+	}
+	double openTime = elapsedSeconds(&begin);
+
+	printf("%d rounds of b_open() and b_close() on %s\n", rounds, argvec[1]);
+	printf("%10.3f us per round\n", openTime * 1e6 / rounds);
+	printf("%10.3f allocations per b_open()\n", (double)openAllocations / rounds);
+	printf("%10.3f allocations per b_close()\n", (double)closeAllocations / rounds);
+	return 0;
+}
+
+/****************************************************
+*  Tree benchmark commmand
+****************************************************/
+#define TREEBENCH_SUBDIRS 2	   // directories in each top level directory
+#define TREEBENCH_TOP_FILES 4  // files in each top level directory
+#define TREEBENCH_SUB_FILES 6  // files in each of its directories
+#define TREEBENCH_AGE_PASSES 3 // passes removing and writing a third of the files again
+
+typedef struct
+{
+	uint64_t lastEnd;	 // block after the extent visited last
+	uint64_t seekBlocks; // distance between the extents, in blocks
+	uint64_t longSeeks;	 // jumps longer than a bitmap group
+	uint64_t extents;
+	uint64_t bytes;
+	int treeStart; // the next extent starts another top level directory
+} treeWalk;
+
+static unsigned int treebenchSeed;
+
+// a file of 1 to 24 blocks, the same sizes for each placement
+static int treebenchSize()
+{
+	treebenchSeed = treebenchSeed * 1103515245 + 12345;
+	return ((treebenchSeed >> 16) % 24 + 1) * ourVCB->blockSize - (treebenchSeed >> 8) % 64;
+}
+
+static int treebenchWrite(const char *path)
+{
+	// sized by the volume, the blocks can be larger than 4096 bytes
+	int size = treebenchSize();
+	char *data = malloc(size);
+	if (data == NULL)
+	{
+		printf("malloc() on data failed\n");
+		return -1;
+	}
+	int fd = b_open((char *)path, O_WRONLY | O_CREAT | O_TRUNC);
+	if (fd < 0)
+	{
+		free(data);
+		return -1;
+	}
+	memset(data, path[strlen(path) - 1], size);
+	b_write(fd, data, size);
+	b_close(fd);
+	free(data);
+	return 0;
+}
+
+// path of file f of a directory, d == 0 is the top level directory itself
+static void treebenchPath(char *path, int top, int d, int f)
+{
+	if (d == 0)
+	{
+		sprintf(path, "/tbench%d/f%d", top, f);
+	}
+	else
+	{
+		sprintf(path, "/tbench%d/s%d/f%d", top, d - 1, f);
+	}
+}
+
+// note the extent of a path in the order the walk reaches it
+static void treebenchVisit(treeWalk *walk, const char *path)
+{
+	fsEntry *handle = fs_lookup(path);
+	if (handle == NULL)
+	{
+		return;
+	}
+	uint64_t start = handle->entry->entryStartLocation;
+	uint64_t length = fs_isDirEntry(handle) ? getBlockCount(DIR_EXTENT_SIZE) : getExtentBlockCount(handle->entry);
+	uint64_t distance = start > walk->lastEnd ? start - walk->lastEnd : walk->lastEnd - start;
+	if (!walk->treeStart)
+	{
+		walk->seekBlocks += distance;
+		walk->longSeeks += distance > freespace->blocksPerPage;
+	}
+	walk->lastEnd = start + length;
+	walk->extents++;
+	walk->treeStart = 0;
+	fs_releaseentry(handle);
+}
+
+// list a directory, read each file, then go down into each directory
+static void treebenchWalk(treeWalk *walk, const char *path)
+{
+	treebenchVisit(walk, path);
+	fdDir *dirp = fs_opendir(path);
+	if (dirp == NULL)
+	{
+		return;
+	}
+
+	char child[DIRMAX_LEN];
+	char subdirs[MAX_AMOUNT_OF_ENTRIES][MAX_NAME_LENGTH];
+	int subdirCount = 0;
+	struct fs_direntplus entries[LS_BATCH_SIZE];
+	int count;
+	while ((count = fs_readdir_plus(dirp, entries, LS_BATCH_SIZE)) > 0)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (strcmp(entries[i].d_name, ".") == 0 || strcmp(entries[i].d_name, "..") == 0)
+			{
+				continue;
+			}
+			if (entries[i].fileType == TYPE_DIR)
+			{
+				strcpy(subdirs[subdirCount++], entries[i].d_name);
+				continue;
+			}
+
+			snprintf(child, sizeof(child), "%s/%s", path, entries[i].d_name);
+			treebenchVisit(walk, child);
+			int fd = b_open(child, O_RDONLY);
+			if (fd < 0)
+			{
+				printf("%s can't be opened\n", child);
+				continue;
+			}
+			char buf[BUFFERLEN];
+			int readcnt;
+			while ((readcnt = b_read(fd, buf, BUFFERLEN)) > 0)
+			{
+				walk->bytes += readcnt;
+			}
+			b_close(fd);
+		}
+	}
+	fs_closedir(dirp);
+
+	for (int i = 0; i < subdirCount; i++)
+	{
+		snprintf(child, sizeof(child), "%s/%s", path, subdirs[i]);
+		treebenchWalk(walk, child);
+	}
+}
+
+// build the tree, writing one file of every directory in turn
+// so the allocations of the directories are mixed, then age it
+static int treebenchBuild(int topCount)
+{
+	char path[DIRMAX_LEN];
+	for (int t = 0; t < topCount; t++)
+	{
+		sprintf(path, "/tbench%d", t);
+		if (fs_mkdir(path, 0777) != 0)
+		{
+			return -1;
+		}
+		for (int d = 0; d < TREEBENCH_SUBDIRS; d++)
+		{
+			sprintf(path, "/tbench%d/s%d", t, d);
+			if (fs_mkdir(path, 0777) != 0)
+			{
+				return -1;
+			}
+		}
+	}
+
+	for (int pass = 0; pass <= TREEBENCH_AGE_PASSES; pass++)
+	{
+		for (int f = 0; f < TREEBENCH_SUB_FILES; f++)
+		{
+			for (int t = 0; t < topCount; t++)
+			{
+				for (int d = 0; d <= TREEBENCH_SUBDIRS; d++)
+				{
+					if ((d == 0 && f >= TREEBENCH_TOP_FILES) || (pass > 0 && (f + t + d + pass) % 3 != 0))
+					{
+						continue;
+					}
+					treebenchPath(path, t, d, f);
+					if (pass > 0)
+					{
+						fs_delete(path);
+					}
+					if (treebenchWrite(path) != 0)
+					{
+						return -1;
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+int cmd_treebench(int argcnt, char *argvec[])
+{
+	int topCount = 3;
+
+	if (argcnt > 2)
+	{
+		printf("Usage: treebench [topdirs]\n");
+		return -1;
+	}
+	if (argcnt == 2)
+	{
+		topCount = atoi(argvec[1]);
+	}
+	if (topCount < 1 || topCount > MAX_AMOUNT_OF_ENTRIES - 2)
+	{
+		printf("topdirs must be between 1 and %d\n", MAX_AMOUNT_OF_ENTRIES - 2);
+		return -1;
+	}
+
+	int wasOn = (ourVCB->featureFlags & FEATURE_LOCALITY) != 0;
+	int retVal = 0;
+	printf("%d top level directories, %d files each, %d aging passes\n", topCount,
+		   TREEBENCH_TOP_FILES + TREEBENCH_SUBDIRS * TREEBENCH_SUB_FILES, TREEBENCH_AGE_PASSES);
+	printf("%-10s %10s %12s %10s %12s\n", "placement", "extents", "seek blocks", "long seeks", "walk+read");
+
+	for (int policy = 0; policy < 2; policy++)
+	{
+		fs_setfeature(FEATURE_LOCALITY, policy);
+		treebenchSeed = 415;
+		if (treebenchBuild(topCount) != 0)
+		{
+			printf("failed to build the tree, the root needs %d free entries\n", topCount);
+			retVal = -1;
+		}
+
+		// a checkpoint writes the metadata home and empties the journal
+		// cache, so the walk reads the directories from the volume
+		if (journalCheckpoint() != 0)
+		{
+			printf("checkpoint before the walk failed\n");
+			retVal = -1;
+		}
+		treeWalk walk;
+		memset(&walk, 0, sizeof(walk));
+		struct timespec begin;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		for (int t = 0; retVal == 0 && t < topCount; t++)
+		{
+			// the jump to a top level directory is not counted, the
+			// spread placement puts them far from each other on purpose
+			char path[DIRMAX_LEN];
+			sprintf(path, "/tbench%d", t);
+			walk.treeStart = 1;
+			treebenchWalk(&walk, path);
+		}
+		double walkTime = elapsedSeconds(&begin);
+		if (retVal == 0)
+		{
+			printf("%-10s %10ld %12ld %10ld %9.3f ms\n", policy ? "near" : "first fit",
+				   walk.extents, walk.seekBlocks, walk.longSeeks, walkTime * 1e3);
+		}
+
+		for (int t = 0; t < topCount; t++)
+		{
+			char path[DIRMAX_LEN];
+			sprintf(path, "/tbench%d", t);
+			if (fs_isDir(path))
+			{
+				fs_rmdir(path);
+			}
+		}
+	}
+
+	fs_setfeature(FEATURE_LOCALITY, wasOn);
+	return retVal;
+}
+
 int main(int argc, char *argv[])
 {
 	char *cmdin;
@@ -782,7 +1582,10 @@ int main(int argc, char *argv[])
 		return (retVal);
 	}
 
+	struct timespec begin;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 	retVal = initFileSystem(volumeSize / blockSize, blockSize);
+	printf("Mounted in %.3f ms\n", elapsedSeconds(&begin) * 1e3);
 
 	if (retVal != 0)
 	{
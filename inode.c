@@ -0,0 +1,364 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: inode.c
+*
+* Description: keeps the inode table on the volume, the entry
+* of a file only points to its inode, so the size and the times
+* of a file are read and written without its directory. the table
+* grows by a segment of INODE_TABLE_BLOCK_COUNT blocks when every
+* inode is taken, the segments are listed in the vcb
+*
+**************************************************************/
+
+#include "mfs.h"
+#include "inode.h"
+#include "journal.h"
+
+/**
+ * @brief amount of inodes in one segment of the table
+ */
+static uint inodesPerSegment()
+{
+	return INODE_TABLE_BLOCK_COUNT * ourVCB->blockSize / sizeof(inode);
+}
+
+/**
+ * @brief where a segment of the table is on the volume, the first one is
+ * the table of volumes made before it could grow
+ *
+ * @param segment index of the segment
+ * @return LBA of the segment, 0 if it is not added yet
+ */
+uint64_t getInodeSegmentLocation(uint segment)
+{
+	if (segment == 0)
+	{
+		return ourVCB->inodeTableLocation;
+	}
+	if (segment >= INODE_TABLE_MAX_SEGMENTS)
+	{
+		return 0;
+	}
+	return ourVCB->inodeSegmentLocation[segment - 1];
+}
+
+/**
+ * @brief read the table from the volume if the volume has one,
+ * the whole table is kept in memory once it is loaded
+ *
+ * @return 0 for success, -1 if there is no table
+ */
+int loadInodeTable()
+{
+	if (currentVolume->inodeSegmentCount > 0)
+	{
+		return 0;
+	}
+	if (ourVCB->inodeTableLocation == 0)
+	{
+		return -1;
+	}
+
+	uint64_t segmentBytes = INODE_TABLE_BLOCK_COUNT * ourVCB->blockSize;
+	uint count = 0;
+	for (uint64_t start; (start = getInodeSegmentLocation(count)) != 0; count++)
+	{
+		currentVolume->inodeSegments[count] = fsMalloc(segmentBytes);
+		if (currentVolume->inodeSegments[count] == NULL)
+		{
+			eprintf("malloc() on inodeSegments");
+			freeInodeTable();
+			return -1;
+		}
+		journalLBAread(currentVolume->inodeSegments[count], INODE_TABLE_BLOCK_COUNT, start);
+		currentVolume->inodeSegmentCount = count + 1;
+	}
+	currentVolume->inodeTableCapacity = count * inodesPerSegment();
+	return 0;
+}
+
+/**
+ * @brief free the table in memory, it is read again when needed
+ */
+void freeInodeTable()
+{
+	for (uint i = 0; i < currentVolume->inodeSegmentCount; i++)
+	{
+		free(currentVolume->inodeSegments[i]);
+		currentVolume->inodeSegments[i] = NULL;
+		currentVolume->inodeDirtyBlocks[i] = 0;
+	}
+	currentVolume->inodeSegmentCount = 0;
+	currentVolume->inodeTableCapacity = 0;
+}
+
+/**
+ * @brief add an empty segment at the end of the table, the first one
+ * creates the table, the inodes already taken keep their place
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int addInodeSegment()
+{
+	uint count = currentVolume->inodeSegmentCount;
+	if (count == INODE_TABLE_MAX_SEGMENTS)
+	{
+		return -1;
+	}
+
+	uint64_t start = allocateFreespace(INODE_TABLE_BLOCK_COUNT);
+	if (start == -1)
+	{
+		eprintf("allocateFreespace() on inodeSegments");
+		return -1;
+	}
+
+	uint64_t segmentBytes = INODE_TABLE_BLOCK_COUNT * ourVCB->blockSize;
+	inode *segment = fsMalloc(segmentBytes);
+	if (segment == NULL)
+	{
+		eprintf("malloc() on inodeSegments");
+		releaseFreespace(start, INODE_TABLE_BLOCK_COUNT);
+		return -1;
+	}
+	memset(segment, 0, segmentBytes);
+
+	journalLBAwrite(segment, segmentBytes, start);
+	if (count == 0)
+	{
+		ourVCB->inodeTableLocation = start;
+	}
+	else
+	{
+		ourVCB->inodeSegmentLocation[count - 1] = start;
+	}
+	updateOurVCB();
+
+	// getInode() reads the capacity without a lock, the segment is set before it
+	currentVolume->inodeSegments[count] = segment;
+	currentVolume->inodeSegmentCount = count + 1;
+	__atomic_store_n(&currentVolume->inodeTableCapacity, (count + 1) * inodesPerSegment(), __ATOMIC_RELEASE);
+
+	dprintf("inode table segment %u added at %ld", count, start);
+	return 0;
+}
+
+/**
+ * @brief allocate an empty table on the volume the first time it is needed
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int createInodeTable()
+{
+	if (loadInodeTable() == 0)
+	{
+		return 0;
+	}
+	return addInodeSegment();
+}
+
+/**
+ * @brief find the slot of a number, used or not
+ *
+ * @param number inode number, 0 means none
+ * @return the slot, NULL if the number is outside the table
+ */
+static inode *getInodeSlot(uint32_t number)
+{
+	if (number == 0 || number > __atomic_load_n(&currentVolume->inodeTableCapacity, __ATOMIC_ACQUIRE))
+	{
+		return NULL;
+	}
+	uint perSegment = inodesPerSegment();
+	return currentVolume->inodeSegments[(number - 1) / perSegment] + (number - 1) % perSegment;
+}
+
+/**
+ * @brief find the inode of a number taken from an entry
+ *
+ * @param number inode number, 0 means none
+ * @return the inode, NULL if the number is not a used inode
+ */
+inode *getInode(uint32_t number)
+{
+	inode *node = getInodeSlot(number);
+	return node != NULL && node->used ? node : NULL;
+}
+
+/**
+ * @brief write one block of a segment with the next batch
+ *
+ * @param segment index of the segment
+ * @param block block inside the segment
+ * @return 0 for success, -1 for fail
+ */
+static int writeInodeBlock(uint segment, uint64_t block)
+{
+	return journalLBAwrite((char *)currentVolume->inodeSegments[segment] + block * ourVCB->blockSize,
+						   ourVCB->blockSize, getInodeSegmentLocation(segment) + block);
+}
+
+/**
+ * @brief write back only the block holding the inode
+ *
+ * @param number inode number
+ * @return 0 for success, -1 for fail
+ */
+int updateInode(uint32_t number)
+{
+	if (getInodeSlot(number) == NULL)
+	{
+		return -1;
+	}
+	uint perSegment = inodesPerSegment();
+	uint segment = (number - 1) / perSegment;
+	uint64_t block = (number - 1) % perSegment * sizeof(inode) / ourVCB->blockSize;
+
+	// an access time touched before this point goes out with the block
+	__atomic_fetch_and(currentVolume->inodeDirtyBlocks + segment, ~(1ULL << block), __ATOMIC_ACQ_REL);
+	return writeInodeBlock(segment, block);
+}
+
+/**
+ * @brief take a free inode for the entry of a new file,
+ * its location, size and attributes are copied from the entry
+ *
+ * @param entry entry of the file
+ * @return inode number, 0 if the table is full or fails
+ */
+uint32_t allocInode(struct fs_diriteminfo *entry)
+{
+	if (createInodeTable() != 0)
+	{
+		return 0;
+	}
+
+	for (uint i = 0;; i++)
+	{
+		// the table grows by a segment when every inode is taken
+		if (i == currentVolume->inodeTableCapacity && addInodeSegment() != 0)
+		{
+			break;
+		}
+		inode *node = getInodeSlot(i + 1);
+		if (!node->used)
+		{
+			memset(node, 0, sizeof(inode));
+			node->entryStartLocation = entry->entryStartLocation;
+			node->size = entry->size;
+			node->fileType = entry->fileType;
+			node->attributes = entry->attributes;
+			node->createTime = time(NULL);
+			node->modifyTime = node->createTime;
+			node->accessTime = node->createTime;
+			node->used = 1;
+			updateInode(i + 1);
+			return i + 1;
+		}
+	}
+
+	// not an error, the file keeps everything in its entry like before
+	dprintf("inode table is full with %d segments", INODE_TABLE_MAX_SEGMENTS);
+	return 0;
+}
+
+/**
+ * @brief free the inode of a removed entry
+ *
+ * @param number inode number, 0 is ignored
+ */
+void releaseInode(uint32_t number)
+{
+	inode *node = getInode(number);
+	if (node == NULL)
+	{
+		return;
+	}
+	node->used = 0;
+	updateInode(number);
+}
+
+/**
+ * @brief note a read of the file, the access time only changes when
+ * it is not newer than the modify time or it is a day old, and then
+ * only in memory, flushInodeTimes() writes it with the next batch
+ *
+ * @param number inode number, 0 is ignored
+ */
+void touchInodeAccess(uint32_t number)
+{
+	inode *node = getInode(number);
+	if (node == NULL)
+	{
+		return;
+	}
+
+	int64_t now = time(NULL);
+	int64_t accessTime = __atomic_load_n(&node->accessTime, __ATOMIC_RELAXED);
+	if (accessTime > node->modifyTime && now - accessTime < RELATIME_SECONDS)
+	{ // most reads stop here without touching anything
+		return;
+	}
+	__atomic_store_n(&node->accessTime, now, __ATOMIC_RELAXED);
+
+	uint perSegment = inodesPerSegment();
+	uint64_t block = (number - 1) % perSegment * sizeof(inode) / ourVCB->blockSize;
+	__atomic_fetch_or(currentVolume->inodeDirtyBlocks + (number - 1) / perSegment, 1ULL << block, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief write the blocks of the table holding access times changed
+ * by touchInodeAccess(), called by the journal before each commit
+ * so many reads cost one write of each block at most
+ */
+void flushInodeTimes()
+{
+	for (uint segment = 0; segment < currentVolume->inodeSegmentCount; segment++)
+	{
+		uint64_t dirty = __atomic_exchange_n(currentVolume->inodeDirtyBlocks + segment, 0, __ATOMIC_ACQ_REL);
+		for (uint64_t block = 0; dirty != 0; block++, dirty >>= 1)
+		{
+			if (dirty & 1)
+			{
+				writeInodeBlock(segment, block);
+			}
+		}
+	}
+}
+
+/**
+ * @brief copy what the inodes hold into the entries of a directory,
+ * the values packed in the directory can be older than the inode
+ *
+ * @param dirp the directory
+ */
+void applyInodes(fdDir *dirp)
+{
+	for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+	{
+		struct fs_diriteminfo *entry = dirp->entryList + i;
+		if (entry->space != SPACE_USED || entry->inodeNumber == 0)
+		{
+			continue;
+		}
+
+		inode *node = getInode(entry->inodeNumber);
+		if (node == NULL)
+		{
+			eprintf("%s points to inode %u which is not used", entry->d_name, entry->inodeNumber);
+			continue;
+		}
+		entry->entryStartLocation = node->entryStartLocation;
+		entry->size = node->size;
+		entry->attributes = node->attributes;
+	}
+}
@@ -0,0 +1,57 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: inode.h
+*
+* Description: Interface of the inode table, which keeps the
+*	location, size and times of each file apart from the
+*	directory entry pointing to it
+*
+**************************************************************/
+#ifndef _INODE_H
+#define _INODE_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+#ifndef uint32_t
+typedef u_int32_t uint32_t;
+#endif
+
+#define INODE_TABLE_BLOCK_COUNT 64 // blocks of each segment of the table, at most 64 for inodeDirtyBlocks
+#define RELATIME_SECONDS 86400	   // an access time older than this is updated even if the file didn't change
+
+typedef struct inode
+{
+	uint64_t entryStartLocation; // LBA of the extent
+	uint64_t size;				 // the exact size of the file
+	int64_t createTime;			 // seconds since the epoch, same as time()
+	int64_t modifyTime;
+	int64_t accessTime;
+	unsigned char fileType;		 // TYPE_FILE
+	unsigned char attributes;	 // ATTR_* bits
+	unsigned char used;			 // 0 for a free slot
+	unsigned char reserved[21];	 // keeps a slot at 64 bytes so none crosses a block or a cache line
+} inode;
+
+uint64_t getInodeSegmentLocation(uint segment);
+int loadInodeTable();
+void freeInodeTable();
+uint32_t allocInode(struct fs_diriteminfo *entry);
+inode *getInode(uint32_t number);
+int updateInode(uint32_t number);
+void releaseInode(uint32_t number);
+void touchInodeAccess(uint32_t number);
+void flushInodeTimes();
+void applyInodes(fdDir *dirp);
+
+#endif
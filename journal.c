@@ -0,0 +1,889 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: journal.c
+*
+* Description: write-ahead journal for metadata blocks
+*
+* metadata writes are kept in memory instead of going to their home
+* blocks, many operations are batched and committed with one sequential
+* write into a circular area of the volume, and the home blocks are only
+* written when the journal runs low on space or the volume is closed
+* (a checkpoint). reads of metadata see the latest images from memory.
+* a batch is committed after JOURNAL_GROUP_OPS operations, or by the
+* commit timer once it is JOURNAL_COMMIT_SECONDS old, so an idle volume
+* doesn't keep finished operations only in memory.
+*
+**************************************************************/
+
+#include <pthread.h>
+#include "mfs.h"
+#include "extent.h"
+#include "journal.h"
+#include "inode.h"
+
+// keep enough free space at the start of each operation
+#define JOURNAL_RESERVE (JOURNAL_BLOCK_COUNT / 4)
+
+// latest image of a metadata block not written to its home yet
+typedef struct
+{
+	uint64_t lba;
+	char *data;
+	int pending;	 // 1 if not committed into the journal yet
+	char *committed; // image in the journal while a newer one is pending, NULL if none
+} journalBlock;
+
+// the journal of one volume
+typedef struct journalState
+{
+	journalBlock *cache;
+	uint64_t cacheCount, cacheCapacity;
+	uint64_t pendingCount;
+
+	int journalActive;	   // 0 until the journal is on the volume
+	int depth;			   // nested journalBegin() calls
+	int batchOps;		   // finished operations in the running batch
+	time_t batchStart;	   // when the running batch got its first block
+	uint64_t journalTail;  // where the next record goes in the journal
+	uint64_t liveBlocks;   // journal blocks not checkpointed yet
+	uint64_t nextSequence; // sequence of the next record
+	int releasedInBatch;   // blocks were released by the running batch
+	int releasedCached;	   // a released block still has an image here
+
+	// one operation changes metadata at a time, it is held from journalBegin()
+	// to journalEnd() and can be taken again by nested calls on the same thread
+	pthread_mutex_t operationLock;
+
+	// readers of metadata share the cache, taken after operationLock
+	pthread_rwlock_t cacheLock;
+
+	// commits batches that got old while the volume is idle
+	pthread_t timer;
+	int timerRunning;
+	int stopTimer;
+	pthread_mutex_t timerLock; // guards stopTimer
+	pthread_cond_t timerWake;
+} journalState;
+
+/**
+ * @brief create the journal state of a volume, nothing is journaled
+ * until initJournal() is called
+ *
+ * @return the state, NULL for fail
+ */
+journalState *openJournalState()
+{
+	journalState *journal = fsMalloc(sizeof(journalState));
+	if (journal == NULL)
+	{
+		eprintf("malloc() on journal");
+		return NULL;
+	}
+	memset(journal, 0, sizeof(journalState));
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&journal->operationLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_rwlock_init(&journal->cacheLock, NULL);
+	pthread_mutex_init(&journal->timerLock, NULL);
+	pthread_cond_init(&journal->timerWake, NULL);
+	return journal;
+}
+
+/**
+ * @brief free the journal state of a volume, closeJournal() must be called first
+ *
+ * @param journal the state
+ */
+void closeJournalState(journalState *journal)
+{
+	if (journal == NULL)
+	{
+		return;
+	}
+	pthread_mutex_destroy(&journal->operationLock);
+	pthread_rwlock_destroy(&journal->cacheLock);
+	pthread_mutex_destroy(&journal->timerLock);
+	pthread_cond_destroy(&journal->timerWake);
+	free(journal->cache);
+	free(journal);
+}
+
+/**
+ * @brief take the lock of operations
+ */
+static void lockOperation()
+{
+	pthread_mutex_lock(&currentVolume->journal->operationLock);
+}
+
+/**
+ * @brief release the lock of operations
+ */
+static void unlockOperation()
+{
+	pthread_mutex_unlock(&currentVolume->journal->operationLock);
+}
+
+/**
+ * @brief find the image of a block in memory
+ *
+ * @param lba home location of the block
+ * @return the cached block, NULL if not found
+ */
+static journalBlock *findCached(uint64_t lba)
+{
+	journalState *journal = currentVolume->journal;
+
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		if (journal->cache[i].lba == lba)
+		{
+			return journal->cache + i;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief amount of journal blocks a record of the given images takes
+ */
+static uint64_t recordBlockCount(uint64_t imageCount)
+{
+	return getBlockCount(sizeof(journalHeader) + imageCount * sizeof(uint64_t)) + imageCount + 1;
+}
+
+/**
+ * @brief used to sort the cache before writing it home
+ */
+static int compareLBA(const void *a, const void *b)
+{
+	uint64_t left = ((journalBlock *)a)->lba;
+	uint64_t right = ((journalBlock *)b)->lba;
+	return left < right ? -1 : left > right;
+}
+
+/**
+ * @brief image of a block as it is committed in the journal
+ *
+ * @return the image, NULL if the block has no committed image in memory
+ */
+static char *committedImage(journalBlock *block)
+{
+	if (!block->pending)
+	{
+		return block->data;
+	}
+	return block->committed;
+}
+
+/**
+ * @brief write every committed image in memory to its home in LBA order,
+ * then mark the journal as empty in the vcb
+ *
+ * images of the running batch stay in memory, a block it changed again
+ * goes home as it was committed, so the volume only ever holds committed
+ * metadata and the batch can still be journaled as a whole
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int flushCache()
+{
+	journalState *journal = currentVolume->journal;
+
+	pthread_rwlock_wrlock(&journal->cacheLock);
+	qsort(journal->cache, journal->cacheCount, sizeof(journalBlock), compareLBA);
+
+	// blocks next to each other are written with one LBAwrite()
+	char *runBuffer = fsMalloc(journal->cacheCount * ourVCB->blockSize + 1);
+	if (runBuffer == NULL)
+	{
+		eprintf("malloc() on runBuffer");
+		pthread_rwlock_unlock(&journal->cacheLock);
+		return -1;
+	}
+	uint64_t written = 0;
+	for (uint64_t i = 0; i < journal->cacheCount;)
+	{
+		if (committedImage(journal->cache + i) == NULL)
+		{
+			i++;
+			continue;
+		}
+		uint64_t run = 0;
+		while (i + run < journal->cacheCount && journal->cache[i + run].lba == journal->cache[i].lba + run &&
+			   committedImage(journal->cache + i + run) != NULL)
+		{
+			memcpy(runBuffer + run * ourVCB->blockSize, committedImage(journal->cache + i + run), ourVCB->blockSize);
+			run++;
+		}
+		deviceWrite(runBuffer, run, journal->cache[i].lba);
+		written += run;
+		i += run;
+	}
+	free(runBuffer);
+	runBuffer = NULL;
+
+	uint64_t kept = 0;
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		free(journal->cache[i].committed);
+		journal->cache[i].committed = NULL;
+		if (journal->cache[i].pending)
+		{
+			journal->cache[kept++] = journal->cache[i];
+		}
+		else
+		{
+			free(journal->cache[i].data);
+		}
+	}
+	ldprintf("checkpointed %ld blocks", written);
+	journal->cacheCount = kept;
+	journal->liveBlocks = 0;
+	journal->releasedCached = kept > 0 && journal->releasedCached;
+
+	// the journal is empty, the next record starts at its beginning
+	journal->journalTail = 0;
+	pthread_rwlock_unlock(&journal->cacheLock);
+
+	// the vcb goes last, a crash before it just replays the journal again
+	ourVCB->journalHead = journal->journalTail;
+	ourVCB->journalSequence = journal->nextSequence;
+	return updateByLBAwrite(ourVCB, sizeof(vcb), 0);
+}
+
+static int commitBatch();
+
+/**
+ * @brief body of the commit timer, checks the age of the running batch
+ * each second and commits it when no operation is in the middle of it
+ *
+ * @param arg the volume of the journal
+ * @return NULL
+ */
+static void *commitTimer(void *arg)
+{
+	currentVolume = arg;
+	journalState *journal = currentVolume->journal;
+
+	pthread_mutex_lock(&journal->timerLock);
+	while (!journal->stopTimer)
+	{
+		struct timespec wake;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec += 1;
+		pthread_cond_timedwait(&journal->timerWake, &journal->timerLock, &wake);
+		if (journal->stopTimer)
+		{
+			break;
+		}
+		pthread_mutex_unlock(&journal->timerLock);
+
+		lockOperation();
+		if (journal->depth == 0 && journal->pendingCount > 0 &&
+			time(NULL) - journal->batchStart >= JOURNAL_COMMIT_SECONDS)
+		{
+			commitBatch();
+		}
+		unlockOperation();
+
+		pthread_mutex_lock(&journal->timerLock);
+	}
+	pthread_mutex_unlock(&journal->timerLock);
+	return NULL;
+}
+
+/**
+ * @brief put the journal on the volume the first time, then start using it
+ * must be called after replayJournal() when mounting
+ *
+ * @return 0 for success, -1 for fail
+ */
+int initJournal()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (ourVCB->journalLocation == 0)
+	{
+		// nothing is journaled yet, so these writes go straight home
+		uint64_t start = allocateFreespace(JOURNAL_BLOCK_COUNT);
+		if (start == -1)
+		{
+			eprintf("allocateFreespace() on journal");
+			return -1;
+		}
+
+		// a clean first block so an old record can't be taken as the first one
+		char *emptyBlock = fsMalloc(ourVCB->blockSize);
+		if (emptyBlock == NULL)
+		{
+			eprintf("malloc() on emptyBlock");
+			return -1;
+		}
+		memset(emptyBlock, 0, ourVCB->blockSize);
+		deviceWrite(emptyBlock, 1, start);
+		free(emptyBlock);
+		emptyBlock = NULL;
+
+		ourVCB->journalLocation = start;
+		ourVCB->journalBlockCount = JOURNAL_BLOCK_COUNT;
+		ourVCB->journalHead = 0;
+		ourVCB->journalSequence = 1;
+		updateOurVCB();
+		dprintf("journal created at %ld", start);
+	}
+
+	journal->journalTail = ourVCB->journalHead;
+	journal->nextSequence = ourVCB->journalSequence;
+	journal->liveBlocks = 0;
+	journal->journalActive = 1;
+
+	journal->stopTimer = 0;
+	if (pthread_create(&journal->timer, NULL, commitTimer, currentVolume) != 0)
+	{ // batches are still committed by count and at the checkpoint
+		eprintf("pthread_create() failed");
+		return 0;
+	}
+	journal->timerRunning = 1;
+	return 0;
+}
+
+/**
+ * @brief write the committed records of the journal to their homes,
+ * records without a valid commit are ignored
+ *
+ * @return amount of replayed records, -1 for fail
+ */
+int replayJournal()
+{
+	if (ourVCB->journalLocation == 0)
+	{
+		return 0;
+	}
+
+	uint64_t capacity = ourVCB->journalBlockCount;
+	uint64_t position = ourVCB->journalHead;
+	uint64_t sequence = ourVCB->journalSequence;
+	int replayed = 0;
+
+	journalHeader *header = fsMalloc(ourVCB->blockSize);
+	if (header == NULL)
+	{
+		eprintf("malloc() on header");
+		return -1;
+	}
+
+	while (1)
+	{
+		// a record that does not fit at the end was written at the beginning
+		if (position + 2 > capacity)
+		{
+			position = 0;
+		}
+		deviceRead(header, 1, ourVCB->journalLocation + position);
+		if ((header->magicNumber != JOURNAL_MAGIC || header->sequence != sequence) && position != 0)
+		{
+			position = 0;
+			deviceRead(header, 1, ourVCB->journalLocation + position);
+		}
+		if (header->magicNumber != JOURNAL_MAGIC || header->type != JOURNAL_DESCRIPTOR ||
+			header->sequence != sequence || header->blockCount > capacity)
+		{
+			break;
+		}
+
+		uint64_t imageCount = header->blockCount;
+		uint64_t size = recordBlockCount(imageCount);
+		if (position + size > capacity)
+		{
+			break;
+		}
+
+		char *record = fsMalloc(size * ourVCB->blockSize);
+		if (record == NULL)
+		{
+			eprintf("malloc() on record");
+			break;
+		}
+		deviceRead(record, size, ourVCB->journalLocation + position);
+
+		// the commit must match the descriptor and the images
+		uint64_t *lbas = (uint64_t *)(record + sizeof(journalHeader));
+		char *images = record + (size - imageCount - 1) * ourVCB->blockSize;
+		journalHeader *commit = (journalHeader *)(record + (size - 1) * ourVCB->blockSize);
+		if (commit->magicNumber != JOURNAL_MAGIC || commit->type != JOURNAL_COMMIT ||
+			commit->sequence != sequence || commit->blockCount != imageCount ||
+			commit->checksum != fingerprintData(images, imageCount * ourVCB->blockSize))
+		{
+			free(record);
+			break;
+		}
+
+		for (uint64_t i = 0; i < imageCount; i++)
+		{
+			deviceWrite(images + i * ourVCB->blockSize, 1, lbas[i]);
+		}
+		free(record);
+		record = NULL;
+
+		position += size;
+		sequence++;
+		replayed++;
+	}
+	free(header);
+	header = NULL;
+
+	// the vcb itself may have been replayed
+	if (replayed > 0)
+	{
+		char *readBuffer = fsMalloc(getBlockCount(sizeof(vcb)) * ourVCB->blockSize);
+		if (readBuffer == NULL)
+		{
+			eprintf("malloc() on readBuffer");
+			return -1;
+		}
+		deviceRead(readBuffer, getBlockCount(sizeof(vcb)), 0);
+		memcpy(ourVCB, readBuffer, sizeof(vcb));
+		free(readBuffer);
+		readBuffer = NULL;
+		printf("replayed %d journal records\n", replayed);
+	}
+
+	ourVCB->journalHead = position;
+	ourVCB->journalSequence = sequence;
+	updateByLBAwrite(ourVCB, sizeof(vcb), 0);
+	return replayed;
+}
+
+/**
+ * @brief start an operation, all metadata it writes is committed together
+ * calls can be nested, only the outer one counts
+ *
+ * @return 0 for success
+ */
+int journalBegin()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return 0;
+	}
+
+	// released by the journalEnd() of the same call
+	lockOperation();
+	if (journal->depth == 0)
+	{
+		// make room before the operation, the running batch is complete here
+		uint64_t freeBlocks = ourVCB->journalBlockCount - journal->liveBlocks;
+		if (freeBlocks < recordBlockCount(journal->pendingCount) + JOURNAL_RESERVE)
+		{
+			journalCommit();
+			journalCheckpoint();
+		}
+		if (journal->pendingCount == 0)
+		{
+			journal->batchStart = time(NULL);
+		}
+	}
+	journal->depth++;
+	return 0;
+}
+
+/**
+ * @brief finish an operation, and commit the batch when it is big or old enough
+ *
+ * @return 0 for success, -1 for fail
+ */
+int journalEnd()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive || journal->depth == 0)
+	{
+		return 0;
+	}
+
+	journal->depth--;
+	if (journal->depth > 0)
+	{
+		unlockOperation();
+		return 0;
+	}
+
+	int retVal = 0;
+	journal->batchOps++;
+	if (journal->batchOps >= JOURNAL_GROUP_OPS || time(NULL) - journal->batchStart >= JOURNAL_COMMIT_SECONDS)
+	{
+		retVal = journalCommit();
+	}
+	unlockOperation();
+	return retVal;
+}
+
+/**
+ * @brief keep a metadata write in memory for the running batch
+ * same arguments as updateByLBAwrite(), which is used before the journal exists
+ *
+ * @param toWrite pointer to the element
+ * @param size size of the element in bytes
+ * @param start the beginning block
+ * @return 0 for success, -1 for fail
+ */
+int journalLBAwrite(void *toWrite, uint64_t size, uint64_t start)
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return updateByLBAwrite(toWrite, size, start);
+	}
+
+	// a write outside any operation is an operation by itself,
+	// inside one this only nests, the depth is read under the lock
+	journalBegin();
+
+	pthread_rwlock_wrlock(&journal->cacheLock);
+	uint blockCount = getBlockCount(size);
+	for (uint64_t i = 0; i < blockCount; i++)
+	{
+		journalBlock *block = findCached(start + i);
+		if (block == NULL)
+		{
+			if (journal->cacheCount == journal->cacheCapacity)
+			{
+				uint64_t newCapacity = journal->cacheCapacity == 0 ? 64 : journal->cacheCapacity * 2;
+				journalBlock *newCache = fsRealloc(journal->cache, newCapacity * sizeof(journalBlock));
+				if (newCache == NULL)
+				{
+					eprintf("realloc() on journal->cache");
+					pthread_rwlock_unlock(&journal->cacheLock);
+					journalEnd();
+					return -1;
+				}
+				journal->cache = newCache;
+				journal->cacheCapacity = newCapacity;
+			}
+
+			block = journal->cache + journal->cacheCount;
+			block->data = fsMalloc(ourVCB->blockSize);
+			if (block->data == NULL)
+			{
+				eprintf("malloc() on block->data");
+				pthread_rwlock_unlock(&journal->cacheLock);
+				journalEnd();
+				return -1;
+			}
+			block->lba = start + i;
+			block->pending = 0;
+			block->committed = NULL;
+			journal->cacheCount++;
+		}
+		else if (!block->pending)
+		{
+			// the committed image may not be home yet, it is kept
+			// so a checkpoint during this batch can still write it
+			char *data = fsMalloc(ourVCB->blockSize);
+			if (data == NULL)
+			{
+				eprintf("malloc() on block->data");
+				pthread_rwlock_unlock(&journal->cacheLock);
+				journalEnd();
+				return -1;
+			}
+			block->committed = block->data;
+			block->data = data;
+		}
+
+		// same as updateByLBAwrite(), the rest of the last block is zero
+		uint64_t offset = i * ourVCB->blockSize;
+		uint64_t length = size - offset < ourVCB->blockSize ? size - offset : ourVCB->blockSize;
+		memset(block->data, 0, ourVCB->blockSize);
+		memcpy(block->data, (char *)toWrite + offset, length);
+		if (!block->pending)
+		{
+			block->pending = 1;
+			journal->pendingCount++;
+		}
+	}
+	pthread_rwlock_unlock(&journal->cacheLock);
+
+	return journalEnd();
+}
+
+/**
+ * @brief LBAread() that also sees metadata not written home yet
+ *
+ * @return amount of blocks read
+ */
+uint64_t journalLBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition)
+{
+	journalState *journal = currentVolume->journal;
+
+	// the images can't be written home between reading the volume and the cache
+	pthread_rwlock_rdlock(&journal->cacheLock);
+	uint64_t retVal = deviceRead(buffer, lbaCount, lbaPosition);
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		if (journal->cache[i].lba >= lbaPosition && journal->cache[i].lba < lbaPosition + lbaCount)
+		{
+			memcpy((char *)buffer + (journal->cache[i].lba - lbaPosition) * ourVCB->blockSize,
+				   journal->cache[i].data, ourVCB->blockSize);
+		}
+	}
+	pthread_rwlock_unlock(&journal->cacheLock);
+	return retVal;
+}
+
+/**
+ * @brief remember blocks were released, so they are not overwritten
+ * as file data before the release is safe in the journal
+ *
+ * @param start first released block
+ * @param count amount of released blocks
+ */
+void journalNoteRelease(uint64_t start, uint64_t count)
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return;
+	}
+
+	journal->releasedInBatch = 1;
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		if (journal->cache[i].lba >= start && journal->cache[i].lba < start + count)
+		{
+			journal->releasedCached = 1;
+		}
+	}
+}
+
+/**
+ * @brief called before file data is written straight to the volume
+ *
+ * released blocks can be reused by the data, so their release is
+ * committed first, and if one of them still has a metadata image in the
+ * journal we checkpoint, otherwise a replay would put the image back
+ * over the new data
+ */
+void journalBeforeDataWrite()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return;
+	}
+
+	lockOperation();
+	if (journal->depth == 0)
+	{
+		if (journal->releasedCached)
+		{
+			journalCheckpoint();
+		}
+		else if (journal->releasedInBatch)
+		{
+			journalCommit();
+		}
+	}
+	unlockOperation();
+}
+
+/**
+ * @brief body of journalCommit(), called with operationLock held
+ *
+ * @return 0 for success, -1 for fail
+ */
+static int commitBatch()
+{
+	journalState *journal = currentVolume->journal;
+
+	// access times wait in memory for a batch going out,
+	// the depth keeps their writes inside this batch
+	journal->depth++;
+	flushInodeTimes();
+	journal->depth--;
+
+	if (journal->pendingCount == 0)
+	{
+		journal->batchOps = 0;
+		return 0;
+	}
+
+	uint64_t capacity = ourVCB->journalBlockCount;
+	uint64_t size = recordBlockCount(journal->pendingCount);
+	uint64_t position = journal->journalTail;
+	uint64_t gap = 0;
+	if (position + size > capacity)
+	{ // skip the end and wrap around
+		gap = capacity - position;
+		position = 0;
+	}
+
+	// it can't be committed atomically, so it stays in memory uncommitted
+	// and the volume keeps the metadata of the last batch
+	if (size > capacity)
+	{
+		eprintf("batch of %ld blocks is bigger than the journal of %ld blocks", journal->pendingCount, capacity);
+		return -1;
+	}
+
+	// only an operation writing more than the reserve gets here, the
+	// committed records go home first so the batch gets the whole journal
+	if (size + gap > capacity - journal->liveBlocks)
+	{
+		dprintf("batch of %ld blocks doesn't fit the journal, checkpointing first", journal->pendingCount);
+		if (flushCache() != 0)
+		{
+			return -1;
+		}
+		position = 0;
+		gap = 0;
+	}
+
+	char *record = fsMalloc(size * ourVCB->blockSize);
+	if (record == NULL)
+	{
+		eprintf("malloc() on record");
+		return -1;
+	}
+	memset(record, 0, size * ourVCB->blockSize);
+
+	// descriptor with the home of each image, then the images
+	journalHeader *header = (journalHeader *)record;
+	uint64_t *lbas = (uint64_t *)(record + sizeof(journalHeader));
+	char *images = record + (size - journal->pendingCount - 1) * ourVCB->blockSize;
+	uint64_t imageCount = 0;
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		if (journal->cache[i].pending)
+		{
+			lbas[imageCount] = journal->cache[i].lba;
+			memcpy(images + imageCount * ourVCB->blockSize, journal->cache[i].data, ourVCB->blockSize);
+			journal->cache[i].pending = 0;
+			free(journal->cache[i].committed);
+			journal->cache[i].committed = NULL;
+			imageCount++;
+		}
+	}
+	header->magicNumber = JOURNAL_MAGIC;
+	header->type = JOURNAL_DESCRIPTOR;
+	header->sequence = journal->nextSequence;
+	header->blockCount = imageCount;
+
+	journalHeader *commit = (journalHeader *)(record + (size - 1) * ourVCB->blockSize);
+	memcpy(commit, header, sizeof(journalHeader));
+	commit->type = JOURNAL_COMMIT;
+	commit->checksum = fingerprintData(images, imageCount * ourVCB->blockSize);
+
+	deviceWrite(record, size, ourVCB->journalLocation + position);
+	free(record);
+	record = NULL;
+
+	ldprintf("committed record %ld with %ld blocks after %d operations", journal->nextSequence, imageCount, journal->batchOps);
+	journal->journalTail = position + size;
+	journal->liveBlocks += gap + size;
+	journal->nextSequence++;
+	journal->pendingCount = 0;
+	journal->batchOps = 0;
+	journal->releasedInBatch = 0;
+	return 0;
+}
+
+/**
+ * @brief write the running batch into the journal with one LBAwrite()
+ *
+ * @return 0 for success, -1 for fail
+ */
+int journalCommit()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return 0;
+	}
+
+	lockOperation();
+	int retVal = commitBatch();
+	unlockOperation();
+	return retVal;
+}
+
+/**
+ * @brief commit the running batch and write every image to its home
+ *
+ * @return 0 for success, -1 for fail
+ */
+int journalCheckpoint()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (!journal->journalActive)
+	{
+		return 0;
+	}
+
+	lockOperation();
+	int retVal = commitBatch();
+	if (retVal == 0)
+	{
+		retVal = flushCache();
+	}
+	unlockOperation();
+	return retVal;
+}
+
+/**
+ * @brief checkpoint and stop journaling, later writes go straight home
+ *
+ * @return 0 for success, -1 for fail
+ */
+int closeJournal()
+{
+	journalState *journal = currentVolume->journal;
+
+	if (journal->timerRunning)
+	{
+		pthread_mutex_lock(&journal->timerLock);
+		journal->stopTimer = 1;
+		pthread_cond_signal(&journal->timerWake);
+		pthread_mutex_unlock(&journal->timerLock);
+		pthread_join(journal->timer, NULL);
+		journal->timerRunning = 0;
+	}
+
+	int retVal = journalCheckpoint();
+
+	// a batch that failed to commit is dropped, the volume keeps the last one
+	for (uint64_t i = 0; i < journal->cacheCount; i++)
+	{
+		free(journal->cache[i].data);
+		free(journal->cache[i].committed);
+	}
+	journal->cacheCount = 0;
+	journal->pendingCount = 0;
+	free(journal->cache);
+	journal->cache = NULL;
+	journal->cacheCapacity = 0;
+	journal->journalActive = 0;
+	journal->depth = 0;
+	journal->batchOps = 0;
+	return retVal;
+}
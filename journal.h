@@ -0,0 +1,62 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: journal.h
+*
+* Description: Interface of the write-ahead journal of metadata
+*	blocks (vcb, freespace, directories and the extent table)
+*
+**************************************************************/
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+#ifndef uint32_t
+typedef u_int32_t uint32_t;
+#endif
+
+#define JOURNAL_MAGIC 0x4C4E524A // stands for "JRNL"
+#define JOURNAL_BLOCK_COUNT 512	 // blocks reserved for the journal on the volume
+#define JOURNAL_GROUP_OPS 16	 // operations batched into one commit
+#define JOURNAL_COMMIT_SECONDS 5 // max age of a batch, enforced by the commit timer
+
+#define JOURNAL_DESCRIPTOR 1
+#define JOURNAL_COMMIT 2
+
+// layout of a record: descriptor | block images | commit
+// the descriptor is followed by the LBA of each image and can take several blocks
+typedef struct
+{
+	uint32_t magicNumber;
+	uint32_t type;		   // JOURNAL_DESCRIPTOR or JOURNAL_COMMIT
+	uint64_t sequence;	   // increases by one for each record
+	uint64_t blockCount;   // amount of block images in the record
+	uint64_t checksum;	   // fingerprint of the images, only in the commit
+} journalHeader;
+
+struct journalState *openJournalState();
+void closeJournalState(struct journalState *journal);
+int initJournal();
+int replayJournal();
+int journalBegin();
+int journalEnd();
+int journalLBAwrite(void *toWrite, uint64_t size, uint64_t start);
+uint64_t journalLBAread(void *buffer, uint64_t lbaCount, uint64_t lbaPosition);
+void journalNoteRelease(uint64_t start, uint64_t count);
+void journalBeforeDataWrite();
+int journalCommit();
+int journalCheckpoint();
+int closeJournal();
+
+#endif
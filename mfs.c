@@ -16,9 +16,90 @@ Siqi Guo, 918209895, Guo-1999
 *
 **************************************************************/
 
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "mfs.h"
+#include "compress.h"
+#include "extent.h"
+#include "inode.h"
+#include "journal.h"
+#include "prefetch.h"
+#include "defrag.h"
 #include "bitmap.c"
 
+// the volume used by this thread, ourVCB and freespace are the ones of it
+__thread fsVolume *currentVolume = NULL;
+
+// the volume used by the calls without a session argument
+fsVolume *defaultVolume = NULL;
+
+// every fsMalloc(), fsCalloc() and fsRealloc() adds one
+unsigned long fsAllocationCount = 0;
+
+/**
+ * @brief malloc() counted in fsAllocationCount, every module of the file
+ * system allocates through this or fsCalloc() and fsRealloc()
+ *
+ * @param size bytes to allocate
+ * @return the memory, NULL for fail
+ */
+void *fsMalloc(size_t size)
+{
+    __atomic_add_fetch(&fsAllocationCount, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+/**
+ * @brief calloc() counted in fsAllocationCount
+ *
+ * @param count amount of members
+ * @param size bytes of each member
+ * @return the zeroed memory, NULL for fail
+ */
+void *fsCalloc(size_t count, size_t size)
+{
+    __atomic_add_fetch(&fsAllocationCount, 1, __ATOMIC_RELAXED);
+    return calloc(count, size);
+}
+
+/**
+ * @brief realloc() counted in fsAllocationCount
+ *
+ * @param pointer the memory to resize, NULL allocates new memory
+ * @param size bytes it holds after
+ * @return the resized memory, NULL for fail and pointer is kept
+ */
+void *fsRealloc(void *pointer, size_t size)
+{
+    __atomic_add_fetch(&fsAllocationCount, 1, __ATOMIC_RELAXED);
+    return realloc(pointer, size);
+}
+
+// bodies of the public calls, run inside a journal transaction
+int mkdirByPath(fdDir *start, const char *pathname, mode_t mode);
+int rmdirByPath(fsSession *session, fdDir *start, const char *pathname);
+int deleteByPath(fdDir *start, const char *filename);
+int removeFileEntry(fdDir *parent, int i);
+
+// blocks collected by a recursive delete, released together at the end
+typedef struct
+{
+    uint64_t start;
+    uint64_t count;
+} blockRun;
+
+typedef struct
+{
+    blockRun *runs;
+    uint64_t runCount;
+    uint64_t runCapacity;
+} releaseBatch;
+
+static int queueRelease(releaseBatch *batch, uint64_t start, uint64_t count);
+static int releaseQueued(releaseBatch *batch);
+
 // OUTPUT TERMINAL COMMAND
 // Hexdump/hexdump.linux SampleVolume --count 1 --start 12
 
@@ -30,6 +111,42 @@ Siqi Guo, 918209895, Guo-1999
  * @return 0-∞ for starting block, -1 for fail
  */
 uint64_t allocateFreespace(uint64_t requestedBlock)
+{
+    return allocateFreespaceNear(requestedBlock, 0);
+}
+
+/**
+ * @brief pick where a file or directory should be allocated, a top level
+ * directory goes to a group picked by spreadGoal(), everything else right
+ * behind its parent directory, so a tree is read without long seeks
+ * 
+ * @param parent the . entry of the parent directory
+ * @param fileType TYPE_DIR or TYPE_FILE
+ * @param requestedBlock amount of blocks to be occupied
+ * @return the goal for allocateFreespaceNear(), 0 for the first fit
+ */
+uint64_t placementGoal(struct fs_diriteminfo *parent, int fileType, uint64_t requestedBlock)
+{
+    if (!(ourVCB->featureFlags & FEATURE_LOCALITY))
+    {
+        return 0;
+    }
+    if (fileType == TYPE_DIR && parent->entryStartLocation == ourVCB->rootDirLocation)
+    {
+        return spreadGoal(requestedBlock);
+    }
+    return parent->entryStartLocation;
+}
+
+/**
+ * @brief find contigous free blocks at or after the goal, and the first
+ * fit when there are none, then mark them as used like allocateFreespace()
+ * 
+ * @param requestedBlock amount of blocks to be occupied 
+ * @param goal block to start looking from, 0 for the first fit
+ * @return 0-∞ for starting block, -1 for fail
+ */
+uint64_t allocateFreespaceNear(uint64_t requestedBlock, uint64_t goal)
 {
     // handle error of invalid requestedBlock
     if (requestedBlock < 1)
@@ -38,64 +155,58 @@ uint64_t allocateFreespace(uint64_t requestedBlock)
         return -1;
     }
 
-    uint64_t count = 0;
-
     // use the firstFreeBlockIndex to save time
     // this can save a lot of time when there are a lot of files in the volume
-    for (uint64_t i = ourVCB->firstFreeBlockIndex; i < ourVCB->numberOfBlocks; i++)
+    uint64_t i = ourVCB->numberOfBlocks;
+    if (goal > ourVCB->firstFreeBlockIndex)
+    {
+        i = findFreeRun(requestedBlock, goal);
+    }
+    if (i == ourVCB->numberOfBlocks)
+    {
+        i = findFreeRun(requestedBlock, ourVCB->firstFreeBlockIndex);
+    }
+    if (i < ourVCB->numberOfBlocks)
     {
-        if (checkBit(i, freespace) == SPACE_FREE)
+        // set the bit of these contigous blocks to used
+        for (uint64_t j = 0; j < requestedBlock; j++)
         {
-            count++;
-            if (count == requestedBlock)
+            // handle error when setBitUsed get in errors
+            if (setBitUsed(i - j) != 0)
             {
-                // set the bit of these contigous blocks to used
-                for (uint64_t j = 0; j < count; j++)
-                {
-                    // handle error when setBitUsed get in errors
-                    if (setBitUsed(i - j, freespace) != 0)
-                    {
-                        // this won't run if checkBit() works as expected
-                        eprintf("setBitUsed() failed, bit at %ld", j);
-
-                        // if current index of j gets in error, go back to the previous one
-                        for (j--; j >= 0; j--)
-                        {
-                            setBitFree(i - j, freespace);
-                        }
-                        return -1;
-                    }
-                }
+                // this won't run if checkBit() works as expected
+                eprintf("setBitUsed() failed, bit at %ld", i - j);
 
-                // check if the first free block is occupied to determine if we need to update
-                if (checkBit(ourVCB->firstFreeBlockIndex, freespace) == SPACE_USED)
+                // if current index of j gets in error, go back to the previous one
+                while (j > 0)
                 {
-                    // if so, the ith block is the last occupied block
-                    // so we start checking i+1th block to save time
-                    for (uint64_t k = i + 1; k < ourVCB->numberOfBlocks; k++)
-                    {
-                        if (checkBit(k, freespace) == SPACE_FREE)
-                        {
-                            // set the new first free block index and update ourVCB
-                            dprintf("first free block index changes to %ld", k);
-                            ourVCB->firstFreeBlockIndex = k;
-                            updateOurVCB();
-                            break;
-                        }
-                    }
+                    j--;
+                    setBitFree(i - j);
                 }
-
-                // return the starting block index of this allocated space
-                updateFreespace();
-                uint64_t val = i - requestedBlock + 1;
-                dprintf("returning block index: %ld\n", val);
-                return val;
+                return -1;
             }
         }
-        else
+
+        // check if the first free block is occupied to determine if we need to update
+        if (checkBit(ourVCB->firstFreeBlockIndex) == SPACE_USED)
         {
-            count = 0;
+            // if so, the ith block is the last occupied block
+            // so we start checking i+1th block to save time
+            uint64_t k = findFreeBlock(i + 1);
+            if (k < ourVCB->numberOfBlocks)
+            {
+                // set the new first free block index and update ourVCB
+                dprintf("first free block index changes to %ld", k);
+                ourVCB->firstFreeBlockIndex = k;
+                updateOurVCB();
+            }
         }
+
+        // return the starting block index of this allocated space
+        updateFreespace();
+        uint64_t val = i - requestedBlock + 1;
+        dprintf("returning block index: %ld\n", val);
+        return val;
     }
 
     // not enough space
@@ -111,7 +222,7 @@ uint64_t allocateFreespace(uint64_t requestedBlock)
 int updateOurVCB()
 {
     ldprintf("updating ourVCB\n");
-    return updateByLBAwrite(ourVCB, sizeof(vcb), 0);
+    return journalLBAwrite(ourVCB, sizeof(vcb), 0);
 }
 
 /**
@@ -122,26 +233,38 @@ int updateOurVCB()
 int updateFreespace()
 {
     ldprintf("updating freespace\n");
+    int retVal = 0;
 
-    // do a round up since it needs to turn bits into bytes
-    uint64_t bytes = ourVCB->numberOfBlocks / 8;
-    if (ourVCB->numberOfBlocks % 8 > 0)
+    // only the pages and summary blocks changed since the last update
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < freespace->dirtyCount; i++)
     {
-        bytes++;
+        uint64_t slot = freespace->dirtyList[i];
+        if (slot < freespace->pageCount)
+        { // pages start right behind vcb
+            retVal |= journalLBAwrite(freespace->pages[slot], ourVCB->blockSize,
+                                      ourVCB->vcbBlockCount + slot);
+        }
+        else if (ourVCB->freespaceSummaryLocation != 0)
+        {
+            uint64_t block = slot - freespace->pageCount;
+            retVal |= journalLBAwrite(freespace->summary[block], ourVCB->blockSize,
+                                      ourVCB->freespaceSummaryLocation + block);
+        }
+        else
+        { // the summary has no place on the volume yet
+            freespace->dirtyList[kept++] = slot;
+            continue;
+        }
+        freespace->dirtyFlags[slot] = 0;
     }
 
-    // starts right behind vcb
-    int retVal = updateByLBAwrite(freespace, bytes, ourVCB->vcbBlockCount);
-
-    // testing freespace on removing
-    printf("\nused block index: ");
-    for (int i = 0; i < ourVCB->numberOfBlocks; i++)
+    // the free block count in the vcb goes with the bitmap it counts
+    if (freespace->dirtyCount > kept)
     {
-        if (checkBit(i, freespace) == 1)
-        {
-            printf("%d ", i);
-        }
+        retVal |= updateOurVCB();
     }
+    freespace->dirtyCount = kept;
 
     return retVal;
 }
@@ -154,917 +277,2844 @@ int updateFreespace()
 int updateDirectory(fdDir *dirp)
 {
     ldprintf("updating directory %s", dirp->dirName);
-    int retVal = updateByLBAwrite(dirp, dirp->d_reclen, dirp->directoryStartLocation);
+    prefetchForget(dirp->directoryStartLocation);
 
-    // read the data again if it is updating cwd
-    if (fsCWD != NULL && dirp->directoryStartLocation == fsCWD->directoryStartLocation)
+    char *packBuffer = (char *)allocDir();
+    if (packBuffer == NULL)
     {
-        memcpy(fsCWD, dirp, sizeof(fdDir));
+        return -1;
     }
-}
 
-/**
- * @brief base of updating volume using LBAwrite()
- * 
- * @param toWrite pointer to the element
- * @param count block count
- * @param start the beginning block
- * @return 0 for success, -1 for fail
- */
-int updateByLBAwrite(void *toWrite, uint64_t size, uint start)
-{
-    // set up a clean buffer to copy data
-    uint blockCount = getBlockCount(size);
-    uint64_t fullBlockSize = blockCount * ourVCB->blockSize;
-    char *writeBuffer = malloc(fullBlockSize);
-    if (writeBuffer == NULL)
+    // only names close to 255 bytes make it longer than DIR_EXTENT_SIZE,
+    // it still fits in the whole blocks of the extent
+    uint64_t packedLength = packDirectory(dirp, packBuffer);
+    if (packedLength > getBlockCount(DIR_EXTENT_SIZE) * ourVCB->blockSize)
     {
-        eprintf("malloc() on writeBuffer");
+        eprintf("directory %s doesn't fit its extent", dirp->dirName);
+        releaseDir((fdDir *)packBuffer);
         return -1;
     }
-    memset(writeBuffer, 0, fullBlockSize);
-
-    // copy the data and then write using LBAwrite()
-    memcpy(writeBuffer, toWrite, size);
-    LBAwrite(writeBuffer, blockCount, start);
+    int retVal = journalLBAwrite(packBuffer, packedLength, dirp->directoryStartLocation);
+    releaseDir((fdDir *)packBuffer);
 
-    ldprintf("size : %d", size);
-    ldprintf("block count : %d", blockCount);
-    ldprintf("start : %d", start);
+    // every session reads its cwd again before using it
+    __atomic_add_fetch(&dirVersion, 1, __ATOMIC_RELEASE);
+    return retVal;
+}
 
-    free(writeBuffer);
-    writeBuffer = NULL;
-    return 0;
+/**
+ * @brief hash of a name kept in the directory for findEntry()
+ * 
+ * @param name the name, doesn't need a null terminator
+ * @param length length of the name
+ * @return the hash
+ */
+uint32_t hashName(const char *name, size_t length)
+{
+    return (uint32_t)fingerprintData(name, length);
 }
 
 /**
- * @brief round up while doing division
+ * @brief set nameHash and nameLength of the directory from its entries,
+ * the entries changed in memory are only found after this
  * 
- * @param num number to be divided
- * @param divider number to be divided by
- * @return rounded up result
+ * @param dirp the directory
  */
-uint getBlockCount(uint64_t num)
+void hashEntryNames(fdDir *dirp)
 {
-    int result = num / ourVCB->blockSize;
-    if (num % ourVCB->blockSize > 0)
+    for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
     {
-        result++;
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space != SPACE_USED)
+        {
+            dirp->nameHash[i] = 0;
+            dirp->nameLength[i] = 0;
+            continue;
+        }
+        dirp->nameLength[i] = strnlen(entry->d_name, MAX_NAME_LENGTH - 1);
+        dirp->nameHash[i] = hashName(entry->d_name, dirp->nameLength[i]);
     }
-    return result;
 }
 
 /**
- * @brief create a directory in the volume
+ * @brief find a used entry by its name, the hash and the length of every
+ * entry are compared at once and only the ones matching both compare the name
  * 
- * @param parent a pointer to the parent directory entry
- * @param name name of this new directory
- * @return pointer to created directory, NULL for fail
+ * @param dirp directory to look in
+ * @param name the name, doesn't need a null terminator
+ * @param length length of the name
+ * @return index in entryList, -1 if not found
  */
-fdDir *createDirectory(struct fs_diriteminfo *parent, char *name)
+int findEntry(fdDir *dirp, const char *name, size_t length)
 {
-    // malloc() a new directory and clean it up
-    fdDir *newDir = malloc(sizeof(fdDir));
-    if (newDir == NULL)
+    if (length == 0 || length >= MAX_NAME_LENGTH)
     {
-        eprintf("malloc() on newDir");
-        return NULL;
+        return -1;
     }
-    memset(newDir, 0, sizeof(fdDir));
-
-    // initialize the directory and allocate the space for it
-    uint dirBlockCount = getBlockCount(sizeof(fdDir));
-    int retVal = allocateFreespace(dirBlockCount);
-    if (retVal < 0)
+    uint32_t hash = hashName(name, length);
+
+    // one bit for each entry which has the same hash and length
+    unsigned int candidates = 0;
+#ifdef __SSE2__
+    __m128i wantedHash = _mm_set1_epi32(hash);
+    __m128i wantedLength = _mm_set1_epi32(length);
+    __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i += 4)
     {
-        eprintf("allocateFreespace()");
-        return NULL;
+        int packedLengths;
+        memcpy(&packedLengths, dirp->nameLength + i, sizeof(int));
+        __m128i lengths = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedLengths), zero), zero);
+        __m128i hashes = _mm_loadu_si128((const __m128i *)(dirp->nameHash + i));
+        __m128i matched = _mm_and_si128(_mm_cmpeq_epi32(hashes, wantedHash), _mm_cmpeq_epi32(lengths, wantedLength));
+        candidates |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(matched)) << i;
     }
-    newDir->directoryStartLocation = retVal;
-    newDir->d_reclen = sizeof(fdDir);
-    newDir->dirEntryAmount = 2;
+#else
+    for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    {
+        candidates |= (unsigned int)(dirp->nameHash[i] == hash && dirp->nameLength[i] == length) << i;
+    }
+#endif
 
-    // truncate the name if it exceeds the max length
-    if (strlen(name) > (MAX_NAME_LENGTH - 1))
+    while (candidates != 0)
     {
-        char *shortName = malloc(MAX_NAME_LENGTH);
-        if (shortName == NULL)
+        int i = __builtin_ctz(candidates);
+        candidates &= candidates - 1;
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space == SPACE_USED && memcmp(entry->d_name, name, length) == 0 && entry->d_name[length] == '\0')
         {
-            eprintf("malloc() on shortName");
-            return NULL;
+            return i;
         }
-
-        // make sure it only contains one less than the max for null terminator
-        strncpy(shortName, name, MAX_NAME_LENGTH - 1);
-        shortName[MAX_NAME_LENGTH - 1] = '\0';
-        strcpy(newDir->dirName, shortName);
-
-        free(shortName);
-        shortName = NULL;
-    }
-    else
-    {
-        strcpy(newDir->dirName, name);
-    }
-
-    // initialize current directory entry .
-    strcpy(newDir->entryList[0].d_name, ".");
-    newDir->entryList[0].fileType = TYPE_DIR;
-    newDir->entryList[0].space = SPACE_USED;
-    newDir->entryList[0].entryStartLocation = retVal;
-    newDir->entryList[0].d_reclen = sizeof(struct fs_diriteminfo);
-    newDir->entryList[0].size = sizeof(fdDir);
-
-    // initialize parent directory entry ..
-    if (parent == NULL)
-    { // if parent is NULL, this is a root directory
-        memcpy(newDir->entryList + 1, newDir->entryList, sizeof(struct fs_diriteminfo));
-    }
-    else
-    { // if parent is not NULL, we copy the parent into this entry
-        memcpy(newDir->entryList + 1, parent, sizeof(struct fs_diriteminfo));
     }
+    return -1;
+}
 
-    // parent directory needs to be renamed to ..
-    strcpy(newDir->entryList[1].d_name, "..");
+/**
+ * @brief write the used entries of a directory in the packed format,
+ * the name hashes of the directory are set again on the way
+ * 
+ * @param dirp the directory
+ * @param buffer where to pack, at least DIR_BUFFER_SIZE bytes
+ * @return amount of bytes packed
+ */
+uint64_t packDirectory(fdDir *dirp, char *buffer)
+{
+    hashEntryNames(dirp);
+
+    packedDirHeader header;
+    header.magicNumber = DIR_MAGIC;
+    header.version = DIR_FORMAT_VERSION;
+    header.directoryStartLocation = dirp->directoryStartLocation;
+    header.dirEntryAmount = dirp->dirEntryAmount;
+    header.recordCount = 0;
+    header.nameLength = strnlen(dirp->dirName, MAX_NAME_LENGTH - 1);
+
+    uint64_t offset = sizeof(packedDirHeader);
+    memcpy(buffer + offset, dirp->dirName, header.nameLength);
+    offset += header.nameLength;
+
+    packedDirUsage usage;
+    usage.usedBytes = dirp->usedBytes;
+    usage.usedBlocks = dirp->usedBlocks;
+    memcpy(buffer + offset, &usage, sizeof(packedDirUsage));
+    offset += sizeof(packedDirUsage);
 
-    // loop through the rest of entries to mark them as free
-    // this step can be ignored since we clean newDir above and SPACE_FREE = 0
-    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
     {
-        newDir->entryList[i].space = SPACE_FREE;
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space != SPACE_USED)
+        {
+            continue;
+        }
+
+        packedDirRecord record;
+        record.slot = i;
+        record.fileType = entry->fileType;
+        record.attributes = entry->attributes;
+        record.nameLength = dirp->nameLength[i];
+        record.entryStartLocation = entry->entryStartLocation;
+        record.size = entry->size;
+        record.nameHash = dirp->nameHash[i];
+        record.inodeNumber = entry->inodeNumber;
+
+        memcpy(buffer + offset, &record, sizeof(packedDirRecord));
+        offset += sizeof(packedDirRecord);
+        memcpy(buffer + offset, entry->d_name, record.nameLength);
+        offset += record.nameLength;
+        header.recordCount++;
     }
 
-    return newDir;
+    header.packedLength = offset;
+    memcpy(buffer, &header, sizeof(packedDirHeader));
+    return offset;
 }
 
 /**
- * @brief check if the path points to a file
+ * @brief fill a directory from the blocks read from the volume,
+ * a directory still in the fixed format of version 1 is copied as it is
  * 
- * @param path path to check
- * @return 1 for true, 0 for false, -1 for error
+ * @param buffer blocks of the directory
+ * @param size amount of bytes in buffer
+ * @param dirp where to unpack
+ * @return 0 for success, -1 for a damaged or cut directory
  */
-int fs_isFile(char *path)
+int unpackDirectory(const char *buffer, uint64_t size, fdDir *dirp)
 {
-    // keep a copy of fsCWD and openedDir
-    fdDir *copyOfCWD = fsCWD;
-    ldprintf("copy of fsCWD: %X", fsCWD);
-
-    // replace cwd by openedDir if a directory is open
-    int dirIsOpened = 0;
-    if (openedDir != NULL)
+    packedDirHeader header;
+    memcpy(&header, buffer, sizeof(packedDirHeader));
+    if (header.magicNumber != DIR_MAGIC)
     {
-        dirIsOpened = 1;
-        fsCWD = openedDir;
+        if (size < DIR_V1_SIZE)
+        {
+            return -1;
+        }
+
+        // entries of version 1 have no inode number at their end
+        memset(dirp, 0, sizeof(fdDir));
+        memcpy(dirp, buffer, offsetof(fdDir, entryList));
+        for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+        {
+            memcpy(dirp->entryList + i, buffer + offsetof(fdDir, entryList) + i * DIR_V1_ENTRY_SIZE,
+                   DIR_V1_ENTRY_SIZE);
+        }
+        hashEntryNames(dirp);
+        return 0;
     }
 
-    // make a copy and substring before the last slash
-    char *pathBeforeLastSlash = malloc(strlen(path) + 1);
-    if (pathBeforeLastSlash == NULL)
+    if (header.version != DIR_FORMAT_VERSION || header.packedLength > size ||
+        header.recordCount > MAX_AMOUNT_OF_ENTRIES ||
+        sizeof(packedDirHeader) + header.nameLength > header.packedLength)
     {
-        eprintf("malloc() on pathBeforeLastSlash");
         return -1;
     }
-    strcpy(pathBeforeLastSlash, path);
-    char *filename = getPathByLastSlash(pathBeforeLastSlash);
 
-    // find the directory that is expected for holding that file
-    fdDir *retPtr = getDirByPath(pathBeforeLastSlash);
+    // free entries are not packed, SPACE_FREE = 0
+    memset(dirp, 0, sizeof(fdDir));
+    dirp->d_reclen = DIR_EXTENT_SIZE;
+    dirp->directoryStartLocation = header.directoryStartLocation;
+    dirp->dirEntryAmount = header.dirEntryAmount;
 
-    int result = 0;
+    uint64_t offset = sizeof(packedDirHeader);
+    memcpy(dirp->dirName, buffer + offset, header.nameLength);
+    offset += header.nameLength;
 
-    // if the path is not even in a directory, then we don't need to check anymore
-    if (retPtr != NULL)
+    packedDirUsage usage;
+    if (offset + sizeof(packedDirUsage) > header.packedLength)
     {
-        // check if the item is inside this directory
-        for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
-        { // make sure that is a used space, a directory and name matched
-            if (retPtr->entryList[i].space == SPACE_USED &&
-                retPtr->entryList[i].fileType == TYPE_FILE &&
-                strcmp(retPtr->entryList[i].d_name, filename) == 0)
-            {
-                result = 1;
-            }
-        }
+        return -1;
     }
+    memcpy(&usage, buffer + offset, sizeof(packedDirUsage));
+    offset += sizeof(packedDirUsage);
+    dirp->usedBytes = usage.usedBytes;
+    dirp->usedBlocks = usage.usedBlocks;
 
-    // make sure we reset and also free the retPtr
-    if (dirIsOpened)
+    for (int i = 0; i < header.recordCount; i++)
     {
-        fsCWD = copyOfCWD;
-    }
-    ldprintf("reseted fsCWD: %X", fsCWD);
-
-    free(retPtr);
-    free(pathBeforeLastSlash);
-    free(filename);
-    retPtr = NULL;
-    pathBeforeLastSlash = NULL;
-    filename = NULL;
+        packedDirRecord record;
+        if (offset + sizeof(packedDirRecord) > header.packedLength)
+        {
+            return -1;
+        }
+        memcpy(&record, buffer + offset, sizeof(packedDirRecord));
+        offset += sizeof(packedDirRecord);
+        if (record.slot >= MAX_AMOUNT_OF_ENTRIES || offset + record.nameLength > header.packedLength)
+        {
+            return -1;
+        }
 
-    return result;
+        struct fs_diriteminfo *entry = dirp->entryList + record.slot;
+        entry->d_reclen = sizeof(struct fs_diriteminfo);
+        entry->fileType = record.fileType;
+        entry->space = SPACE_USED;
+        entry->attributes = record.attributes;
+        entry->entryStartLocation = record.entryStartLocation;
+        entry->size = record.size;
+        entry->inodeNumber = record.inodeNumber;
+        memcpy(entry->d_name, buffer + offset, record.nameLength);
+        offset += record.nameLength;
+
+        dirp->nameLength[record.slot] = record.nameLength;
+        dirp->nameHash[record.slot] = record.nameHash;
+    }
+    return 0;
 }
 
 /**
- * @brief check if the path points to a directory
+ * @brief commit the batched metadata changes of the volume used last
+ * into the journal, so everything done before this call survives a crash
  * 
- * @param path path to check
- * @return 1 for true, 0 for false
+ * @return 0 for success, -1 for fail
  */
-int fs_isDir(char *path)
+int fs_sync()
 {
-    // keep a copy of fsCWD and openedDir
-    fdDir *copyOfCWD = fsCWD;
-    ldprintf("origianl fsCWD: %X", fsCWD);
+    return journalCommit();
+}
 
-    // replace cwd by openedDir if a directory is open
-    int dirIsOpened = 0;
-    if (openedDir != NULL)
+/**
+ * @brief base of updating volume using LBAwrite()
+ * metadata should use journalLBAwrite() instead once the volume is mounted
+ * 
+ * @param toWrite pointer to the element
+ * @param count block count
+ * @param start the beginning block
+ * @return 0 for success, -1 for fail
+ */
+int updateByLBAwrite(void *toWrite, uint64_t size, uint start)
+{
+    // set up a clean buffer to copy data
+    uint blockCount = getBlockCount(size);
+    uint64_t fullBlockSize = blockCount * ourVCB->blockSize;
+    char *writeBuffer = fsMalloc(fullBlockSize);
+    if (writeBuffer == NULL)
     {
-        dirIsOpened = 1;
-        fsCWD = openedDir;
+        eprintf("malloc() on writeBuffer");
+        return -1;
     }
+    memset(writeBuffer, 0, fullBlockSize);
 
-    // getDirByPath() already checks TYPE_DIR while running
-    fdDir *retPtr = getDirByPath(path);
-    int result = 0;
-    if (retPtr != NULL)
-    {
-        result = 1;
-    }
+    // copy the data and then write using LBAwrite()
+    memcpy(writeBuffer, toWrite, size);
+    deviceWrite(writeBuffer, blockCount, start);
 
-    // make sure we reset and also free the retPtr
-    if (dirIsOpened)
-    {
-        fsCWD = copyOfCWD;
-        retPtr = NULL;
-    }
-    ldprintf("reseted fsCWD: %X", fsCWD);
+    ldprintf("size : %d", size);
+    ldprintf("block count : %d", blockCount);
+    ldprintf("start : %d", start);
 
-    free(retPtr);
-    return result;
+    free(writeBuffer);
+    writeBuffer = NULL;
+    return 0;
 }
 
 /**
- * @brief open the directory based on the path from cwd
+ * @brief find how many blocks the extent of an entry occupies
+ * compressed extents are shorter than their size, so ask their header
  * 
- * @param name the absolute path
- * @return a fdDir pointer of that directory, NULL for not found or fail
+ * @param entry entry of a file or directory
+ * @return amount of blocks
  */
-fdDir *fs_opendir(const char *name)
+uint64_t getExtentBlockCount(struct fs_diriteminfo *entry)
 {
-
-    // copy the name to avoid modifying it
-    char *path = malloc(strlen(name) + 1);
-    if (path == NULL)
+    if (entry->attributes & ATTR_COMPRESSED)
     {
-        eprintf("malloc()");
-        return NULL;
+        return compressedBlockCount(entry->entryStartLocation);
     }
-    strcpy(path, name);
-    openedDir = getDirByPath(path);
-
-    // set the entry index to 0 for fs_readDir() works
-    openedDirEntryIndex = 0;
-
-    free(path);
-    path = NULL;
-    return openedDir;
+    return getBlockCount(entry->size);
 }
 
 /**
- * @brief get a directory pointer from cwd
+ * @brief get the size and the free space of the volume of a session,
+ * the free block count is kept in the vcb so nothing is scanned
  * 
- * @param name name of the path
- * @return direcotry pointer, NULL for error or not found
+ * @param session the session
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
  */
-fdDir *getDirByPath(char *name)
+int fs_statvfs_r(fsSession *session, struct fs_statvfs *buf)
 {
-    fdDir *getDir = malloc(sizeof(fdDir));
-    if (getDir == NULL)
+    if (session == NULL || buf == NULL)
     {
-        eprintf("malloc() on getDir");
-        return NULL;
+        return -1;
     }
+    currentVolume = session->volume;
+
+    memset(buf, 0, sizeof(struct fs_statvfs));
+    buf->f_bsize = ourVCB->blockSize;
+    buf->f_blocks = ourVCB->numberOfBlocks;
+    buf->f_bfree = __atomic_load_n(&ourVCB->freeBlockCount, __ATOMIC_RELAXED);
+    buf->f_bavail = buf->f_bfree;
+    buf->f_namemax = MAX_NAME_LENGTH - 1;
+    return 0;
+}
 
-    // copy the cwd recorded by the file system
-    memcpy(getDir, fsCWD, sizeof(fdDir));
+/**
+ * @brief get the size and the free space of the volume
+ * 
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
+ */
+int fs_statvfs(struct fs_statvfs *buf)
+{
+    return fs_statvfs_r(fsDefaultSession, buf);
+}
 
-    // make a copy of name to avoid modifying it using strtok()
-    char *copyOfName = malloc(strlen(name) + 1);
-    if (copyOfName == NULL)
+/**
+ * @brief add a change of the files under a directory to its usage and
+ * to the usage of every directory above it up to the root, each of them
+ * is read again, so it is called after the caller wrote the directory
+ * 
+ * a directory not counted yet stops the walk, the ones above it are
+ * not counted either since their usage includes it
+ * 
+ * @param dirEntry the . entry of the directory that changed
+ * @param bytes change of the size of the files
+ * @param blocks change of the blocks
+ * @return 0 for success, -1 for fail
+ */
+int addTreeUsage(struct fs_diriteminfo *dirEntry, int64_t bytes, int64_t blocks)
+{
+    if (bytes == 0 && blocks == 0)
     {
-        eprintf("malloc() on copyOfName");
-        return NULL;
+        return 0;
     }
-    strcpy(copyOfName, name);
-
-    // split the string by the delimeter
-    char *token = strtok(copyOfName, "/");
 
-    // loop through the entry list to find the directory
-    while (token != NULL)
+    struct fs_diriteminfo entry = *dirEntry;
+    while (1)
     {
-        // if token is . or empty, it means current directory
-        if (strcmp(token, ".") == 0 || strcmp(token, "") == 0)
+        fdDir *dirp = getDirByEntry(&entry);
+        if (dirp == NULL)
         {
-            // do nothing
+            eprintf("getDirByEntry() on %ld", entry.entryStartLocation);
+            return -1;
+        }
+        if (dirp->usedBlocks == 0)
+        {
+            releaseDir(dirp);
+            return 0;
         }
-        else
-        { // loop through the entry list of getDir to see if any matches
-            // skip the first one since we do the case above
-            int i = 1;
-            for (; i < MAX_AMOUNT_OF_ENTRIES; i++)
-            { // make sure that is a used space, a directory and name matched
-                if (getDir->entryList[i].space == SPACE_USED &&
-                    getDir->entryList[i].fileType == TYPE_DIR &&
-                    strcmp(getDir->entryList[i].d_name, token) == 0)
-                {
-                    free(getDir);
-                    getDir = getDirByEntry(getDir->entryList + i);
-                    break;
-                }
-            }
 
-            // if it didn't find a directory, which should fail
-            if (i == MAX_AMOUNT_OF_ENTRIES)
-            { // notice this is an exepected error!!!
-                return NULL;
-            }
+        dirp->usedBytes += bytes;
+        dirp->usedBlocks += blocks;
+        updateDirectory(dirp);
+
+        if (dirp->directoryStartLocation == ourVCB->rootDirLocation)
+        {
+            releaseDir(dirp);
+            return 0;
         }
-        token = strtok(NULL, "/");
+        entry = dirp->entryList[1];
+        releaseDir(dirp);
     }
-    return getDir;
 }
 
 /**
- * @brief get a directory reference based on the entry
+ * @brief count the usage of a directory made before it was kept, every
+ * directory under it that is not counted yet is counted and written
+ * on the way, the directory itself is left for the caller to write
  * 
- * @param entry the entry we want to get reference as a directory
- * @return a directory pointer, NULL for fail
+ * @param dirp the directory
+ * @return 0 for success, -1 for fail
  */
-fdDir *getDirByEntry(struct fs_diriteminfo *entry)
+static int countTreeUsage(fdDir *dirp)
 {
-    if (entry->fileType != TYPE_DIR)
+    uint64_t bytes = 0;
+    uint64_t blocks = getBlockCount(DIR_EXTENT_SIZE);
+
+    // . links to this directory and .. links to the parent
+    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
     {
-        return NULL;
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space != SPACE_USED)
+        {
+            continue;
+        }
+        if (entry->fileType != TYPE_DIR)
+        {
+            bytes += entry->size;
+            blocks += getExtentBlockCount(entry);
+            continue;
+        }
+
+        fdDir *child = getDirByEntry(entry);
+        if (child == NULL)
+        {
+            eprintf("getDirByEntry() on %s", entry->d_name);
+            return -1;
+        }
+        if (child->usedBlocks == 0 && (countTreeUsage(child) != 0 || updateDirectory(child) != 0))
+        {
+            releaseDir(child);
+            return -1;
+        }
+        bytes += child->usedBytes;
+        blocks += child->usedBlocks;
+        releaseDir(child);
     }
 
-    // preapare a buffer for reading directories using LBAread()
-    uint fdDirBlockCount = getBlockCount(sizeof(fdDir));
-    char *readBuffer = malloc(fdDirBlockCount * ourVCB->blockSize);
-    if (readBuffer == NULL)
+    dirp->usedBytes = bytes;
+    dirp->usedBlocks = blocks;
+    return 0;
+}
+
+/**
+ * @brief get the usage of a directory and everything under it, it is
+ * kept in the directory so only the path is read, a directory of an
+ * older volume is counted once by walking it
+ * 
+ * @param session the session
+ * @param path path to the directory
+ * @param buf buffer to store the usage
+ * @return 0 for success, -1 for fail
+ */
+int fs_dirusage_r(fsSession *session, const char *path, struct fs_dirusage *buf)
+{
+    currentVolume = session->volume;
+
+    // counting an older directory writes it, so it takes a transaction
+    journalBegin();
+    refreshCwd(session);
+    int retVal = -1;
+    fdDir *dirp = getDirFrom(session->cwd, path);
+    if (dirp != NULL && dirp->usedBlocks == 0)
     {
-        eprintf("malloc() on readBuffer");
-        return NULL;
+        dprintf("counting the usage of %s", path);
+        if (countTreeUsage(dirp) == 0)
+        {
+            updateDirectory(dirp);
+        }
     }
-    fdDir *retDir = malloc(sizeof(fdDir));
-    if (retDir == NULL)
+    if (dirp != NULL && dirp->usedBlocks != 0)
     {
-        eprintf("malloc() on retDir");
-        return NULL;
+        buf->du_bytes = dirp->usedBytes;
+        buf->du_blocks = dirp->usedBlocks;
+        retVal = 0;
     }
+    journalEnd();
 
-    LBAread(readBuffer, fdDirBlockCount, entry->entryStartLocation);
-    memcpy(retDir, readBuffer, sizeof(fdDir));
+    releaseDir(dirp);
+    dirp = NULL;
+    return retVal;
+}
 
-    return retDir;
+/**
+ * @brief get the usage of a directory and everything under it
+ * 
+ * @param path path to the directory
+ * @param buf buffer to store the usage
+ * @return 0 for success, -1 for fail
+ */
+int fs_dirusage(const char *path, struct fs_dirusage *buf)
+{
+    return fs_dirusage_r(fsDefaultSession, path, buf);
 }
 
 /**
- * @brief find the name of the cwd for printing
+ * @brief turn an optional feature of the volume on or off
  * 
- * @param buf a buffer to copy path
- * @param size max size of the path
- * @return a buffer pointer for success, NULL for fail
+ * @param feature one of FEATURE_* bits
+ * @param enabled 1 to turn on, 0 to turn off
+ * @return 0 for success, -1 for fail
  */
-char *fs_getcwd(char *buf, size_t size)
+int fs_setfeature(uint64_t feature, int enabled)
 {
-    // clean the buffer because it was expected malloc() only
-    strcpy(buf, "");
+    if (enabled)
+    {
+        ourVCB->featureFlags |= feature;
+    }
+    else
+    {
+        ourVCB->featureFlags &= ~feature;
+    }
+
+    dprintf("feature flags changes to %lX", ourVCB->featureFlags);
+    return updateOurVCB();
+}
 
-    // malloc() a temp buffer
-    char *tempBuffer = malloc(size);
-    if (tempBuffer == NULL)
+/**
+ * @brief round up while doing division
+ * 
+ * @param num number to be divided
+ * @param divider number to be divided by
+ * @return rounded up result
+ */
+uint getBlockCount(uint64_t num)
+{
+    int result = num / ourVCB->blockSize;
+    if (num % ourVCB->blockSize > 0)
     {
-        eprintf("malloc() on tempHolder");
-        return NULL;
+        result++;
     }
+    return result;
+}
 
-    // make a copy to loop through the directory
-    fdDir *copiedDir = malloc(sizeof(fdDir));
-    if (copiedDir == NULL)
+/**
+ * @brief create a directory in the volume
+ * 
+ * @param parent a pointer to the parent directory entry
+ * @param name name of this new directory
+ * @return pointer to created directory, NULL for fail
+ */
+fdDir *createDirectory(struct fs_diriteminfo *parent, const char *name)
+{
+    // get a new directory and clean it up
+    fdDir *newDir = allocDir();
+    if (newDir == NULL)
     {
-        eprintf("malloc() on copiedDir");
         return NULL;
     }
-    memcpy(copiedDir, fsCWD, sizeof(fdDir));
+    memset(newDir, 0, sizeof(fdDir));
 
-    // loops backward until we reach the root to get the full path
-    while (copiedDir->directoryStartLocation != ourVCB->rootDirLocation)
+    // initialize the directory and allocate the space for it
+    uint dirBlockCount = getBlockCount(DIR_EXTENT_SIZE);
+    int retVal = parent == NULL ? allocateFreespace(dirBlockCount)
+                                : allocateFreespaceNear(dirBlockCount, placementGoal(parent, TYPE_DIR, dirBlockCount));
+    if (retVal < 0)
     {
-        strcpy(tempBuffer, "/");
-        strcat(tempBuffer, copiedDir->dirName);
-        strcat(tempBuffer, buf);
-        strcpy(buf, tempBuffer);
+        eprintf("allocateFreespace()");
+        releaseDir(newDir);
+        return NULL;
+    }
+    newDir->directoryStartLocation = retVal;
+    newDir->readVersion = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+    newDir->d_reclen = DIR_EXTENT_SIZE;
+    newDir->dirEntryAmount = 2;
+    newDir->usedBlocks = dirBlockCount;
 
-        // get the parent directory pointer
-        fdDir *tempPtr = getDirByEntry(copiedDir->entryList + 1);
+    // truncate the name if it exceeds the max length
+    // make sure it only contains one less than the max for null terminator
+    strncpy(newDir->dirName, name, MAX_NAME_LENGTH - 1);
+    newDir->dirName[MAX_NAME_LENGTH - 1] = '\0';
 
-        // free the original copy of directory and assign the new one
-        free(copiedDir);
-        copiedDir = tempPtr;
-    }
+    // initialize current directory entry .
+    strcpy(newDir->entryList[0].d_name, ".");
+    newDir->entryList[0].fileType = TYPE_DIR;
+    newDir->entryList[0].space = SPACE_USED;
+    newDir->entryList[0].entryStartLocation = retVal;
+    newDir->entryList[0].d_reclen = sizeof(struct fs_diriteminfo);
+    newDir->entryList[0].size = DIR_EXTENT_SIZE;
 
-    // if nothing is inside, just use slash to represent the root directory
-    if (strcmp(buf, "") == 0)
-    {
-        strcpy(buf, "./");
+    // initialize parent directory entry ..
+    if (parent == NULL)
+    { // if parent is NULL, this is a root directory
+        memcpy(newDir->entryList + 1, newDir->entryList, sizeof(struct fs_diriteminfo));
     }
     else
-    { // if there is already string, we cat the root referece to the front
-        strcpy(tempBuffer, ".");
-        strcat(tempBuffer, buf);
-        strcpy(buf, tempBuffer);
+    { // if parent is not NULL, we copy the parent into this entry
+        memcpy(newDir->entryList + 1, parent, sizeof(struct fs_diriteminfo));
     }
 
-    // dprintf("cwd is %s", buf); // pwd command takes over its job!!!
-    free(copiedDir);
-    free(tempBuffer);
-    copiedDir = NULL;
-    tempBuffer = NULL;
-    return buf;
-}
+    // parent directory needs to be renamed to ..
+    strcpy(newDir->entryList[1].d_name, "..");
 
-/**
- * @brief read the directory entry list
- * 
- * @param dirp a pointer to that directory
- * @return a pointer to the first entry
- */
-struct fs_diriteminfo *fs_readdir(fdDir *dirp)
-{
-    for (int i = openedDirEntryIndex; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    // loop through the rest of entries to mark them as free
+    // this step can be ignored since we clean newDir above and SPACE_FREE = 0
+    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
     {
-        // find the first entry and mark the index
-        if (dirp->entryList[i].space == SPACE_USED)
-        {
-            openedDirEntryIndex = i + 1;
-            return dirp->entryList + i;
-        }
+        newDir->entryList[i].space = SPACE_FREE;
     }
 
-    // return NULL and reset if no more entries
-    return NULL;
+    return newDir;
 }
 
 /**
- * @brief clear the access and memory allocated on the directory
+ * @brief read the directory of the cwd again if any directory was written
+ * since it was read, it can be changed by another session
  * 
- * @param dirp a pointer to a directory to be closed
- * @return 0 for success
+ * @param session the session
  */
-int fs_closedir(fdDir *dirp)
+void refreshCwd(fsSession *session)
 {
-    free(dirp);
-    openedDir = NULL;
-    openedDirEntryIndex = 0;
-    return 0;
+    uint64_t version = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+    if (session->cwdVersion == version)
+    {
+        return;
+    }
+
+    // . points to the directory itself, the defragmenter can have moved it
+    struct fs_diriteminfo dotEntry = session->cwd->entryList[0];
+    followDirectoryMoves(&dotEntry, session->cwd->readVersion);
+    fdDir *fresh = getDirByEntry(&dotEntry);
+    if (fresh == NULL || fresh->directoryStartLocation != dotEntry.entryStartLocation)
+    { // removed by another session, go back to the root
+        releaseDir(fresh);
+        fresh = getRootDir();
+    }
+    if (fresh == NULL)
+    {
+        eprintf("getRootDir() failed");
+        return;
+    }
+
+    releaseDir(session->cwd);
+    session->cwd = fresh;
+    session->cwdVersion = version;
 }
 
 /**
- * @brief load up the status of file on opened directory
+ * @brief make sure the cached cwd path can hold the length
  * 
- * @param path the path to a file or directory
- * @param buf buffer to store the status
+ * @param session the session
+ * @param length amount of characters without the terminator
  * @return 0 for success, -1 for fail
  */
-int fs_stat(const char *path, struct fs_stat *buf)
+int reserveCwdPath(fsSession *session, size_t length)
 {
-    // should not fail because it is using with a existed directory
-    for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    if (length + 1 <= session->cwdPathCapacity)
     {
-        if (openedDir->entryList[i].space == SPACE_USED &&
-            strcmp(openedDir->entryList[i].d_name, path) == 0)
-        {
-            buf->st_blksize = ourVCB->blockSize;
-            buf->st_size = openedDir->entryList[i].size;
-            buf->st_blocks = getBlockCount(buf->st_size);
-            // todo for time managements
-            return 0;
-        }
+        return 0;
     }
 
-    // not found, but should not happen
-    return -1;
+    // grow by doubling, so going deeper one level at a time stays linear
+    size_t capacity = session->cwdPathCapacity == 0 ? 64 : session->cwdPathCapacity;
+    while (capacity < length + 1)
+    {
+        capacity *= 2;
+    }
+    char *cwdPath = fsRealloc(session->cwdPath, capacity);
+    if (cwdPath == NULL)
+    {
+        eprintf("realloc() on cwdPath");
+        return -1;
+    }
+    session->cwdPath = cwdPath;
+    session->cwdPathCapacity = capacity;
+    return 0;
 }
 
 /**
- * @brief set current cwd
+ * @brief apply the components of a path given to fs_setcwd() to the
+ * cached cwd path, the path was already resolved so each one exists
  * 
- * @param buf path to the directory
- * @return 0 for success, -1 for fail
+ * @param session the session, cwdPath is the path of the old cwd
+ * @param path the path from the old cwd to the new one
+ * @return 0 for success, -1 if the cache can't be kept
  */
-int fs_setcwd(char *buf)
+int updateCwdPath(fsSession *session, const char *path)
 {
-    // get the toGo directory
-    fdDir *toGo = getDirByPath(buf);
-    if (toGo == NULL)
+    size_t tokenStart = 0;
+    size_t length = strlen(path);
+    while (tokenStart < length)
     {
-        return -1;
-    }
+        size_t tokenLength = 0;
+        while (tokenStart + tokenLength < length && path[tokenStart + tokenLength] != '/')
+        {
+            tokenLength++;
+        }
+        const char *token = path + tokenStart;
+        tokenStart += tokenLength + 1;
+
+        if (tokenLength == 0 || (tokenLength == 1 && token[0] == '.'))
+        { // the same directory
+            continue;
+        }
 
-    dprintf("previous fsCWD: %s", fsCWD->dirName);
+        if (tokenLength == 2 && token[0] == '.' && token[1] == '.')
+        { // cut the last name, the .. of the root is the root itself
+            char *lastSlash = strrchr(session->cwdPath, '/');
+            session->cwdPathLength = lastSlash - session->cwdPath;
 
-    // free the original directory in memory and set it to toGo
-    free(fsCWD);
-    fsCWD = toGo;
+            // "./a" goes back to "./"
+            if (session->cwdPathLength < 2)
+            {
+                session->cwdPathLength = 2;
+            }
+            session->cwdPath[session->cwdPathLength] = '\0';
+            continue;
+        }
 
-    dprintf("current fsCWD: %s\n", fsCWD->dirName);
+        // "./" of the root already ends with a slash
+        int atRoot = session->cwdPathLength == 2;
+        if (reserveCwdPath(session, session->cwdPathLength + tokenLength + 1) != 0)
+        {
+            return -1;
+        }
+        if (!atRoot)
+        {
+            session->cwdPath[session->cwdPathLength] = '/';
+            session->cwdPathLength++;
+        }
+        memcpy(session->cwdPath + session->cwdPathLength, token, tokenLength);
+        session->cwdPathLength += tokenLength;
+        session->cwdPath[session->cwdPathLength] = '\0';
+    }
     return 0;
 }
 
 /**
- * @brief get the path before the last slash
+ * @brief open a session with the root directory as its cwd
  * 
- * @param name a copy of path (will be turned into the new path)
- * @return a char* of the left path, NULL for fail
+ * @param volume the mounted volume the session works in
+ * @return a session, NULL for fail
  */
-char *getPathByLastSlash(char *path)
+fsSession *fs_opensession(fsVolume *volume)
 {
-    char *lastSlash = strrchr(path, '/');
-    int cutIndex = lastSlash - path;
-    if (lastSlash == NULL)
-    {
-        cutIndex = 0;
-    }
+    currentVolume = volume;
 
-    ldprintf("cutIndex: %d", cutIndex);
-
-    // prepare the new pointer to replace and return
-    char *pathBeforeLastSlash = malloc(cutIndex + 1);
-    if (pathBeforeLastSlash == NULL)
+    fsSession *session = fsMalloc(sizeof(fsSession));
+    if (session == NULL)
     {
-        eprintf("malloc() on pathBeforeLastSlash");
+        eprintf("malloc() on session");
         return NULL;
     }
-    char *leftPath = malloc(strlen(path) - cutIndex);
-    if (pathBeforeLastSlash == NULL)
+
+    session->volume = volume;
+    session->cwdVersion = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+    session->cwd = getRootDir();
+    session->lastOpened = NULL;
+    session->cwdPath = NULL;
+    session->cwdPathLength = 0;
+    session->cwdPathCapacity = 0;
+    session->cwdPathVersion = CWD_PATH_UNKNOWN;
+    if (session->cwd == NULL)
     {
-        eprintf("malloc() on leftPath");
+        eprintf("getRootDir() failed");
+        free(session);
         return NULL;
     }
 
-    if (lastSlash == NULL)
+    // the path of the root is known without reading anything
+    if (reserveCwdPath(session, 2) == 0)
     {
-        strcpy(pathBeforeLastSlash, ".");
-        strcpy(leftPath, path);
+        strcpy(session->cwdPath, "./");
+        session->cwdPathLength = 2;
+        session->cwdPathVersion = __atomic_load_n(&nameVersion, __ATOMIC_ACQUIRE);
     }
-    else
-    {
-        strncpy(pathBeforeLastSlash, path, cutIndex);
-        pathBeforeLastSlash[cutIndex] = '\0';
-        strcpy(leftPath, lastSlash + 1);
-    }
-
-    // place back the path into original path buffer
-    strcpy(path, pathBeforeLastSlash);
-
-    ldprintf("path before last slash is %s", path);
-    ldprintf("the left path is %s\n", leftPath);
-
-    return leftPath;
+    return session;
 }
 
 /**
- * @brief make a directory in the volume based on cwd
+ * @brief close a session, the directories it opened must be closed by the caller
  * 
- * @param pathname path to the new directory
- * @param mode haven't used...
- * @return 0 for success, -1 for fail
+ * @param session the session
  */
-int fs_mkdir(const char *pathname, mode_t mode)
+void fs_closesession(fsSession *session)
 {
-    // make a copy and use that for substring
-    char *pathBeforeLastSlash = malloc(strlen(pathname) + 1);
-    if (pathBeforeLastSlash == NULL)
+    if (session == NULL)
     {
-        eprintf("malloc() on pathBeforeLastSlash");
-        return -1;
+        return;
     }
-    strcpy(pathBeforeLastSlash, pathname);
+    releaseDir(session->cwd);
+    free(session->cwdPath);
+    session->cwd = NULL;
+    session->cwdPath = NULL;
+    free(session);
+}
 
-    // substring and get the left path as new directory name
-    char *newDirName = getPathByLastSlash(pathBeforeLastSlash);
-    if (newDirName == NULL)
-    {
-        eprintf("getPathByLastSlash() failed");
-        return -1;
-    }
-    else if (strcmp(newDirName, "") == 0)
-    {
+/**
+ * @brief check if the path points to a file
+ * 
+ * @param start directory the path starts from
+ * @param path path to check
+ * @return 1 for true, 0 for false, -1 for error
+ */
+int isFileFrom(fdDir *start, char *path)
+{
+    // split the path before the last slash in place
+    size_t parentLength;
+    const char *filename = getNameByLastSlash(path, &parentLength);
+
+    // find the directory that is expected for holding that file
+    fdDir *retPtr = getDirFromN(start, path, parentLength);
+
+    int result = 0;
+
+    // if the path is not even in a directory, then we don't need to check anymore
+    if (retPtr != NULL)
+    {
+        // check if the item is inside this directory and is a file
+        int i = findEntry(retPtr, filename, strlen(filename));
+        result = i >= 0 && retPtr->entryList[i].fileType == TYPE_FILE;
+    }
+
+    releaseDir(retPtr);
+    retPtr = NULL;
+
+    return result;
+}
+
+/**
+ * @brief check if the path points to a file
+ * 
+ * @param session the session
+ * @param path path to check
+ * @return 1 for true, 0 for false, -1 for error
+ */
+int fs_isFile_r(fsSession *session, char *path)
+{
+    // paths of a session are looked up in its volume
+    currentVolume = session->volume;
+
+    refreshCwd(session);
+    return isFileFrom(session->cwd, path);
+}
+
+/**
+ * @brief check if the path points to a file, paths start from
+ * the directory opened last if a directory is open
+ * 
+ * @param path path to check
+ * @return 1 for true, 0 for false, -1 for error
+ */
+int fs_isFile(char *path)
+{
+    currentVolume = defaultVolume;
+
+    if (fsDefaultSession->lastOpened != NULL)
+    {
+        return isFileFrom(fsDefaultSession->lastOpened, path);
+    }
+    return fs_isFile_r(fsDefaultSession, path);
+}
+
+/**
+ * @brief check if the path points to a directory
+ * 
+ * @param start directory the path starts from
+ * @param path path to check
+ * @return 1 for true, 0 for false
+ */
+int isDirFrom(fdDir *start, char *path)
+{
+    // getDirFrom() already checks TYPE_DIR while running
+    fdDir *retPtr = getDirFrom(start, path);
+    int result = retPtr != NULL;
+    releaseDir(retPtr);
+    return result;
+}
+
+/**
+ * @brief check if the path points to a directory
+ * 
+ * @param session the session
+ * @param path path to check
+ * @return 1 for true, 0 for false
+ */
+int fs_isDir_r(fsSession *session, char *path)
+{
+    currentVolume = session->volume;
+
+    refreshCwd(session);
+    return isDirFrom(session->cwd, path);
+}
+
+/**
+ * @brief check if the path points to a directory, paths start from
+ * the directory opened last if a directory is open
+ * 
+ * @param path path to check
+ * @return 1 for true, 0 for false
+ */
+int fs_isDir(char *path)
+{
+    currentVolume = defaultVolume;
+
+    if (fsDefaultSession->lastOpened != NULL)
+    {
+        return isDirFrom(fsDefaultSession->lastOpened, path);
+    }
+    return fs_isDir_r(fsDefaultSession, path);
+}
+
+/**
+ * @brief open the directory based on the path from cwd,
+ * each opened directory keeps its own position for fs_readdir()
+ * 
+ * @param session the session
+ * @param name the absolute path
+ * @return a fdDir pointer of that directory, NULL for not found or fail
+ */
+fdDir *fs_opendir_r(fsSession *session, const char *name)
+{
+    currentVolume = session->volume;
+
+    // the name is only read, it is not copied
+    fdDir *dirp = getDirByPath(session, name);
+
+    // set the entry index to 0 for fs_readDir() works
+    if (dirp != NULL)
+    {
+        dirp->dirEntryPosition = 0;
+    }
+    return dirp;
+}
+
+/**
+ * @brief open the directory based on the path from cwd
+ * 
+ * @param name the absolute path
+ * @return a fdDir pointer of that directory, NULL for not found or fail
+ */
+fdDir *fs_opendir(const char *name)
+{
+    fdDir *dirp = fs_opendir_r(fsDefaultSession, name);
+    fsDefaultSession->lastOpened = dirp;
+    return dirp;
+}
+
+/**
+ * @brief read the root directory
+ * 
+ * @return a directory pointer, NULL for fail
+ */
+fdDir *getRootDir()
+{
+    struct fs_diriteminfo rootEntry;
+    memset(&rootEntry, 0, sizeof(rootEntry));
+    rootEntry.fileType = TYPE_DIR;
+    rootEntry.entryStartLocation = ourVCB->rootDirLocation;
+    return getDirByEntry(&rootEntry);
+}
+
+/**
+ * @brief get a directory pointer from the cwd of a session
+ * 
+ * @param session the session
+ * @param name name of the path
+ * @return direcotry pointer, NULL for error or not found
+ */
+fdDir *getDirByPath(fsSession *session, const char *name)
+{
+    refreshCwd(session);
+    return getDirFromN(session->cwd, name, strlen(name));
+}
+
+/**
+ * @brief get a directory pointer from a directory
+ * 
+ * @param start directory the path starts from
+ * @param name name of the path
+ * @return direcotry pointer, NULL for error or not found
+ */
+fdDir *getDirFrom(fdDir *start, const char *name)
+{
+    return getDirFromN(start, name, strlen(name));
+}
+
+/**
+ * @brief get a directory pointer from a directory, the path is only
+ * read in place so it can be a part of a longer string
+ * 
+ * @param start directory the path starts from
+ * @param name name of the path, not modified
+ * @param length amount of bytes of name that belong to the path
+ * @return direcotry pointer, NULL for error or not found
+ */
+fdDir *getDirFromN(fdDir *start, const char *name, size_t length)
+{
+    fdDir *getDir = allocDir();
+    if (getDir == NULL)
+    {
+        return NULL;
+    }
+
+    // copy the directory the path starts from
+    memcpy(getDir, start, sizeof(fdDir));
+
+    // loop through each component between the slashes to find the directory
+    size_t tokenStart = 0;
+    while (tokenStart < length && getDir != NULL)
+    {
+        size_t tokenLength = 0;
+        while (tokenStart + tokenLength < length && name[tokenStart + tokenLength] != '/')
+        {
+            tokenLength++;
+        }
+        const char *token = name + tokenStart;
+        tokenStart += tokenLength + 1;
+
+        // if token is . or empty, it means current directory
+        if (tokenLength == 0 || (tokenLength == 1 && token[0] == '.'))
+        {
+            continue;
+        }
+
+        // find the entry of the token, it must be a directory
+        int i = findEntry(getDir, token, tokenLength);
+        if (i >= 0 && getDir->entryList[i].fileType == TYPE_DIR)
+        {
+            // the copy the path starts from can be older than a move
+            followDirectoryMoves(getDir->entryList + i, getDir->readVersion);
+            fdDir *nextDir = getDirByEntry(getDir->entryList + i);
+            releaseDir(getDir);
+            getDir = nextDir;
+        }
+        else
+        { // notice this is an exepected error!!!
+            releaseDir(getDir);
+            getDir = NULL;
+        }
+    }
+    return getDir;
+}
+
+// directories freed by releaseDir() are kept here for the next allocDir()
+// of the same thread, so walking a path doesn't call malloc() at all
+static __thread fdDir *dirPool[DIR_POOL_SIZE];
+static __thread int dirPoolCount = 0;
+static pthread_key_t dirPoolKey;
+static pthread_once_t dirPoolOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief free the directories kept by a thread when it exits
+ */
+static void freeDirPool(void *unused)
+{
+    while (dirPoolCount > 0)
+    {
+        dirPoolCount--;
+        free(dirPool[dirPoolCount]);
+        dirPool[dirPoolCount] = NULL;
+    }
+}
+
+/**
+ * @brief create the key that runs freeDirPool() at thread exit
+ */
+static void createDirPoolKey()
+{
+    pthread_key_create(&dirPoolKey, freeDirPool);
+}
+
+/**
+ * @brief get a directory buffer of DIR_BUFFER_SIZE bytes, reused if the
+ * thread released one before, every fdDir must come from here
+ * 
+ * @return a directory pointer, NULL for fail
+ */
+fdDir *allocDir()
+{
+    if (dirPoolCount > 0)
+    {
+        dirPoolCount--;
+        return dirPool[dirPoolCount];
+    }
+
+    fdDir *dirp = fsMalloc(DIR_BUFFER_SIZE);
+    if (dirp == NULL)
+    {
+        eprintf("malloc() on dirp");
+    }
+    return dirp;
+}
+
+/**
+ * @brief give a directory back for reuse, free() works on it as well
+ * 
+ * @param dirp a directory from allocDir(), NULL is ignored
+ */
+void releaseDir(fdDir *dirp)
+{
+    if (dirp == NULL)
+    {
+        return;
+    }
+    if (dirPoolCount == DIR_POOL_SIZE)
+    {
+        free(dirp);
+        return;
+    }
+
+    // the first release of a thread sets up the clean up at its exit
+    pthread_once(&dirPoolOnce, createDirPoolKey);
+    if (dirPoolCount == 0 && pthread_getspecific(dirPoolKey) == NULL)
+    {
+        pthread_setspecific(dirPoolKey, dirPool);
+    }
+    dirPool[dirPoolCount] = dirp;
+    dirPoolCount++;
+}
+
+/**
+ * @brief get a directory reference based on the entry
+ * 
+ * @param entry the entry we want to get reference as a directory
+ * @return a directory pointer, NULL for fail
+ */
+fdDir *getDirByEntry(struct fs_diriteminfo *entry)
+{
+    if (entry->fileType != TYPE_DIR)
+    {
+        return NULL;
+    }
+
+    fdDir *retDir = allocDir();
+    if (retDir == NULL)
+    {
+        return NULL;
+    }
+    uint64_t version = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+
+    // the directory can be already read in the background at mount
+    prefetchNoteAccess(entry->entryStartLocation);
+    if (prefetchLookup(entry->entryStartLocation, retDir))
+    {
+        applyInodes(retDir);
+        retDir->readVersion = version;
+        return retDir;
+    }
+
+    // preapare a buffer for reading directories using LBAread(),
+    // one from the pool when the whole extent fits in it
+    uint fdDirBlockCount = getBlockCount(DIR_EXTENT_SIZE);
+    int pooled = fdDirBlockCount * ourVCB->blockSize <= DIR_BUFFER_SIZE;
+    char *readBuffer = pooled ? (char *)allocDir() : fsMalloc(fdDirBlockCount * ourVCB->blockSize);
+    if (readBuffer == NULL)
+    {
+        eprintf("malloc() on readBuffer");
+        releaseDir(retDir);
+        return NULL;
+    }
+
+    // a packed directory usually fits in its first block,
+    // the rest of the extent is only read when the header asks for it
+    journalLBAread(readBuffer, 1, entry->entryStartLocation);
+    uint readBlockCount = fdDirBlockCount;
+    packedDirHeader *header = (packedDirHeader *)readBuffer;
+    if (header->magicNumber == DIR_MAGIC && getBlockCount(header->packedLength) <= fdDirBlockCount)
+    {
+        readBlockCount = getBlockCount(header->packedLength);
+    }
+    if (readBlockCount > 1)
+    {
+        journalLBAread(readBuffer + ourVCB->blockSize, readBlockCount - 1, entry->entryStartLocation + 1);
+    }
+
+    if (unpackDirectory(readBuffer, readBlockCount * ourVCB->blockSize, retDir) != 0)
+    {
+        eprintf("directory at %ld is damaged", entry->entryStartLocation);
+        releaseDir(retDir);
+        retDir = NULL;
+    }
+    else
+    {
+        applyInodes(retDir);
+        retDir->readVersion = version;
+    }
+
+    if (pooled)
+    {
+        releaseDir((fdDir *)readBuffer);
+    }
+    else
+    {
+        free(readBuffer);
+    }
+    readBuffer = NULL;
+    return retDir;
+}
+
+/**
+ * @brief find the name of the cwd by reading each directory up to the root
+ * 
+ * @param session the session
+ * @param buf a buffer to copy path
+ * @param size max size of the path
+ * @return a buffer pointer for success, NULL for fail
+ */
+char *buildCwdPath(fsSession *session, char *buf, size_t size)
+{
+    // room for at least "./"
+    if (size < 3)
+    {
+        return NULL;
+    }
+
+    // the names are written from the end of buf towards its start,
+    // so each level costs one copy of its name and no buffer
+    size_t start = size - 1;
+    buf[start] = '\0';
+
+    // make a copy to loop through the directory
+    fdDir *copiedDir = allocDir();
+    if (copiedDir == NULL)
+    {
+        return NULL;
+    }
+    refreshCwd(session);
+    memcpy(copiedDir, session->cwd, sizeof(fdDir));
+
+    // loops backward until we reach the root to get the full path
+    while (copiedDir != NULL && copiedDir->directoryStartLocation != ourVCB->rootDirLocation)
+    {
+        // keep one byte for the . of the root
+        size_t nameLength = strlen(copiedDir->dirName);
+        if (nameLength + 2 > start)
+        {
+            printf("cwd is longer than %ld bytes\n", size);
+            releaseDir(copiedDir);
+            return NULL;
+        }
+        start -= nameLength;
+        memcpy(buf + start, copiedDir->dirName, nameLength);
+        start--;
+        buf[start] = '/';
+
+        // get the parent directory pointer
+        followDirectoryMoves(copiedDir->entryList + 1, copiedDir->readVersion);
+        fdDir *tempPtr = getDirByEntry(copiedDir->entryList + 1);
+
+        // free the original copy of directory and assign the new one
+        releaseDir(copiedDir);
+        copiedDir = tempPtr;
+    }
+    releaseDir(copiedDir);
+    copiedDir = NULL;
+
+    // if nothing is inside, just use slash to represent the root directory
+    if (buf[start] == '\0')
+    {
+        start--;
+        buf[start] = '/';
+    }
+
+    // cat the root referece to the front and move it to the start of buf
+    start--;
+    buf[start] = '.';
+    memmove(buf, buf + start, size - start);
+
+    // dprintf("cwd is %s", buf); // pwd command takes over its job!!!
+    return buf;
+}
+
+/**
+ * @brief find the name of the cwd for printing, the path kept by
+ * fs_setcwd() is copied unless a directory was renamed or removed
+ * 
+ * @param session the session
+ * @param buf a buffer to copy path
+ * @param size max size of the path
+ * @return a buffer pointer for success, NULL for fail
+ */
+char *fs_getcwd_r(fsSession *session, char *buf, size_t size)
+{
+    currentVolume = session->volume;
+
+    refreshCwd(session);
+    uint64_t version = __atomic_load_n(&nameVersion, __ATOMIC_ACQUIRE);
+    if (session->cwdPathVersion == version)
+    {
+        if (session->cwdPathLength + 1 > size)
+        {
+            printf("cwd is longer than %ld bytes\n", size);
+            return NULL;
+        }
+        memcpy(buf, session->cwdPath, session->cwdPathLength + 1);
+        return buf;
+    }
+
+    // build it again and keep it for the next calls
+    if (buildCwdPath(session, buf, size) == NULL)
+    {
+        return NULL;
+    }
+    size_t length = strlen(buf);
+    if (reserveCwdPath(session, length) == 0)
+    {
+        memcpy(session->cwdPath, buf, length + 1);
+        session->cwdPathLength = length;
+        session->cwdPathVersion = version;
+    }
+    return buf;
+}
+
+/**
+ * @brief find the name of the cwd for printing
+ * 
+ * @param buf a buffer to copy path
+ * @param size max size of the path
+ * @return a buffer pointer for success, NULL for fail
+ */
+char *fs_getcwd(char *buf, size_t size)
+{
+    return fs_getcwd_r(fsDefaultSession, buf, size);
+}
+
+/**
+ * @brief read the directory entry list
+ * 
+ * @param dirp a pointer to that directory
+ * @return a pointer to the first entry
+ */
+struct fs_diriteminfo *fs_readdir(fdDir *dirp)
+{
+    for (int i = dirp->dirEntryPosition; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    {
+        // find the first entry and mark the index
+        if (dirp->entryList[i].space == SPACE_USED)
+        {
+            dirp->dirEntryPosition = i + 1;
+            return dirp->entryList + i;
+        }
+    }
+
+    // return NULL and reset if no more entries
+    return NULL;
+}
+
+/**
+ * @brief fill the status from a directory entry
+ * 
+ * @param entry the entry of a file or directory
+ * @param buf buffer to store the status
+ */
+void fillStat(struct fs_diriteminfo *entry, struct fs_stat *buf)
+{
+    memset(buf, 0, sizeof(struct fs_stat));
+    buf->st_blksize = ourVCB->blockSize;
+    buf->st_size = entry->size;
+    buf->st_blocks = getExtentBlockCount(entry);
+
+    // the inode is newer than a directory copied some time ago
+    inode *node = getInode(entry->inodeNumber);
+    if (node != NULL)
+    {
+        buf->st_size = node->size;
+        buf->st_accesstime = node->accessTime;
+        buf->st_modtime = node->modifyTime;
+        buf->st_createtime = node->createTime;
+    }
+}
+
+/**
+ * @brief read many entries of the directory with their status at once,
+ * everything is taken from the entry list that is already in memory
+ * 
+ * @param session the session, it gives the volume of the directory
+ * @param dirp a pointer to that directory
+ * @param buf array to store the entries
+ * @param n capacity of buf
+ * @return amount of entries stored, 0 when there are no more entries
+ */
+int fs_readdir_plus_r(fsSession *session, fdDir *dirp, struct fs_direntplus *buf, int n)
+{
+    currentVolume = session->volume;
+
+    int count = 0;
+    int i = dirp->dirEntryPosition;
+    for (; i < MAX_AMOUNT_OF_ENTRIES && count < n; i++)
+    {
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space != SPACE_USED)
+        {
+            continue;
+        }
+
+        buf[count].fileType = entry->fileType;
+        strcpy(buf[count].d_name, entry->d_name);
+        fillStat(entry, &buf[count].st);
+        count++;
+    }
+
+    // the next call continues after the last stored entry
+    dirp->dirEntryPosition = i;
+    return count;
+}
+
+/**
+ * @brief read many entries of the directory with their status at once
+ * 
+ * @param dirp a pointer to that directory
+ * @param buf array to store the entries
+ * @param n capacity of buf
+ * @return amount of entries stored, 0 when there are no more entries
+ */
+int fs_readdir_plus(fdDir *dirp, struct fs_direntplus *buf, int n)
+{
+    return fs_readdir_plus_r(fsDefaultSession, dirp, buf, n);
+}
+
+/**
+ * @brief clear the access and memory allocated on the directory
+ * 
+ * @param dirp a pointer to a directory to be closed
+ * @return 0 for success
+ */
+int fs_closedir(fdDir *dirp)
+{
+    if (defaultVolume != NULL && fsDefaultSession->lastOpened == dirp)
+    {
+        fsDefaultSession->lastOpened = NULL;
+    }
+    releaseDir(dirp);
+    return 0;
+}
+
+/**
+ * @brief load up the status of a file or directory
+ * 
+ * @param start directory the path starts from
+ * @param path the path to a file or directory
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
+ */
+int statFrom(fdDir *start, const char *path, struct fs_stat *buf)
+{
+    size_t parentLength;
+    const char *name = getNameByLastSlash(path, &parentLength);
+    fdDir *parent = getDirFromN(start, path, parentLength);
+
+    int retVal = -1;
+    int i = parent != NULL ? findEntry(parent, name, strlen(name)) : -1;
+    if (i >= 0)
+    {
+        fillStat(parent->entryList + i, buf);
+        retVal = 0;
+    }
+
+    releaseDir(parent);
+    parent = NULL;
+    return retVal;
+}
+
+/**
+ * @brief load up the status of a file or directory from cwd
+ * 
+ * @param session the session
+ * @param path the path to a file or directory
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
+ */
+int fs_stat_r(fsSession *session, const char *path, struct fs_stat *buf)
+{
+    currentVolume = session->volume;
+
+    refreshCwd(session);
+    return statFrom(session->cwd, path, buf);
+}
+
+/**
+ * @brief load up the status of file on opened directory
+ * 
+ * @param path the path to a file or directory
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
+ */
+int fs_stat(const char *path, struct fs_stat *buf)
+{
+    currentVolume = defaultVolume;
+
+    if (fsDefaultSession->lastOpened != NULL)
+    {
+        return statFrom(fsDefaultSession->lastOpened, path, buf);
+    }
+    return fs_stat_r(fsDefaultSession, path, buf);
+}
+
+/**
+ * @brief resolve a path once, the handle keeps the directory holding
+ * the entry so the calls taking it don't read the path again
+ * 
+ * @param session the session
+ * @param path the path to a file or directory
+ * @return a handle with one reference, NULL for not found or fail
+ */
+fsEntry *fs_lookup_r(fsSession *session, const char *path)
+{
+    currentVolume = session->volume;
+
+    size_t parentLength;
+    const char *name = getNameByLastSlash(path, &parentLength);
+    refreshCwd(session);
+    fdDir *parent = getDirFromN(session->cwd, path, parentLength);
+
+    // an empty name is the directory itself
+    const char *target = strcmp(name, "") == 0 ? "." : name;
+    fsEntry *handle = NULL;
+    int i = parent != NULL ? findEntry(parent, target, strlen(target)) : -1;
+    if (i >= 0)
+    {
+        handle = fsMalloc(sizeof(fsEntry));
+        if (handle == NULL)
+        {
+            eprintf("malloc() on handle");
+        }
+        else
+        {
+            handle->volume = session->volume;
+            handle->parent = parent;
+            handle->entry = parent->entryList + i;
+            handle->refCount = 1;
+            parent = NULL; // owned by the handle now
+        }
+    }
+
+    releaseDir(parent);
+    parent = NULL;
+    return handle;
+}
+
+/**
+ * @brief resolve a path once from cwd
+ * 
+ * @param path the path to a file or directory
+ * @return a handle with one reference, NULL for not found or fail
+ */
+fsEntry *fs_lookup(const char *path)
+{
+    return fs_lookup_r(fsDefaultSession, path);
+}
+
+/**
+ * @brief add one reference to a handle
+ * 
+ * @param handle the handle
+ * @return the same handle
+ */
+fsEntry *fs_holdentry(fsEntry *handle)
+{
+    __atomic_add_fetch(&handle->refCount, 1, __ATOMIC_RELAXED);
+    return handle;
+}
+
+/**
+ * @brief remove one reference of a handle, the last one frees it
+ * 
+ * @param handle the handle, NULL is ignored
+ */
+void fs_releaseentry(fsEntry *handle)
+{
+    if (handle == NULL)
+    {
+        return;
+    }
+    if (__atomic_sub_fetch(&handle->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        releaseDir(handle->parent);
+        free(handle);
+    }
+}
+
+/**
+ * @brief check the type of a resolved entry
+ * 
+ * @param handle the handle
+ * @return 1 if file, 0 otherwise
+ */
+int fs_isFileEntry(fsEntry *handle)
+{
+    return handle->entry->fileType == TYPE_FILE;
+}
+
+/**
+ * @brief check the type of a resolved entry
+ * 
+ * @param handle the handle
+ * @return 1 if directory, 0 otherwise
+ */
+int fs_isDirEntry(fsEntry *handle)
+{
+    return handle->entry->fileType == TYPE_DIR;
+}
+
+/**
+ * @brief load up the status of a resolved entry
+ * 
+ * @param handle the handle
+ * @param buf buffer to store the status
+ * @return 0 for success
+ */
+int fs_statEntry(fsEntry *handle, struct fs_stat *buf)
+{
+    currentVolume = handle->volume;
+
+    fillStat(handle->entry, buf);
+    return 0;
+}
+
+/**
+ * @brief set current cwd
+ * 
+ * @param session the session
+ * @param buf path to the directory
+ * @return 0 for success, -1 for fail
+ */
+int fs_setcwd_r(fsSession *session, char *buf)
+{
+    currentVolume = session->volume;
+
+    // the cached path is only updated if no directory was renamed or removed meanwhile
+    uint64_t version = __atomic_load_n(&nameVersion, __ATOMIC_ACQUIRE);
+
+    // get the toGo directory
+    fdDir *toGo = getDirByPath(session, buf);
+    if (toGo == NULL)
+    {
+        return -1;
+    }
+
+    if (session->cwdPathVersion != version ||
+        __atomic_load_n(&nameVersion, __ATOMIC_ACQUIRE) != version ||
+        updateCwdPath(session, buf) != 0)
+    {
+        session->cwdPathVersion = CWD_PATH_UNKNOWN;
+    }
+
+    dprintf("previous cwd: %s", session->cwd->dirName);
+
+    // free the original directory in memory and set it to toGo
+    releaseDir(session->cwd);
+    session->cwd = toGo;
+
+    dprintf("current cwd: %s\n", session->cwd->dirName);
+    return 0;
+}
+
+/**
+ * @brief set current cwd
+ * 
+ * @param buf path to the directory
+ * @return 0 for success, -1 for fail
+ */
+int fs_setcwd(char *buf)
+{
+    return fs_setcwd_r(fsDefaultSession, buf);
+}
+
+/**
+ * @brief split the path at the last slash without copying it,
+ * the first parentLength bytes of path are the directory part
+ * 
+ * @param path the path, not modified
+ * @param parentLength set to the length of the part before the last slash
+ * @return the name after the last slash, inside path
+ */
+const char *getNameByLastSlash(const char *path, size_t *parentLength)
+{
+    const char *lastSlash = strrchr(path, '/');
+    if (lastSlash == NULL)
+    { // the name is in the cwd
+        *parentLength = 0;
+        return path;
+    }
+    *parentLength = lastSlash - path;
+    return lastSlash + 1;
+}
+
+/**
+ * @brief get the path before the last slash
+ * 
+ * @param name a copy of path (will be turned into the new path)
+ * @return a char* of the left path, NULL for fail
+ */
+char *getPathByLastSlash(char *path)
+{
+    size_t cutIndex;
+    const char *name = getNameByLastSlash(path, &cutIndex);
+
+    ldprintf("cutIndex: %ld", cutIndex);
+
+    // prepare the new pointer to return
+    char *leftPath = fsMalloc(strlen(name) + 1);
+    if (leftPath == NULL)
+    {
+        eprintf("malloc() on leftPath");
+        return NULL;
+    }
+    strcpy(leftPath, name);
+
+    // cut the original path buffer at the last slash
+    // an empty path is the cwd, so a name without slash leaves ""
+    path[cutIndex] = '\0';
+
+    ldprintf("path before last slash is %s", path);
+    ldprintf("the left path is %s\n", leftPath);
+
+    return leftPath;
+}
+
+/**
+ * @brief make a directory in the volume based on cwd
+ * 
+ * @param session the session
+ * @param pathname path to the new directory
+ * @param mode haven't used...
+ * @return 0 for success, -1 for fail
+ */
+int fs_mkdir_r(fsSession *session, const char *pathname, mode_t mode)
+{
+    currentVolume = session->volume;
+
+    // every metadata block written by this call goes into one transaction
+    journalBegin();
+    refreshCwd(session);
+    int retVal = mkdirByPath(session->cwd, pathname, mode);
+    journalEnd();
+    return retVal;
+}
+
+/**
+ * @brief make a directory in the volume based on cwd
+ * 
+ * @param pathname path to the new directory
+ * @param mode haven't used...
+ * @return 0 for success, -1 for fail
+ */
+int fs_mkdir(const char *pathname, mode_t mode)
+{
+    return fs_mkdir_r(fsDefaultSession, pathname, mode);
+}
+
+/**
+ * @brief body of fs_mkdir_r() and fs_mkdirat(), called inside a transaction
+ * 
+ * @param start directory the path starts from
+ */
+int mkdirByPath(fdDir *start, const char *pathname, mode_t mode)
+{
+    // split in place and get the left path as new directory name
+    size_t parentLength;
+    const char *newDirName = getNameByLastSlash(pathname, &parentLength);
+    if (strcmp(newDirName, "") == 0)
+    {
         printf("no directory name given\n");
         return -1;
     }
 
-    // get the directory pointer
-    fdDir *parent = getDirByPath(pathBeforeLastSlash);
-    if (parent == NULL)
+    // get the directory pointer
+    fdDir *parent = getDirFromN(start, pathname, parentLength);
+    if (parent == NULL)
+    {
+        printf("%.*s is not exisited from cwd\n", (int)parentLength, pathname);
+        return -1;
+    }
+
+    // create directory if the amount is not reaching the max
+    int retVal = 0;
+    if (parent->dirEntryAmount < MAX_AMOUNT_OF_ENTRIES)
+    {
+        // skip if it has same name with existed one
+        // NOTE: must check all, because we don't want user to create . and .. !!!
+        if (findEntry(parent, newDirName, strlen(newDirName)) >= 0)
+        {
+            printf("\nsame name of directory or file existed!\n");
+
+            // avoid memory leak
+            releaseDir(parent);
+            parent = NULL;
+            return -1;
+        }
+        
+        dprintf("creating new directory %s", newDirName);
+
+        // create the new directory
+        fdDir *createdDir = createDirectory(parent->entryList, newDirName);
+        if (createdDir == NULL)
+        {
+            releaseDir(parent);
+            return -1;
+        }
+
+        // find the first avaliable space and put the data in
+        for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+        {
+            if (parent->entryList[i].space == SPACE_FREE)
+            {
+                parent->dirEntryAmount++;
+                parent->entryList[i].d_reclen = sizeof(struct fs_diriteminfo);
+                parent->entryList[i].fileType = TYPE_DIR;
+                parent->entryList[i].entryStartLocation = createdDir->directoryStartLocation;
+                parent->entryList[i].space = SPACE_USED;
+                parent->entryList[i].attributes = 0;
+                parent->entryList[i].size = DIR_EXTENT_SIZE;
+                parent->entryList[i].inodeNumber = 0;
+                strcpy(parent->entryList[i].d_name, createdDir->dirName);
+
+                // write the two changed files back into the disk
+                updateDirectory(createdDir);
+                updateDirectory(parent);
+                addTreeUsage(parent->entryList, 0, createdDir->usedBlocks);
+                break;
+            }
+        }
+        releaseDir(createdDir);
+    }
+    else
+    {
+        printf("reaches the max of entries of a directory\n");
+        retVal = -1;
+    }
+
+    releaseDir(parent);
+    parent = NULL;
+    return retVal;
+}
+
+/**
+ * @brief remove a directory file
+ * 
+ * @param session the session
+ * @param pathname path to the director and file
+ * @return 0 for success, -1 for fail
+ */
+int fs_rmdir_r(fsSession *session, const char *pathname)
+{
+    currentVolume = session->volume;
+
+    // every metadata block written by this call goes into one transaction
+    journalBegin();
+    refreshCwd(session);
+    int retVal = rmdirByPath(session, session->cwd, pathname);
+    journalEnd();
+    return retVal;
+}
+
+/**
+ * @brief remove a directory file
+ * 
+ * @param pathname path to the director and file
+ * @return 0 for success, -1 for fail
+ */
+int fs_rmdir(const char *pathname)
+{
+    return fs_rmdir_r(fsDefaultSession, pathname);
+}
+
+/**
+ * @brief release everything inside a directory which is going to be removed,
+ * each directory in the tree is read once and the entries are never
+ * looked up by path, the removed directories themselves are not written
+ * 
+ * the blocks are only queued here in post-order, releaseQueued() frees
+ * them with one update of the bitmap and the vcb for the whole tree
+ * 
+ * @param session the session, its cwd is checked against the removed directories
+ * @param dirp the directory
+ * @param cwdRemoved set to 1 if the cwd is inside the tree
+ * @param batch collects the extents to release
+ * @return 0 for success, -1 for fail
+ */
+int removeTree(fsSession *session, fdDir *dirp, int *cwdRemoved, releaseBatch *batch)
+{
+    // . links to this directory and .. links to the parent
+    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    {
+        struct fs_diriteminfo *entry = dirp->entryList + i;
+        if (entry->space != SPACE_USED)
+        {
+            continue;
+        }
+
+        uint64_t blockCount = getExtentBlockCount(entry);
+        if (entry->fileType == TYPE_DIR)
+        {
+            fdDir *child = getDirByEntry(entry);
+            if (child == NULL)
+            {
+                eprintf("getDirByEntry() on %s", entry->d_name);
+                return -1;
+            }
+            if (child->directoryStartLocation == session->cwd->directoryStartLocation)
+            {
+                *cwdRemoved = 1;
+            }
+            int retVal = removeTree(session, child, cwdRemoved, batch);
+            blockCount = getBlockCount(child->d_reclen);
+            free(child);
+            child = NULL;
+            if (retVal != 0)
+            {
+                return -1;
+            }
+        }
+
+        if (queueRelease(batch, entry->entryStartLocation, blockCount) != 0)
+        {
+            return -1;
+        }
+        releaseInode(entry->inodeNumber);
+        ldprintf("%s was removed", entry->d_name);
+    }
+    return 0;
+}
+
+/**
+ * @brief body of fs_rmdir_r() and fs_unlinkat(), called inside a transaction
+ * 
+ * @param session the session
+ * @param start directory the path starts from
+ * @param pathname path to the directory
+ * @return 0 for success, -1 for fail
+ */
+int rmdirByPath(fsSession *session, fdDir *start, const char *pathname)
+{
+    // find the directory to delete
+    char *path = fsMalloc(strlen(pathname) + 1);
+    if (path == NULL)
+    {
+        eprintf("malloc() on path");
+        return -1;
+    }
+    strcpy(path, pathname);
+    fdDir *target = getDirFrom(start, path);
+
+    // free the unused buffer
+    free(path);
+    path = NULL;
+
+    // another session can remove it before this call takes the journal
+    if (target == NULL)
+    {
+        printf("%s is not a directory\n", pathname);
+        return -1;
+    }
+
+    // we can't remove the root directory
+    if (target->directoryStartLocation == ourVCB->rootDirLocation)
     {
-        printf("%s is not exisited from cwd\n", pathBeforeLastSlash);
+        printf("root can't be removed\n");
 
         // avoid memory leak
-        free(pathBeforeLastSlash);
-        free(newDirName);
-        pathBeforeLastSlash = NULL;
-        newDirName = NULL;
+        free(target);
+        target = NULL;
         return -1;
     }
 
-    // create directory if the amount is not reaching the max
-    int retVal = 0;
-    if (parent->dirEntryAmount < MAX_AMOUNT_OF_ENTRIES)
+    // get the parent reference to remove the directory in the parent
+    fdDir *parent = getDirByEntry(target->entryList + 1);
+    if (parent == NULL)
     {
-        // skip if it has same name with existed one
-        // NOTE: must check all, because we don't want user to create . and .. !!!
-        for (int i = 0; i < MAX_AMOUNT_OF_ENTRIES; i++)
+        eprintf("getDirByEntry() on parent");
+        free(target);
+        return -1;
+    }
+
+    // remove everything inside before the directory itself
+    int cwdRemoved = target->directoryStartLocation == session->cwd->directoryStartLocation;
+    releaseBatch batch = {0};
+    if (removeTree(session, target, &cwdRemoved, &batch) != 0 ||
+        queueRelease(&batch, target->directoryStartLocation, getBlockCount(target->d_reclen)) != 0)
+    {
+        // nothing is released, leaked blocks are safer than blocks still in use
+        free(batch.runs);
+        free(target);
+        free(parent);
+        return -1;
+    }
+
+    // find the entry in the parent and set it as free
+    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    {
+        if (parent->entryList[i].space == SPACE_USED &&
+            parent->entryList[i].fileType == TYPE_DIR &&
+            parent->entryList[i].entryStartLocation == target->directoryStartLocation)
+        {
+            parent->entryList[i].space = SPACE_FREE;
+            parent->dirEntryAmount--;
+            updateDirectory(parent);
+
+            // a directory not counted yet has a parent not counted either
+            addTreeUsage(parent->entryList, -(int64_t)target->usedBytes, -(int64_t)target->usedBlocks);
+            break;
+        }
+    }
+
+    // the cached cwd path of every session inside it is wrong now
+    __atomic_add_fetch(&nameVersion, 1, __ATOMIC_RELEASE);
+
+    // release the blocks of the whole tree and the directory itself
+    if (releaseQueued(&batch) != 0)
+    {
+        eprintf("releaseQueued() falied");
+        free(target);
+        free(parent);
+        return -1;
+    }
+
+    // redirect cwd to the parent if the directory or one inside it was removed
+    if (cwdRemoved)
+    {
+        printf("\n*** cwd is being removed, redirect to parent ***\n");
+        releaseDir(session->cwd);
+        session->cwd = parent;
+        session->cwdVersion = __atomic_load_n(&dirVersion, __ATOMIC_ACQUIRE);
+        parent = NULL;
+    }
+
+    printf("\n%s : %s was removed\n", pathname, target->dirName);
+
+    free(target);
+    free(parent);
+    target = NULL;
+    parent = NULL;
+
+    return 0;
+}
+
+/**
+ * @brief set the bits of the blocks free, without writing anything
+ * 
+ * @param start the starting index
+ * @param count amount of blocks
+ * @return 0 for success, -1 for fail, -2 for invalid arg
+ */
+static int freeBlockBits(uint64_t start, uint64_t count)
+{
+    // handle error of invalid count, generally not goint to happen
+    if (start < (ourVCB->freespaceBlockCount + ourVCB->vcbBlockCount) || count < 1 || start + count > ourVCB->numberOfBlocks)
+    {
+        eprintf("invalid arg");
+        return -2;
+    }
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        // handle error when setBitFree get in errors
+        if (setBitFree(start + i) != 0)
         {
-            if (parent->entryList[i].space == SPACE_USED &&
-                strcmp(parent->entryList[i].d_name, newDirName) == 0)
+            // this won't run if checkBit() works as expected
+            eprintf("setBitFree() failed, bit at %ld", start + i);
+
+            // we should mark those back in order to recover
+            while (i > 0)
             {
-                printf("\nsame name of directory or file existed!\n");
-
-                // avoid memory leak
-                free(pathBeforeLastSlash);
-                free(newDirName);
-                free(parent);
-                pathBeforeLastSlash = NULL;
-                newDirName = NULL;
-                parent = NULL;
-                return -1;
+                i--;
+                setBitUsed(start + i);
             }
+            return -1;
         }
-        
-        dprintf("creating new directory %s", newDirName);
+    }
 
-        // create the new directory
-        fdDir *createdDir = createDirectory(parent->entryList, newDirName);
+    // the blocks must not be reused by file data before this is journaled
+    journalNoteRelease(start, count);
+    return 0;
+}
 
-        // find the first avaliable space and put the data in
-        for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+/**
+ * @brief release the blocks in the freespace bitmap
+ * 
+ * @param start the starting index
+ * @param count amount of blocks
+ * @return 0 for success, -1 for fail
+ */
+int releaseFreespace(uint64_t start, uint64_t count)
+{
+    // a shared extent is only released with its last reference
+    if (dropExtentRef(start) > 0)
+    {
+        return 0;
+    }
+
+    int retVal = freeBlockBits(start, count);
+    if (retVal != 0)
+    {
+        return retVal;
+    }
+
+    // simply compare if the freed block is before the freeblock index
+    if (start < ourVCB->firstFreeBlockIndex)
+    {
+        // set the new first free block index and update ourVCB
+        dprintf("first free block index changes to %ld\n", start);
+        ourVCB->firstFreeBlockIndex = start;
+        updateOurVCB();
+    }
+
+    // return the starting block index of this allocated space
+    updateFreespace();
+    return 0;
+}
+
+/**
+ * @brief add an extent to the blocks released by releaseQueued()
+ * 
+ * @param batch the batch
+ * @param start the starting index
+ * @param count amount of blocks
+ * @return 0 for success, -1 for fail
+ */
+static int queueRelease(releaseBatch *batch, uint64_t start, uint64_t count)
+{
+    if (batch->runCount == batch->runCapacity)
+    {
+        uint64_t newCapacity = batch->runCapacity == 0 ? 64 : batch->runCapacity * 2;
+        blockRun *newRuns = fsRealloc(batch->runs, newCapacity * sizeof(blockRun));
+        if (newRuns == NULL)
         {
-            if (parent->entryList[i].space == SPACE_FREE)
-            {
-                parent->dirEntryAmount++;
-                parent->entryList[i].d_reclen = sizeof(struct fs_diriteminfo);
-                parent->entryList[i].fileType = TYPE_DIR;
-                parent->entryList[i].entryStartLocation = createdDir->directoryStartLocation;
-                parent->entryList[i].space = SPACE_USED;
-                parent->entryList[i].size = sizeof(fdDir);
-                strcpy(parent->entryList[i].d_name, createdDir->dirName);
+            eprintf("realloc() on runs");
+            return -1;
+        }
+        batch->runs = newRuns;
+        batch->runCapacity = newCapacity;
+    }
+    batch->runs[batch->runCount].start = start;
+    batch->runs[batch->runCount].count = count;
+    batch->runCount++;
+    return 0;
+}
 
-                // write the two changed files back into the disk
-                updateDirectory(createdDir);
-                updateDirectory(parent);
-                break;
-            }
+/**
+ * @brief used to sort the queued extents by their first block
+ */
+static int compareRunStart(const void *a, const void *b)
+{
+    uint64_t startA = ((const blockRun *)a)->start;
+    uint64_t startB = ((const blockRun *)b)->start;
+    return (startA > startB) - (startA < startB);
+}
+
+/**
+ * @brief release every queued extent, then write the bitmap and
+ * the vcb once for all of them, the batch is emptied and freed
+ * 
+ * @param batch the batch
+ * @return 0 for success, -1 if any extent fails
+ */
+static int releaseQueued(releaseBatch *batch)
+{
+    int retVal = 0;
+
+    // shared extents keep their blocks until the last reference is gone
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < batch->runCount; i++)
+    {
+        if (dropExtentRef(batch->runs[i].start) == 0)
+        {
+            batch->runs[kept++] = batch->runs[i];
+        }
+    }
+
+    // extents next to each other are released as one run
+    qsort(batch->runs, kept, sizeof(blockRun), compareRunStart);
+    uint64_t i = 0;
+    while (i < kept)
+    {
+        uint64_t start = batch->runs[i].start;
+        uint64_t end = start + batch->runs[i].count;
+        for (i++; i < kept && batch->runs[i].start == end; i++)
+        {
+            end += batch->runs[i].count;
         }
+        if (freeBlockBits(start, end - start) != 0)
+        {
+            eprintf("freeBlockBits() failed on %ld", start);
+            retVal = -1;
+        }
+    }
+    ldprintf("%ld extents released", kept);
+
+    if (kept > 0 && batch->runs[0].start < ourVCB->firstFreeBlockIndex)
+    {
+        dprintf("first free block index changes to %ld\n", batch->runs[0].start);
+        ourVCB->firstFreeBlockIndex = batch->runs[0].start;
+        updateOurVCB();
+    }
+    updateFreespace();
+
+    free(batch->runs);
+    memset(batch, 0, sizeof(releaseBatch));
+    return retVal;
+}
+
+/**
+ * @brief delete a file based on the path or filename
+ * 
+ * @param session the session
+ * @param filename may hold a path or filename
+ * @return 0 for success, -1 for fail
+ */
+int fs_delete_r(fsSession *session, char *filename)
+{
+    currentVolume = session->volume;
+
+    // every metadata block written by this call goes into one transaction
+    journalBegin();
+    refreshCwd(session);
+    int retVal = deleteByPath(session->cwd, filename);
+    journalEnd();
+    return retVal;
+}
+
+/**
+ * @brief delete a file based on the path or filename
+ * 
+ * @param filename may hold a path or filename
+ * @return 0 for success, -1 for fail
+ */
+int fs_delete(char *filename)
+{
+    return fs_delete_r(fsDefaultSession, filename);
+}
+
+/**
+ * @brief body of fs_delete_r() and fs_unlinkat(), called inside a transaction
+ * 
+ * @param start directory the path starts from
+ */
+int deleteByPath(fdDir *start, const char *filename)
+{
+    size_t parentLength;
+    const char *trueFileName = getNameByLastSlash(filename, &parentLength);
+
+    // find the directory that is expected for holding that file
+    fdDir *parent = getDirFromN(start, filename, parentLength);
+
+    // find the file to delete
+    int retVal = -1;
+    int i = parent != NULL ? findEntry(parent, trueFileName, strlen(trueFileName)) : -1;
+    if (i >= 0 && parent->entryList[i].fileType == TYPE_FILE)
+    {
+        retVal = removeFileEntry(parent, i);
+    }
+
+    if (retVal == 0)
+    {
+        printf("\n%s : %s was removed\n", filename, trueFileName);
+    }
+
+    releaseDir(parent);
+    parent = NULL;
+    return retVal;
+}
+
+/**
+ * @brief remove a file entry from its directory and release its blocks
+ * 
+ * @param parent the directory holding the file, written back here
+ * @param i index of the entry in parent
+ * @return 0 for success, -1 for fail
+ */
+int removeFileEntry(fdDir *parent, int i)
+{
+    uint64_t fileStart = parent->entryList[i].entryStartLocation;
+    uint64_t blockCount = getExtentBlockCount(parent->entryList + i);
+    parent->entryList[i].space = SPACE_FREE;
+    parent->dirEntryAmount--;
+    updateDirectory(parent);
+    addTreeUsage(parent->entryList, -(int64_t)parent->entryList[i].size, -(int64_t)blockCount);
+    releaseInode(parent->entryList[i].inodeNumber);
+
+    // release the blocks occupied by the file
+    if (releaseFreespace(fileStart, blockCount) != 0)
+    {
+        eprintf("releaseFreespace() falied");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief remove a file resolved by fs_lookup(), only its directory is read
+ * 
+ * @param handle the handle of a file
+ * @return 0 for success, -1 for fail or if the entry changed since the lookup
+ */
+int fs_deleteEntry(fsEntry *handle)
+{
+    currentVolume = handle->volume;
+
+    if (handle->entry->fileType != TYPE_FILE)
+    {
+        return -1;
     }
-    else
+
+    // every metadata block written by this call goes into one transaction
+    journalBegin();
+
+    // the copy in the handle can be older than the volume, read it again inside the transaction
+    int i = handle->entry - handle->parent->entryList;
+    followDirectoryMoves(handle->parent->entryList, handle->parent->readVersion);
+    fdDir *parent = getDirByEntry(handle->parent->entryList);
+    int retVal = -1;
+    if (parent != NULL &&
+        parent->entryList[i].space == SPACE_USED &&
+        parent->entryList[i].fileType == TYPE_FILE &&
+        parent->entryList[i].entryStartLocation == handle->entry->entryStartLocation &&
+        parent->entryList[i].size == handle->entry->size &&
+        strcmp(parent->entryList[i].d_name, handle->entry->d_name) == 0)
     {
-        printf("reaches the max of entries of a directory\n");
-        retVal = -1;
+        retVal = removeFileEntry(parent, i);
+    }
+    journalEnd();
+
+    if (retVal == 0)
+    {
+        printf("\n%s was removed\n", handle->entry->d_name);
+        handle->entry->space = SPACE_FREE;
     }
 
-    free(pathBeforeLastSlash);
-    free(newDirName);
     free(parent);
-    pathBeforeLastSlash = NULL;
-    newDirName = NULL;
     parent = NULL;
     return retVal;
 }
 
 /**
- * @brief remove a directory file
+ * @brief open a directory by a path starting from an opened directory,
+ * so walking a tree doesn't resolve the same prefix again for each child
  * 
- * @param pathname path to the director and file
- * @return 0 for success, -1 for fail
+ * @param session the session, it gives the volume of the directory
+ * @param dirp the opened directory the path starts from
+ * @param name the path relative to the opened directory
+ * @return a fdDir pointer of that directory, NULL for not found or fail
  */
-int fs_rmdir(const char *pathname)
+fdDir *fs_openat(fsSession *session, fdDir *dirp, const char *name)
 {
-    // find the directory to delete
-    char *path = malloc(strlen(pathname) + 1);
-    if (path == NULL)
-    {
-        eprintf("malloc() on path");
-        return -1;
-    }
-    strcpy(path, pathname);
-    fdDir *target = getDirByPath(path);
+    currentVolume = session->volume;
 
-    // free the unused buffer
-    free(path);
-    path = NULL;
+    // the opened copy can be older than the volume, start from a fresh read of it
+    followDirectoryMoves(dirp->entryList, dirp->readVersion);
+    fdDir *start = getDirByEntry(dirp->entryList);
+    fdDir *retDir = start == NULL ? NULL : getDirFrom(start, name);
 
-    // we can't remove the root directory
-    if (target->directoryStartLocation == ourVCB->rootDirLocation)
+    // set the entry index to 0 for fs_readDir() works
+    if (retDir != NULL)
     {
-        printf("root can't be removed\n");
-
-        // avoid memory leak
-        free(target);
-        target = NULL;
-        return -1;
+        retDir->dirEntryPosition = 0;
     }
 
-    // get the parent reference to remove the directory in the parent
-    fdDir *parent = getDirByEntry(target->entryList + 1);
-    if (parent == NULL)
+    releaseDir(start);
+    start = NULL;
+    return retDir;
+}
+
+/**
+ * @brief load up the status of a file or directory from an opened directory
+ * 
+ * @param session the session, it gives the volume of the directory
+ * @param dirp the opened directory the path starts from
+ * @param name the path to a file or directory
+ * @param buf buffer to store the status
+ * @return 0 for success, -1 for fail
+ */
+int fs_statat(fsSession *session, fdDir *dirp, const char *name, struct fs_stat *buf)
+{
+    currentVolume = session->volume;
+
+    // the opened copy can be older than the volume, start from a fresh read of it
+    followDirectoryMoves(dirp->entryList, dirp->readVersion);
+    fdDir *start = getDirByEntry(dirp->entryList);
+    if (start == NULL)
     {
-        eprintf("getDirByEntry() on parent");
         return -1;
     }
+    int retVal = statFrom(start, name, buf);
 
-    // remove directories other than . and ..
-    // . links to this deleted file and .. links to the parent
-    if (target->dirEntryAmount > 2)
-    {
-        for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
-        {
-            if (target->entryList[i].space == SPACE_USED)
-            {
-                // copy the path and cat with the entry name with slash
-                char *entryPath = malloc(strlen(pathname) + strlen(target->entryList[i].d_name) + 2);
-                if (entryPath == NULL)
-                {
-                    eprintf("malloc() on entryPath");
-                    return -1;
-                }
-                strcpy(entryPath, pathname);
-                strcat(entryPath, "/");
-                strcat(entryPath, target->entryList[i].d_name);
+    free(start);
+    start = NULL;
+    return retVal;
+}
 
-                // either remove directory or delete file
-                if (fs_isDir(entryPath))
-                {
-                    // fs_rmdir shouldn't fail so only check errors
-                    if (fs_rmdir(entryPath) != 0)
-                    {
-                        eprintf("fs_rmdir()");
-                        return -1;
-                    }
-                }
-                else if (fs_isFile(entryPath))
-                {
-                    if (fs_delete(entryPath) != 0)
-                    {
-                        return -1;
-                    }
-                }
-                else
-                {
-                    return -1;
-                }
-            }
-        }
-    }
+/**
+ * @brief make a new directory from an opened directory
+ * 
+ * @param session the session, it gives the volume of the directory
+ * @param dirp the opened directory the path starts from
+ * @param pathname the path of the new directory
+ * @param mode mode of the directory
+ * @return 0 for success, -1 for fail
+ */
+int fs_mkdirat(fsSession *session, fdDir *dirp, const char *pathname, mode_t mode)
+{
+    currentVolume = session->volume;
 
-    // redirect cwd to the parent if the directory is going to be deleted
-    if (target->directoryStartLocation == fsCWD->directoryStartLocation)
+    journalBegin();
+
+    // the opened copy can be older than the volume, read it again inside the transaction
+    followDirectoryMoves(dirp->entryList, dirp->readVersion);
+    fdDir *start = getDirByEntry(dirp->entryList);
+    int retVal = -1;
+    if (start != NULL)
     {
-        printf("\n*** cwd is being removed, redirect to parent ***\n");
-        fs_setcwd("..");
+        retVal = mkdirByPath(start, pathname, mode);
     }
+    journalEnd();
 
-    // find the entry in the parent and set it as free
-    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    free(start);
+    start = NULL;
+    return retVal;
+}
+
+/**
+ * @brief remove a file, or a directory with AT_REMOVEDIR, from an opened directory
+ * 
+ * @param session the session, it gives the volume of the directory
+ * @param dirp the opened directory the path starts from
+ * @param pathname the path to remove
+ * @param flags 0 or AT_REMOVEDIR
+ * @return 0 for success, -1 for fail
+ */
+int fs_unlinkat(fsSession *session, fdDir *dirp, const char *pathname, int flags)
+{
+    currentVolume = session->volume;
+
+    journalBegin();
+
+    // the opened copy can be older than the volume, read it again inside the transaction
+    followDirectoryMoves(dirp->entryList, dirp->readVersion);
+    fdDir *start = getDirByEntry(dirp->entryList);
+    int retVal = -1;
+    if (start != NULL && (flags & AT_REMOVEDIR))
     {
-        if (parent->entryList[i].space == SPACE_USED &&
-            parent->entryList[i].fileType == TYPE_DIR &&
-            strcmp(parent->entryList[i].d_name, target->dirName) == 0)
-        {
-            parent->entryList[i].space = SPACE_FREE;
-            parent->dirEntryAmount--;
-            updateDirectory(parent);
-            break;
-        }
+        retVal = rmdirByPath(session, start, pathname);
     }
-
-    // release the blocks occupied by the directory
-    if (releaseFreespace(target->directoryStartLocation, getBlockCount(target->d_reclen)) != 0)
+    else if (start != NULL)
     {
-        eprintf("releaseFreespace() falied");
-        return -1;
+        retVal = deleteByPath(start, pathname);
     }
+    journalEnd();
 
-    printf("\n%s : %s was removed\n", pathname, target->dirName);
-
-    free(target);
-    free(parent);
-    target = NULL;
-    parent = NULL;
-
-    return 0;
+    free(start);
+    start = NULL;
+    return retVal;
 }
 
 /**
- * @brief release the blocks in the freespace bitmap
+ * @brief copy a file by making the destination point to the extent of the
+ * source, only the directory of the destination is written
  * 
- * @param start the starting index
- * @param count amount of blocks
+ * files are never written in place, a later write always goes into a
+ * newly allocated extent, so either side changing leaves the other intact
+ * 
+ * @param session the session
+ * @param src path to the source file
+ * @param dst path to the new file
  * @return 0 for success, -1 for fail
  */
-int releaseFreespace(uint64_t start, uint64_t count)
+int fs_clone_r(fsSession *session, char *src, char *dst)
 {
-    // handle error of invalid count, generally not goint to happen
-    if (start < (ourVCB->freespaceBlockCount + ourVCB->vcbBlockCount) || count < 1 || start + count > ourVCB->numberOfBlocks)
+    currentVolume = session->volume;
+
+    // find the directory and entry of the source
+    char *srcParentPath = fsMalloc(strlen(src) + 1);
+    char *dstParentPath = fsMalloc(strlen(dst) + 1);
+    if (srcParentPath == NULL || dstParentPath == NULL)
     {
-        eprintf("invalid arg");
-        return -2;
+        eprintf("malloc() on parent path");
+        free(srcParentPath);
+        free(dstParentPath);
+        return -1;
+    }
+    strcpy(srcParentPath, src);
+    strcpy(dstParentPath, dst);
+    char *srcName = getPathByLastSlash(srcParentPath);
+    char *dstName = getPathByLastSlash(dstParentPath);
+
+    // the extent table and the directory are changed in one transaction,
+    // which also keeps other sessions from changing the parents after they are read
+    journalBegin();
+    fdDir *srcParent = getDirByPath(session, srcParentPath);
+    fdDir *dstParent = getDirByPath(session, dstParentPath);
+    int retVal = -1;
+    struct fs_diriteminfo *srcEntry = NULL;
+    if (srcParent != NULL)
+    {
+        int i = findEntry(srcParent, srcName, strlen(srcName));
+        if (i >= 0 && srcParent->entryList[i].fileType == TYPE_FILE)
+        {
+            srcEntry = srcParent->entryList + i;
+        }
     }
 
-    for (uint64_t i = 0; i < count; i++)
+    if (srcEntry == NULL)
     {
-        // handle error when setBitFree get in errors
-        if (setBitFree(start + i, freespace) != 0)
+        printf("%s is not a file\n", src);
+    }
+    else if (dstParent == NULL || strcmp(dstName, "") == 0)
+    {
+        printf("%s is not a valid destination\n", dst);
+    }
+    else if (dstParent->dirEntryAmount >= MAX_AMOUNT_OF_ENTRIES)
+    {
+        printf("reaches the max of entries of a directory\n");
+    }
+    else
+    {
+        // NOTE: must check all, because we don't want user to create . and .. !!!
+        int exists = findEntry(dstParent, dstName, strlen(dstName)) >= 0;
+
+        // the extent needs a slot in the table before it is shared
+        extentRef *ref = NULL;
+        if (exists)
         {
-            // this won't run if checkBit() works as expected
-            eprintf("setBitFree() failed, bit at %ld", start + i);
+            printf("\nsame name of directory or file existed\n");
+        }
+        else
+        {
+            ref = findExtentByStart(srcEntry->entryStartLocation);
+            if (ref == NULL)
+            {
+                // the stored bytes are read for the hash only when dedup can look it up
+                uint64_t blockCount = getExtentBlockCount(srcEntry);
+                uint64_t fingerprint = 0;
+                if (ourVCB->featureFlags & FEATURE_DEDUP)
+                {
+                    fingerprint = fingerprintExtent(srcEntry->entryStartLocation, blockCount,
+                                                    srcEntry->size, srcEntry->attributes);
+                }
+                ref = addExtentRef(srcEntry->entryStartLocation, blockCount,
+                                   srcEntry->size, srcEntry->attributes, fingerprint);
+            }
+        }
 
-            // we should mark those back in order to recover
-            for (i--; i >= 0; i--)
+        if (ref != NULL && shareExtent(ref) == 0)
+        {
+            // both paths can be in the same directory, so only keep one copy
+            if (dstParent->directoryStartLocation == srcParent->directoryStartLocation)
             {
-                setBitUsed(start + i, freespace);
+                free(dstParent);
+                dstParent = srcParent;
             }
-            return -1;
+
+            for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+            {
+                if (dstParent->entryList[i].space == SPACE_FREE)
+                {
+                    memcpy(dstParent->entryList + i, srcEntry, sizeof(struct fs_diriteminfo));
+                    strncpy(dstParent->entryList[i].d_name, dstName, MAX_NAME_LENGTH - 1);
+                    dstParent->entryList[i].d_name[MAX_NAME_LENGTH - 1] = '\0';
+
+                    // the copy shares the blocks but not the inode
+                    dstParent->entryList[i].inodeNumber = allocInode(dstParent->entryList + i);
+                    dstParent->dirEntryAmount++;
+                    updateDirectory(dstParent);
+                    addTreeUsage(dstParent->entryList, srcEntry->size, getExtentBlockCount(srcEntry));
+                    break;
+                }
+            }
+
+            dprintf("%s shares the extent at %ld with %s", dst, ref->start, src);
+            retVal = 0;
+        }
+        else if (!exists)
+        {
+            printf("failed to share the extent of %s\n", src);
         }
     }
 
-    // simply compare if the freed block is before the freeblock index
-    if (start < ourVCB->firstFreeBlockIndex)
+    journalEnd();
+
+    if (dstParent == srcParent)
     {
-        // set the new first free block index and update ourVCB
-        dprintf("first free block index changes to %ld\n", start);
-        ourVCB->firstFreeBlockIndex = start;
-        updateOurVCB();
+        dstParent = NULL;
     }
+    free(srcParentPath);
+    free(dstParentPath);
+    free(srcName);
+    free(dstName);
+    free(srcParent);
+    free(dstParent);
+    srcParentPath = NULL;
+    dstParentPath = NULL;
+    srcName = NULL;
+    dstName = NULL;
+    srcParent = NULL;
+    dstParent = NULL;
+    return retVal;
+}
 
-    // return the starting block index of this allocated space
-    updateFreespace();
-    return 0;
+/**
+ * @brief copy a file by making the destination point to the extent of the source
+ * 
+ * @param src path to the source file
+ * @param dst path to the new file
+ * @return 0 for success, -1 for fail
+ */
+int fs_clone(char *src, char *dst)
+{
+    return fs_clone_r(fsDefaultSession, src, dst);
 }
 
 /**
- * @brief delete a file based on the path or filename
+ * @brief move a file or directory by moving only its entry,
+ * the blocks of the file or directory stay where they are
  * 
- * @param filename may hold a path or filename
+ * every write is in one journal transaction, so a crash can't leave
+ * the item in both directories or in none
+ * 
+ * @param session the session
+ * @param oldPath path to the file or directory
+ * @param newPath new path, or an existing directory to move into
  * @return 0 for success, -1 for fail
  */
-int fs_delete(char *filename)
+int fs_rename_r(fsSession *session, char *oldPath, char *newPath)
 {
-    char *pathBeforeLastSlash = malloc(strlen(filename) + 1);
-    if (pathBeforeLastSlash == NULL)
+    currentVolume = session->volume;
+
+    char *oldParentPath = fsMalloc(strlen(oldPath) + 1);
+    char *newParentPath = fsMalloc(strlen(newPath) + 1);
+    if (oldParentPath == NULL || newParentPath == NULL)
     {
-        eprintf("malloc() on pathBeforeLastSlash");
+        eprintf("malloc() on parent path");
+        free(oldParentPath);
+        free(newParentPath);
         return -1;
     }
-    strcpy(pathBeforeLastSlash, filename);
-    char *trueFileName = getPathByLastSlash(pathBeforeLastSlash);
-
-    // find the directory that is expected for holding that file
-    fdDir *parent = getDirByPath(pathBeforeLastSlash);
+    strcpy(oldParentPath, oldPath);
+    strcpy(newParentPath, newPath);
+    char *oldName = getPathByLastSlash(oldParentPath);
+    char *newName = NULL;
+
+    // both parents and the moved directory are changed in one transaction,
+    // which also keeps other sessions from changing them after they are read
+    journalBegin();
+    fdDir *oldParent = getDirByPath(session, oldParentPath);
+    fdDir *newParent = getDirByPath(session, newPath);
+    fdDir *moved = NULL;
+
+    // moving into an existing directory keeps the name
+    if (newParent != NULL)
+    {
+        newName = fsMalloc(strlen(oldName) + 1);
+        if (newName != NULL)
+        {
+            strcpy(newName, oldName);
+        }
+    }
+    else
+    {
+        newName = getPathByLastSlash(newParentPath);
+        newParent = getDirByPath(session, newParentPath);
+    }
 
-    // find the file starting location to delete
-    uint64_t start = -1;
-    uint64_t size = -1;
-    for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+    // find the entry to move, . and .. can't be moved
+    int retVal = -1;
+    int oldIndex = -1;
+    if (oldParent != NULL)
     {
-        if (parent->entryList[i].space == SPACE_USED &&
-            parent->entryList[i].fileType == TYPE_FILE &&
-            strcmp(parent->entryList[i].d_name, trueFileName) == 0)
+        // . and .. can't be moved
+        oldIndex = findEntry(oldParent, oldName, strlen(oldName));
+        if (oldIndex < 2)
         {
-            start = parent->entryList[i].entryStartLocation;
-            size = parent->entryList[i].size;
-            parent->entryList[i].space = SPACE_FREE;
-            parent->dirEntryAmount--;
-            updateDirectory(parent);
-            break;
+            oldIndex = -1;
         }
     }
 
-    // release the blocks occupied by the directory
-    if (releaseFreespace(start, getBlockCount(size)) != 0)
+    if (oldIndex < 0)
     {
-        eprintf("releaseFreespace() falied");
-        return -1;
+        printf("%s is not found\n", oldPath);
+    }
+    else if (newParent == NULL || newName == NULL || strcmp(newName, "") == 0 ||
+             strcmp(newName, ".") == 0 || strcmp(newName, "..") == 0)
+    {
+        printf("%s is not a valid destination\n", newPath);
     }
+    else
+    {
+        struct fs_diriteminfo *entry = oldParent->entryList + oldIndex;
+        int sameParent = newParent->directoryStartLocation == oldParent->directoryStartLocation;
+
+        // a directory can't go inside itself, walk up from the new parent to check
+        int intoItself = 0;
+        if (entry->fileType == TYPE_DIR)
+        {
+            fdDir *ancestor = allocDir();
+            if (ancestor != NULL)
+            {
+                memcpy(ancestor, newParent, sizeof(fdDir));
+            }
+            while (ancestor != NULL)
+            {
+                if (ancestor->directoryStartLocation == entry->entryStartLocation)
+                {
+                    intoItself = 1;
+                }
+                if (intoItself || ancestor->directoryStartLocation == ourVCB->rootDirLocation)
+                {
+                    break;
+                }
+                fdDir *tempPtr = getDirByEntry(ancestor->entryList + 1);
+                releaseDir(ancestor);
+                ancestor = tempPtr;
+            }
+            releaseDir(ancestor);
+            ancestor = NULL;
+        }
 
-    printf("\n%s : %s was removed\n", filename, trueFileName);
+        // the new name must be free, except renaming to the same name
+        int i = findEntry(newParent, newName, strlen(newName));
+        int exists = i >= 0 && !(sameParent && i == oldIndex);
 
-    free(pathBeforeLastSlash);
-    free(trueFileName);
-    pathBeforeLastSlash = NULL;
-    trueFileName = NULL;
-    return 0;
-}
\ No newline at end of file
+        if (intoItself)
+        {
+            printf("%s can't be moved into itself\n", oldPath);
+        }
+        else if (exists)
+        {
+            printf("\nsame name of directory or file existed\n");
+        }
+        else if (!sameParent && newParent->dirEntryAmount >= MAX_AMOUNT_OF_ENTRIES)
+        {
+            printf("reaches the max of entries of a directory\n");
+        }
+        else
+        {
+            // a directory keeps its own name and a link to its parent
+            if (entry->fileType == TYPE_DIR)
+            {
+                moved = getDirByEntry(entry);
+            }
+
+            // the usage leaves the old parents for the new ones, a directory
+            // not counted yet is counted before it goes under a counted one
+            int64_t movedBytes = 0, movedBlocks = 0;
+            if (entry->fileType != TYPE_DIR)
+            {
+                movedBytes = entry->size;
+                movedBlocks = getExtentBlockCount(entry);
+            }
+            else if (moved != NULL && !sameParent)
+            {
+                if (moved->usedBlocks == 0 && newParent->usedBlocks != 0)
+                {
+                    countTreeUsage(moved);
+                }
+                movedBytes = moved->usedBytes;
+                movedBlocks = moved->usedBlocks;
+            }
+
+            if (sameParent)
+            { // only the name changes
+                strncpy(entry->d_name, newName, MAX_NAME_LENGTH - 1);
+                entry->d_name[MAX_NAME_LENGTH - 1] = '\0';
+                updateDirectory(oldParent);
+            }
+            else
+            {
+                for (int i = 2; i < MAX_AMOUNT_OF_ENTRIES; i++)
+                {
+                    if (newParent->entryList[i].space == SPACE_FREE)
+                    {
+                        memcpy(newParent->entryList + i, entry, sizeof(struct fs_diriteminfo));
+                        strncpy(newParent->entryList[i].d_name, newName, MAX_NAME_LENGTH - 1);
+                        newParent->entryList[i].d_name[MAX_NAME_LENGTH - 1] = '\0';
+                        newParent->dirEntryAmount++;
+                        updateDirectory(newParent);
+                        break;
+                    }
+                }
+            }
+
+            if (moved != NULL)
+            {
+                strncpy(moved->dirName, newName, MAX_NAME_LENGTH - 1);
+                moved->dirName[MAX_NAME_LENGTH - 1] = '\0';
+
+                // .. is a copy of the . entry of the parent
+                memcpy(moved->entryList + 1, newParent->entryList, sizeof(struct fs_diriteminfo));
+                strcpy(moved->entryList[1].d_name, "..");
+                updateDirectory(moved);
+
+                // the cached cwd path of every session inside it is wrong now
+                __atomic_add_fetch(&nameVersion, 1, __ATOMIC_RELEASE);
+            }
+
+            if (!sameParent)
+            {
+                entry->space = SPACE_FREE;
+                oldParent->dirEntryAmount--;
+                updateDirectory(oldParent);
+                addTreeUsage(oldParent->entryList, -movedBytes, -movedBlocks);
+                addTreeUsage(newParent->entryList, movedBytes, movedBlocks);
+            }
+
+            dprintf("%s is moved to %s", oldPath, newPath);
+            retVal = 0;
+        }
+    }
+    journalEnd();
+
+    free(oldParentPath);
+    free(newParentPath);
+    free(oldName);
+    free(newName);
+    free(oldParent);
+    free(newParent);
+    free(moved);
+    oldParentPath = NULL;
+    newParentPath = NULL;
+    oldName = NULL;
+    newName = NULL;
+    oldParent = NULL;
+    newParent = NULL;
+    moved = NULL;
+    return retVal;
+}
+
+/**
+ * @brief move a file or directory by moving only its entry
+ * 
+ * @param oldPath path to the file or directory
+ * @param newPath new path, or an existing directory to move into
+ * @return 0 for success, -1 for fail
+ */
+int fs_rename(char *oldPath, char *newPath)
+{
+    return fs_rename_r(fsDefaultSession, oldPath, newPath);
+}
@@ -20,12 +20,15 @@ Siqi Guo, 918209895, Guo-1999
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "b_io.h"
 #include "fsLow.h"
+#include "device.h"
 
 #ifndef uint64_t
 typedef u_int64_t uint64_t;
@@ -68,27 +71,115 @@ typedef u_int32_t uint32_t;
 #define TYPE_DIR 0
 #define TYPE_FILE 1
 #define MAX_NAME_LENGTH 256
+
+// bits of fs_diriteminfo.attributes
+#define ATTR_COMPRESSED 0x01 // the extent starts with a compressHeader
+
 struct fs_diriteminfo
 {
 	unsigned short d_reclen; /* length of this record */
 	unsigned char fileType;
 	unsigned char space;		  // determine this entry is free or used
+	unsigned char attributes;	  // ATTR_* bits, takes the old padding byte
 	uint64_t entryStartLocation;  // LBA of the entry, either a file or directory
 	uint64_t size;				  // the exact size of the file occupies
 	char d_name[MAX_NAME_LENGTH]; /* filename max filename is 255 characters */
+	uint32_t inodeNumber;		  // slot in the inode table + 1, 0 if the entry has none
 };
 
-#define MAX_AMOUNT_OF_ENTRIES 8
+// the part of fs_diriteminfo that version 1 wrote on the volume
+#define DIR_V1_ENTRY_SIZE offsetof(struct fs_diriteminfo, inodeNumber)
+
+#define MAX_AMOUNT_OF_ENTRIES 8 // keep it a multiple of 4, see findEntry()
 typedef struct
 {
 	unsigned short d_reclen;		 /*length of this record */
 	uint64_t directoryStartLocation; /*Starting LBA of directory */
 	unsigned short dirEntryAmount;	 // amount of undeleted entries
 	char dirName[MAX_NAME_LENGTH];	 // name of this directory
+	unsigned short dirEntryPosition; // next entry of fs_readdir(), takes padding only
 	struct fs_diriteminfo entryList[MAX_AMOUNT_OF_ENTRIES];
-	// unsigned short dirEntryPosition; // we keep it as global value
+
+	// kept next to each other so findEntry() compares all of them at once,
+	// set again by updateDirectory() and when the directory is read
+	uint32_t nameHash[MAX_AMOUNT_OF_ENTRIES];		 // hashName() of each d_name
+	unsigned char nameLength[MAX_AMOUNT_OF_ENTRIES]; // length of each d_name, 0 if free
+
+	// the whole subtree, kept up to date by addTreeUsage()
+	uint64_t usedBytes;	 // size of every file under it
+	uint64_t usedBlocks; // blocks of every file and directory under it and its own, 0 if not counted yet
+
+	// dirVersion when it was read, see followDirectoryMoves()
+	uint64_t readVersion;
 } fdDir;
 
+// the size of fdDir in version 1, also the bytes reserved for a directory
+// on the volume, a packed directory always fits in its blocks
+#define DIR_V1_SIZE (offsetof(fdDir, entryList) + MAX_AMOUNT_OF_ENTRIES * DIR_V1_ENTRY_SIZE)
+#define DIR_EXTENT_SIZE DIR_V1_SIZE
+
+// on the volume only the used entries of a directory are kept and each name
+// takes its own length, the fixed fdDir above is the form used in memory
+#define DIR_MAGIC 0x32524944 // stands for "DIR2"
+#define DIR_FORMAT_VERSION 2 // version 1 is fdDir written as it is, still read
+
+// layout of a packed directory: header | dirName | usage | record + d_name | ...
+typedef struct
+{
+	uint32_t magicNumber;
+	unsigned short version;			 // DIR_FORMAT_VERSION
+	unsigned short packedLength;	 // bytes taken by the whole packed directory
+	uint64_t directoryStartLocation; // Starting LBA of directory
+	unsigned short dirEntryAmount;	 // amount of undeleted entries
+	unsigned char recordCount;		 // amount of records after dirName
+	unsigned char nameLength;		 // length of dirName, no null terminator
+} packedDirHeader;
+
+// one used entry, followed by nameLength bytes of d_name
+typedef struct __attribute__((packed))
+{
+	unsigned char slot; // index in entryList, so entries keep their place
+	unsigned char fileType;
+	unsigned char attributes;
+	unsigned char nameLength; // length of d_name, no null terminator
+	uint64_t entryStartLocation;
+	uint64_t size;
+	uint32_t nameHash;	  // hashName() of d_name
+	uint32_t inodeNumber;
+} packedDirRecord;
+
+// usage of the subtree, right after dirName
+typedef struct __attribute__((packed))
+{
+	uint64_t usedBytes;
+	uint64_t usedBlocks;
+} packedDirUsage;
+
+// every fdDir is allocated with this size, so whole blocks of 512 up to
+// 4096 bytes are read into it directly, see allocDir()
+#define DIR_BUFFER_SIZE 4096
+#define DIR_POOL_SIZE 16 // released directories kept by each thread
+
+// a session has its own working directory, so threads with their own
+// session can move around and list directories at the same time
+typedef struct fsSession
+{
+	struct fsVolume *volume; // volume the paths are looked up in
+	fdDir *cwd;			 // copy of the working directory
+	uint64_t cwdVersion; // dirVersion when cwd was read
+	fdDir *lastOpened;	 // names given to fs_stat() are looked up here first
+	char *cwdPath;		 // path given by fs_getcwd(), kept up to date by fs_setcwd()
+	size_t cwdPathLength;
+	size_t cwdPathCapacity;
+	uint64_t cwdPathVersion; // nameVersion when cwdPath was right, or CWD_PATH_UNKNOWN
+} fsSession;
+
+#define CWD_PATH_UNKNOWN ((uint64_t)-1) // cwdPath is built again by fs_getcwd()
+
+// must matchthe size, currently it is 8 bytes
+#define MAGIC_NUMBER 0x53465F45524F4946 // stands for "FIORE_FS"
+#define INODE_TABLE_MAX_SEGMENTS 32		 // the inode table grows one segment at a time, see inode.h
+
 typedef struct
 {
 	uint64_t magicNumber;
@@ -98,27 +189,175 @@ typedef struct
 	uint freespaceBlockCount;	  // used for check when it is not the first run
 	uint64_t firstFreeBlockIndex; // used for check when it is not the first run
 	uint64_t rootDirLocation;	  // can be calculated by adding the other two counts
+	uint64_t featureFlags;		  // FEATURE_* bits, 0 on volumes made before it
+	uint64_t refTableLocation;	  // LBA of the shared extent table, 0 if none yet
+	uint64_t journalLocation;	  // LBA of the metadata journal, 0 if none yet
+	uint64_t journalBlockCount;	  // length of the journal in blocks
+	uint64_t journalHead;		  // offset of the oldest record not checkpointed
+	uint64_t journalSequence;	  // sequence of the record at journalHead
+	uint64_t freespaceSummaryLocation; // LBA of the free count of each group, 0 if none yet
+	uint64_t prefetchPlanLocation;	   // LBA of the directories to read early, 0 if none yet
+	uint64_t volumeState;			   // VOLUME_CLEAN only while it is not mounted
+	uint64_t inodeTableLocation;	   // LBA of the inode table, 0 if none yet
+	uint64_t freeBlockCount;		   // free blocks of the volume, only valid with FEATURE_FREE_COUNT
+	uint64_t refTableBlockCount;	   // length of the shared extent table, 0 for REF_TABLE_BLOCK_COUNT
+	uint64_t inodeSegmentLocation[INODE_TABLE_MAX_SEGMENTS - 1]; // LBA of each inode table segment after the first, 0 if not added yet
 } vcb;
 
+// values of vcb.volumeState
+#define VOLUME_DIRTY 0 // mounted, or not closed by exitFileSystem()
+#define VOLUME_CLEAN 1 // everything was written home at the last unmount
+
+// bits of vcb.featureFlags
+#define FEATURE_COMPRESSION 0x01 // compress files when they are written back
+#define FEATURE_DEDUP 0x02		 // identical files share the same extent
+#define FEATURE_LOCALITY 0x04	 // files and directories are placed near their parent
+#define FEATURE_FREE_COUNT 0x08	 // freeBlockCount is kept, older volumes count it at the next mount
+
+// the freespace bitmap is loaded one block (page) at a time,
+// each page is a group which has its free count kept in the summary
+typedef struct
+{
+	uint64_t pageCount;				// amount of bitmap blocks, also amount of groups
+	uint64_t blocksPerPage;			// blocks covered by one page
+	uint64_t groupsPerSummaryBlock; // counters held by one summary block
+	uint64_t summaryBlockCount;		// amount of summary blocks
+	int **pages;					// bitmap pages, NULL until touched
+	uint32_t **summary;				// summary blocks, NULL until touched
+	uint64_t loadedPages;			// amount of pages in memory
+	unsigned char *dirtyFlags;		// 1 for a page or summary block in dirtyList
+	uint64_t *dirtyList;			// pages, then pageCount + summary blocks, to write
+	uint64_t dirtyCount;
+	uint64_t dirtyCapacity;
+	uint64_t spreadCursor;			// group after the one given to the last top level directory
+} freespaceMap;
+
+struct extentRef;
+struct inode;
+struct journalState;
+struct prefetchState;
+
+// everything kept in memory for one mounted volume,
+// a process can mount several volume files at the same time
+typedef struct fsVolume
+{
+	vcb *controlBlock;			   // seen as ourVCB while the volume is in use
+	freespaceMap *bitmap;		   // seen as freespace
+	fsSession *defaultSession;	   // seen as fsDefaultSession on the default volume
+	uint64_t directoryVersion;	   // seen as dirVersion
+	uint64_t namespaceVersion;	   // seen as nameVersion
+	struct journalState *journal;  // owned by journal.c
+	struct prefetchState *prefetch; // owned by prefetch.c
+	struct defragState *defrag;	   // owned by defrag.c
+	struct extentRef *refTable;	   // shared extent table, NULL until loaded
+	uint refTableCapacity;
+	uint refTableUsed;			   // slots with a reference, 0 skips every lookup
+	struct inode *inodeSegments[INODE_TABLE_MAX_SEGMENTS]; // inode table, NULL until loaded, a segment never moves
+	uint inodeSegmentCount;
+	uint inodeTableCapacity;	   // inodes in the loaded segments, read without a lock
+	uint64_t inodeDirtyBlocks[INODE_TABLE_MAX_SEGMENTS]; // blocks of each segment with access times not written yet
+	int deviceFd;				   // volume file, -1 for the partition of fsLow
+	uint64_t deviceBlockSize;
+	int readOnly;				   // 1 to drop every write, fsck without -r
+} fsVolume;
+
+// a path resolved by fs_lookup(), the calls taking it reuse the
+// directory read by the lookup instead of walking the path again
+typedef struct fsEntry
+{
+	fsVolume *volume;			  // volume the entry is on
+	fdDir *parent;				  // copy of the directory holding the entry
+	struct fs_diriteminfo *entry; // the entry inside parent, gives type, size and location
+	int refCount;				  // the handle is freed when it drops to 0
+} fsEntry;
+
 // vcb and freespace related function
-fdDir *createDirectory(struct fs_diriteminfo *, char *);
+fdDir *createDirectory(struct fs_diriteminfo *, const char *);
 uint64_t allocateFreespace(uint64_t requestedBlock);
+uint64_t allocateFreespaceNear(uint64_t requestedBlock, uint64_t goal);
+uint64_t placementGoal(struct fs_diriteminfo *parent, int fileType, uint64_t requestedBlock);
 int updateOurVCB();
 int updateFreespace();
 int updateDirectory(fdDir *);
+int addTreeUsage(struct fs_diriteminfo *, int64_t, int64_t);
+uint64_t packDirectory(fdDir *, char *);
+uint32_t hashName(const char *, size_t);
+void hashEntryNames(fdDir *);
+int findEntry(fdDir *, const char *, size_t);
+int unpackDirectory(const char *, uint64_t, fdDir *);
 int updateByLBAwrite(void *, uint64_t, uint);
 uint getBlockCount(uint64_t);
-fdDir *getDirByPath(char *);
+void refreshCwd(fsSession *);
+fdDir *getDirByPath(fsSession *, const char *);
+fdDir *getDirFrom(fdDir *, const char *);
+fdDir *getDirFromN(fdDir *, const char *, size_t);
+fdDir *allocDir();
+void releaseDir(fdDir *);
+
+// heap allocations made by the paths of the file system, shown by openbench
+extern unsigned long fsAllocationCount;
+void *fsMalloc(size_t);
+void *fsCalloc(size_t, size_t);
+void *fsRealloc(void *, size_t);
+fdDir *getRootDir();
 char *getPathByLastSlash(char *);
+const char *getNameByLastSlash(const char *, size_t *);
 fdDir *getDirByEntry(struct fs_diriteminfo *);
 int releaseFreespace(uint64_t, uint64_t);
+uint64_t getExtentBlockCount(struct fs_diriteminfo *);
+int fs_setfeature(uint64_t feature, int enabled);
+int fs_sync();
+freespaceMap *openFreespace();
+void closeFreespace(freespaceMap *);
+int formatFreespace();
+int loadFreespace();
+int checkFreespace();
+int checkBit(uint64_t);
+int setBitUsed(uint64_t);
+int setBitFree(uint64_t);
+uint64_t findFreeBlock(uint64_t);
+uint64_t findFreeRun(uint64_t, uint64_t);
+uint64_t spreadGoal(uint64_t);
+
+// the volume used by this thread, each call with a session or a fd
+// selects the volume of it, defined in mfs.c
+extern __thread fsVolume *currentVolume;
+
+// the volume mounted by initFileSystem(), used by every call without a session
+extern fsVolume *defaultVolume;
+
+// the state of the volume in use, read and written like the globals
+// they used to be (the same way errno works)
+#define ourVCB (currentVolume->controlBlock)
+#define freespace (currentVolume->bitmap)
+#define dirVersion (currentVolume->directoryVersion) // changes each time a directory is written
+#define nameVersion (currentVolume->namespaceVersion) // changes each time a directory is renamed or removed
+#define fsDefaultSession (defaultVolume->defaultSession)
+
+fsVolume *openVolume(char *fileName, uint64_t *volumeSize, uint64_t *blockSize);
+void closeVolume(fsVolume *volume);
+fsVolume *fs_mount(char *fileName, uint64_t volumeSize, uint64_t blockSize);
+int fs_unmount(fsVolume *volume);
+
+fsSession *fs_opensession(fsVolume *volume);
+void fs_closesession(fsSession *session);
+
+// same as the calls below, paths start from the cwd of the session
+int fs_mkdir_r(fsSession *session, const char *pathname, mode_t mode);
+int fs_rmdir_r(fsSession *session, const char *pathname);
+fdDir *fs_opendir_r(fsSession *session, const char *name);
+char *fs_getcwd_r(fsSession *session, char *buf, size_t size);
+int fs_setcwd_r(fsSession *session, char *buf);
+int fs_isFile_r(fsSession *session, char *path);
+int fs_isDir_r(fsSession *session, char *path);
+int fs_delete_r(fsSession *session, char *filename);
+int fs_clone_r(fsSession *session, char *src, char *dst);
+int fs_rename_r(fsSession *session, char *oldPath, char *newPath);
 
-// global values to keep track on our file system
-vcb *ourVCB;
-int *freespace;
-fdDir *fsCWD;
-fdDir *openedDir;
-uint64_t openedDirEntryIndex;
+// same as the calls above, paths start from an opened directory
+fdDir *fs_openat(fsSession *session, fdDir *dirp, const char *name);
+int fs_mkdirat(fsSession *session, fdDir *dirp, const char *pathname, mode_t mode);
+int fs_unlinkat(fsSession *session, fdDir *dirp, const char *pathname, int flags);
 
 int fs_mkdir(const char *pathname, mode_t mode);
 int fs_rmdir(const char *pathname);
@@ -131,6 +370,8 @@ int fs_setcwd(char *buf);	   //linux chdir
 int fs_isFile(char *path);	   //return 1 if file, 0 otherwise
 int fs_isDir(char *path);	   //return 1 if directory, 0 otherwise
 int fs_delete(char *filename); //removes a file
+int fs_clone(char *src, char *dst); //copies a file by sharing its blocks
+int fs_rename(char *oldPath, char *newPath); //moves a file or directory
 
 struct fs_stat
 {
@@ -143,5 +384,50 @@ struct fs_stat
 };
 
 int fs_stat(const char *path, struct fs_stat *buf);
+void fillStat(struct fs_diriteminfo *entry, struct fs_stat *buf);
+int fs_stat_r(fsSession *session, const char *path, struct fs_stat *buf);
+int fs_statat(fsSession *session, fdDir *dirp, const char *name, struct fs_stat *buf);
+
+struct fs_statvfs
+{
+	blksize_t f_bsize;		 /* block size */
+	fsblkcnt_t f_blocks;	 /* size of the volume in blocks */
+	fsblkcnt_t f_bfree;		 /* free blocks */
+	fsblkcnt_t f_bavail;	 /* free blocks a file can take */
+	unsigned long f_namemax; /* maximum length of a name */
+};
+
+int fs_statvfs(struct fs_statvfs *buf);
+int fs_statvfs_r(fsSession *session, struct fs_statvfs *buf);
+
+// usage of a directory and everything under it
+struct fs_dirusage
+{
+	uint64_t du_bytes;	/* size of every file */
+	uint64_t du_blocks; /* blocks of every file and directory */
+};
+
+int fs_dirusage(const char *path, struct fs_dirusage *buf);
+int fs_dirusage_r(fsSession *session, const char *path, struct fs_dirusage *buf);
+
+// an entry of fs_readdir_plus() with its status
+struct fs_direntplus
+{
+	unsigned char fileType; // TYPE_DIR or TYPE_FILE
+	char d_name[MAX_NAME_LENGTH];
+	struct fs_stat st;
+};
+
+int fs_readdir_plus(fdDir *dirp, struct fs_direntplus *buf, int n);
+int fs_readdir_plus_r(fsSession *session, fdDir *dirp, struct fs_direntplus *buf, int n);
+
+fsEntry *fs_lookup(const char *path);
+fsEntry *fs_lookup_r(fsSession *session, const char *path);
+fsEntry *fs_holdentry(fsEntry *handle);
+void fs_releaseentry(fsEntry *handle);
+int fs_isFileEntry(fsEntry *handle);
+int fs_isDirEntry(fsEntry *handle);
+int fs_statEntry(fsEntry *handle, struct fs_stat *buf);
+int fs_deleteEntry(fsEntry *handle);
 
 #endif
\ No newline at end of file
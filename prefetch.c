@@ -0,0 +1,382 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: prefetch.c
+*
+* Description: counts how often each directory is read during a
+* session and keeps the ones used the most as a plan on the volume
+* at unmount. the next mount reads the plan and a background thread
+* reads those directories into memory, so the first commands after
+* a restart don't wait for them. a directory written during the
+* session is dropped from memory, so a stale copy is never used.
+*
+**************************************************************/
+
+#include <pthread.h>
+
+#include "mfs.h"
+#include "journal.h"
+#include "prefetch.h"
+
+#define SLOT_PENDING 0 // not read yet
+#define SLOT_READY 1   // dir holds the directory
+#define SLOT_DROPPED 2 // written during the session, must be read again
+
+typedef struct
+{
+	uint64_t lba;
+	uint64_t hits;
+} accessCount;
+
+typedef struct
+{
+	uint64_t lba;
+	int state;
+	fdDir *dir;
+} prefetchSlot;
+
+// the counts and copies of one volume
+typedef struct prefetchState
+{
+	accessCount accessTable[PREFETCH_TRACKED];
+	uint accessTableCount;
+
+	prefetchSlot slots[PREFETCH_PLAN_ENTRIES];
+	uint slotCount;
+	uint prefetchHits;
+	pthread_mutex_t slotLock;
+	pthread_t worker;
+	int workerRunning;
+	volatile int stopWorker;
+} prefetchState;
+
+/**
+ * @brief create the prefetch state of a volume, nothing is read yet
+ *
+ * @return the state, NULL for fail
+ */
+prefetchState *openPrefetchState()
+{
+	prefetchState *prefetch = fsMalloc(sizeof(prefetchState));
+	if (prefetch == NULL)
+	{
+		eprintf("malloc() on prefetch");
+		return NULL;
+	}
+	memset(prefetch, 0, sizeof(prefetchState));
+	pthread_mutex_init(&prefetch->slotLock, NULL);
+	return prefetch;
+}
+
+/**
+ * @brief free the prefetch state of a volume, stopPrefetch() must be called first
+ *
+ * @param prefetch the state
+ */
+void closePrefetchState(prefetchState *prefetch)
+{
+	if (prefetch == NULL)
+	{
+		return;
+	}
+	pthread_mutex_destroy(&prefetch->slotLock);
+	free(prefetch);
+}
+
+/**
+ * @brief count one read of the directory at the LBA
+ *
+ * @param lba location of the directory
+ */
+void prefetchNoteAccess(uint64_t lba)
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	// sessions on other threads read directories at the same time
+	pthread_mutex_lock(&prefetch->slotLock);
+	for (uint i = 0; i < prefetch->accessTableCount; i++)
+	{
+		if (prefetch->accessTable[i].lba == lba)
+		{
+			prefetch->accessTable[i].hits++;
+			pthread_mutex_unlock(&prefetch->slotLock);
+			return;
+		}
+	}
+
+	// directories found after the table is full are not counted
+	if (prefetch->accessTableCount < PREFETCH_TRACKED)
+	{
+		prefetch->accessTable[prefetch->accessTableCount].lba = lba;
+		prefetch->accessTable[prefetch->accessTableCount].hits = 1;
+		prefetch->accessTableCount++;
+	}
+	pthread_mutex_unlock(&prefetch->slotLock);
+}
+
+/**
+ * @brief copy the directory at the LBA if the background read has it
+ *
+ * @param lba location of the directory
+ * @param dir where to copy the fdDir
+ * @return 1 for found, 0 for not found
+ */
+int prefetchLookup(uint64_t lba, void *dir)
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	int found = 0;
+	pthread_mutex_lock(&prefetch->slotLock);
+	for (uint i = 0; i < prefetch->slotCount; i++)
+	{
+		if (prefetch->slots[i].lba == lba && prefetch->slots[i].state == SLOT_READY)
+		{
+			memcpy(dir, prefetch->slots[i].dir, sizeof(fdDir));
+			prefetch->prefetchHits++;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&prefetch->slotLock);
+	return found;
+}
+
+/**
+ * @brief drop the copy of a directory which is being written
+ *
+ * @param lba location of the directory
+ */
+void prefetchForget(uint64_t lba)
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	pthread_mutex_lock(&prefetch->slotLock);
+	for (uint i = 0; i < prefetch->slotCount; i++)
+	{
+		if (prefetch->slots[i].lba == lba)
+		{
+			prefetch->slots[i].state = SLOT_DROPPED;
+			free(prefetch->slots[i].dir);
+			prefetch->slots[i].dir = NULL;
+		}
+	}
+	pthread_mutex_unlock(&prefetch->slotLock);
+}
+
+/**
+ * @brief body of the background thread, reads each directory of the plan
+ *
+ * @param arg the volume to read from
+ * @return NULL
+ */
+static void *prefetchWorker(void *arg)
+{
+	currentVolume = arg;
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	uint fdDirBlockCount = getBlockCount(DIR_EXTENT_SIZE);
+	char *readBuffer = fsMalloc(fdDirBlockCount * ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return NULL;
+	}
+
+	for (uint i = 0; i < prefetch->slotCount && !prefetch->stopWorker; i++)
+	{
+		pthread_mutex_lock(&prefetch->slotLock);
+		int state = prefetch->slots[i].state;
+		pthread_mutex_unlock(&prefetch->slotLock);
+		if (state != SLOT_PENDING)
+		{
+			continue;
+		}
+
+		fdDir *dir = fsMalloc(sizeof(fdDir));
+		if (dir == NULL)
+		{
+			eprintf("malloc() on dir");
+			break;
+		}
+		deviceRead(readBuffer, fdDirBlockCount, prefetch->slots[i].lba);
+		if (unpackDirectory(readBuffer, fdDirBlockCount * ourVCB->blockSize, dir) != 0)
+		{ // left for getDirByEntry() to report
+			free(dir);
+			continue;
+		}
+
+		// it can be written while it was being read
+		pthread_mutex_lock(&prefetch->slotLock);
+		if (prefetch->slots[i].state == SLOT_PENDING)
+		{
+			prefetch->slots[i].dir = dir;
+			prefetch->slots[i].state = SLOT_READY;
+			dir = NULL;
+		}
+		pthread_mutex_unlock(&prefetch->slotLock);
+		free(dir);
+	}
+
+	free(readBuffer);
+	readBuffer = NULL;
+	return NULL;
+}
+
+/**
+ * @brief read the plan and start reading its directories in the background
+ *
+ * @return 0 for success, -1 for fail
+ */
+int startPrefetch()
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	if (ourVCB->prefetchPlanLocation == 0)
+	{
+		return 0;
+	}
+
+	// the plan is read here, so every write after the mount can drop its slot
+	char *readBuffer = fsMalloc(ourVCB->blockSize);
+	if (readBuffer == NULL)
+	{
+		eprintf("malloc() on readBuffer");
+		return -1;
+	}
+	journalLBAread(readBuffer, 1, ourVCB->prefetchPlanLocation);
+
+	prefetchPlanHeader *header = (prefetchPlanHeader *)readBuffer;
+	uint64_t *lbas = (uint64_t *)(header + 1);
+	uint capacity = (ourVCB->blockSize - sizeof(prefetchPlanHeader)) / sizeof(uint64_t);
+	if (header->magicNumber == PREFETCH_MAGIC)
+	{
+		for (uint i = 0; i < header->count && i < capacity && i < PREFETCH_PLAN_ENTRIES; i++)
+		{
+			if (lbas[i] < ourVCB->numberOfBlocks)
+			{
+				prefetch->slots[prefetch->slotCount].lba = lbas[i];
+				prefetch->slots[prefetch->slotCount].state = SLOT_PENDING;
+				prefetch->slots[prefetch->slotCount].dir = NULL;
+				prefetch->slotCount++;
+			}
+		}
+	}
+	free(readBuffer);
+	readBuffer = NULL;
+
+	if (prefetch->slotCount == 0)
+	{
+		return 0;
+	}
+
+	prefetch->stopWorker = 0;
+	if (pthread_create(&prefetch->worker, NULL, prefetchWorker, currentVolume) != 0)
+	{
+		eprintf("pthread_create() failed");
+		prefetch->slotCount = 0;
+		return -1;
+	}
+	prefetch->workerRunning = 1;
+	dprintf("prefetching %d directories", prefetch->slotCount);
+	return 0;
+}
+
+/**
+ * @brief wait for the background thread and free every copy
+ */
+void stopPrefetch()
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	if (prefetch->workerRunning)
+	{
+		prefetch->stopWorker = 1;
+		pthread_join(prefetch->worker, NULL);
+		prefetch->workerRunning = 0;
+		dprintf("%d directory reads were served by prefetch", prefetch->prefetchHits);
+	}
+
+	pthread_mutex_lock(&prefetch->slotLock);
+	for (uint i = 0; i < prefetch->slotCount; i++)
+	{
+		free(prefetch->slots[i].dir);
+		prefetch->slots[i].dir = NULL;
+	}
+	prefetch->slotCount = 0;
+	pthread_mutex_unlock(&prefetch->slotLock);
+}
+
+/**
+ * @brief compare two counts, the one read more goes first
+ */
+static int compareHits(const void *a, const void *b)
+{
+	const accessCount *left = a;
+	const accessCount *right = b;
+	if (left->hits == right->hits)
+	{
+		return 0;
+	}
+	return left->hits > right->hits ? -1 : 1;
+}
+
+/**
+ * @brief keep the directories read the most during this session as the
+ * plan of the next mount, called when the volume is closed cleanly
+ *
+ * @return 0 for success, -1 for fail
+ */
+int savePrefetchPlan()
+{
+	prefetchState *prefetch = currentVolume->prefetch;
+
+	if (ourVCB->prefetchPlanLocation == 0)
+	{
+		if (prefetch->accessTableCount == 0)
+		{ // nothing to remember, don't take a block for it
+			return 0;
+		}
+		uint64_t start = allocateFreespace(1);
+		if (start == -1)
+		{
+			eprintf("allocateFreespace() on prefetch plan");
+			return -1;
+		}
+		ourVCB->prefetchPlanLocation = start;
+		updateOurVCB();
+	}
+
+	char *writeBuffer = fsMalloc(ourVCB->blockSize);
+	if (writeBuffer == NULL)
+	{
+		eprintf("malloc() on writeBuffer");
+		return -1;
+	}
+	memset(writeBuffer, 0, ourVCB->blockSize);
+
+	qsort(prefetch->accessTable, prefetch->accessTableCount, sizeof(accessCount), compareHits);
+
+	prefetchPlanHeader *header = (prefetchPlanHeader *)writeBuffer;
+	uint64_t *lbas = (uint64_t *)(header + 1);
+	uint capacity = (ourVCB->blockSize - sizeof(prefetchPlanHeader)) / sizeof(uint64_t);
+	header->magicNumber = PREFETCH_MAGIC;
+	for (uint i = 0; i < prefetch->accessTableCount && i < capacity && i < PREFETCH_PLAN_ENTRIES; i++)
+	{
+		lbas[header->count++] = prefetch->accessTable[i].lba;
+	}
+
+	int retVal = journalLBAwrite(writeBuffer, ourVCB->blockSize, ourVCB->prefetchPlanLocation);
+	dprintf("prefetch plan keeps %d directories", header->count);
+
+	free(writeBuffer);
+	writeBuffer = NULL;
+	return retVal;
+}
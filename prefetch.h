@@ -0,0 +1,50 @@
+/**************************************************************
+* Class:  CSC-415-02 Summer 2021
+* Name: Team Fiore
+
+Haoyuan Tan(Sunny), 918274583, CiYuan53
+Minseon Park, 917199574, minseon-park
+Yong Chi, 920771004, ychi1
+Siqi Guo, 918209895, Guo-1999
+
+* Project: Basic File System
+*
+* File: prefetch.h
+*
+* Description: Interface of the prefetch plan, the directories
+*	used the most are recorded at unmount and read in the
+*	background at the next mount
+*
+**************************************************************/
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+#include <sys/types.h>
+
+#ifndef uint64_t
+typedef u_int64_t uint64_t;
+#endif
+#ifndef uint32_t
+typedef u_int32_t uint32_t;
+#endif
+
+#define PREFETCH_MAGIC 0x48435446 // stands for "FTCH"
+#define PREFETCH_TRACKED 256	  // directories counted in one session
+#define PREFETCH_PLAN_ENTRIES 32  // directories kept in the plan
+
+// the plan takes one block on the volume, the LBAs follow the header
+typedef struct
+{
+	uint32_t magicNumber;
+	uint32_t count; // amount of LBAs in the plan
+} prefetchPlanHeader;
+
+struct prefetchState *openPrefetchState();
+void closePrefetchState(struct prefetchState *prefetch);
+void prefetchNoteAccess(uint64_t lba);
+int prefetchLookup(uint64_t lba, void *dir);
+void prefetchForget(uint64_t lba);
+int startPrefetch();
+void stopPrefetch();
+int savePrefetchPlan();
+
+#endif